@@ -0,0 +1,114 @@
+#include <iostream>
+
+#include "BackpressurePolicy.h"
+#include "BlockParser.h"
+#include "Log.h"
+
+
+BackpressurePolicy::BackpressurePolicy()
+{
+    _isDegraded = false;
+    _lowPriorityEventsCount = 0;
+    for (uint32_t i = 0; i < MaxLowPriorityEvents; i++)
+    {
+        _skippedCounts[i] = 0;
+    }
+
+    _degradedPeriodsCount = 0;
+    _degradedBlocksCount = 0;
+    _skippedEventsCount = 0;
+    _skippedPayloadBytes = 0;
+}
+
+const std::wstring DotnetRuntimeProvider = L"Microsoft-Windows-DotNETRuntime";
+
+// the GC (including the gcdump related events) and the contention events are always parsed
+bool BackpressurePolicy::IsProtected(const std::wstring& providerName, uint32_t eventId)
+{
+    if (providerName != DotnetRuntimeProvider)
+        return false;
+
+    switch (eventId)
+    {
+        case EventIDs::GCStart:
+        case EventIDs::GCEnd:
+        case EventIDs::BulkType:
+        case EventIDs::GCBulkRootEdge:
+        case EventIDs::GCBulkRootConditionalWeakTableElementEdge:
+        case EventIDs::GCBulkNode:
+        case EventIDs::GCBulkEdge:
+        case EventIDs::GCBulkRootStaticVar:
+        case EventIDs::ContentionStart:
+        case EventIDs::ContentionStop:
+            return true;
+
+        default:
+            return false;
+    }
+}
+
+bool BackpressurePolicy::SetLowPriority(const std::wstring& providerName, uint32_t eventId)
+{
+    if ((_lowPriorityEventsCount == MaxLowPriorityEvents) || IsProtected(providerName, eventId))
+    {
+        LOG_ERROR("Event #" << eventId << " can't be skipped\n");
+        return false;
+    }
+
+    _lowPriorityEvents[_lowPriorityEventsCount] = { providerName, eventId };
+    _lowPriorityEventsCount++;
+    return true;
+}
+
+// only called once per event definition
+uint32_t BackpressurePolicy::GetPriorityIndex(const std::wstring& providerName, uint32_t eventId)
+{
+    for (uint32_t i = 0; i < _lowPriorityEventsCount; i++)
+    {
+        if ((_lowPriorityEvents[i].EventId == eventId) && (_lowPriorityEvents[i].ProviderName == providerName))
+            return FirstLowPriorityIndex + i;
+    }
+
+    return NormalPriorityIndex;
+}
+
+void BackpressurePolicy::Update(uint32_t waitingBlocksCount, uint32_t capacity)
+{
+    if (_isDegraded)
+    {
+        _degradedBlocksCount++;
+        if (waitingBlocksCount * 100 <= capacity * DegradedLowWatermarkPercent)
+        {
+            _isDegraded = false;
+            LOG_INFO("Parser has caught up (" << waitingBlocksCount << " blocks waiting): back to normal mode\n");
+        }
+    }
+    else
+    {
+        if (waitingBlocksCount * 100 >= capacity * DegradedHighWatermarkPercent)
+        {
+            _isDegraded = true;
+            _degradedPeriodsCount++;
+            _degradedBlocksCount++;
+            LOG_INFO("Parser is lagging behind (" << waitingBlocksCount << " blocks waiting): low priority events are skipped\n");
+        }
+    }
+}
+
+void BackpressurePolicy::GetStatistics(DegradedModeStatistics& stats)
+{
+    stats.DegradedPeriodsCount = _degradedPeriodsCount;
+    stats.DegradedBlocksCount = _degradedBlocksCount;
+    stats.SkippedEventsCount = _skippedEventsCount;
+    stats.SkippedPayloadBytes = _skippedPayloadBytes;
+    stats.IsDegraded = _isDegraded;
+}
+
+uint64_t BackpressurePolicy::GetSkippedEventsCount(const std::wstring& providerName, uint32_t eventId)
+{
+    uint32_t priorityIndex = GetPriorityIndex(providerName, eventId);
+    if (priorityIndex == NormalPriorityIndex)
+        return 0;
+
+    return _skippedCounts[priorityIndex - FirstLowPriorityIndex];
+}
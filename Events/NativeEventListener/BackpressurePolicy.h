@@ -0,0 +1,101 @@
+#pragma once
+#include <atomic>
+#include <string>
+#include <vector>
+#include <windows.h>
+#include <stdint.h>
+
+
+// more than enough for the few verbose events worth skipping
+const uint32_t MaxLowPriorityEvents = 32;
+
+// cached per event definition (see EventCacheMetadata::PriorityIndex): 0 means not known yet
+const uint32_t UnknownPriorityIndex = 0;
+const uint32_t NormalPriorityIndex = 1;
+const uint32_t FirstLowPriorityIndex = 2;   // + index of the low priority event
+
+// the session is degraded when that many blocks are waiting to be parsed (per 100 of the queue capacity)
+// and back to normal when the parser has caught up
+const uint32_t DegradedHighWatermarkPercent = 75;
+const uint32_t DegradedLowWatermarkPercent = 25;
+
+// without a reader thread (see EventPipeSessionHost), the lag is the number of read buffers already
+// received when the previous one has been parsed, out of this "capacity"
+const uint32_t HostedLagCapacity = 8;
+
+
+// the same event ID has a different meaning for each provider
+struct ProviderEventId
+{
+    std::wstring ProviderName;
+    uint32_t EventId;
+};
+
+
+// can be read from any thread while the session is running
+struct DegradedModeStatistics
+{
+    uint64_t DegradedPeriodsCount;
+    uint64_t DegradedBlocksCount;       // blocks parsed while degraded
+    uint64_t SkippedEventsCount;
+    uint64_t SkippedPayloadBytes;
+    bool IsDegraded;
+};
+
+
+// When the handlers are too slow, the blocks pile up between the reader and the parser threads
+// and the reader ends up waiting: the runtime then drops events from its buffers without any
+// distinction. Instead, while the parser lags behind, the payload of the low priority events
+// is skipped (they are only counted) so that the parser catches up and the reader never waits.
+// Note: the GC and contention events can't be skipped
+class BackpressurePolicy
+{
+public:
+    BackpressurePolicy();
+
+    // return false for the events that must never be skipped
+    // Note: must be called before the first event is received
+    bool SetLowPriority(const std::wstring& providerName, uint32_t eventId);
+
+    // called by the parser thread before each block with the number of blocks waiting
+    void Update(uint32_t waitingBlocksCount, uint32_t capacity);
+
+    // called for each event: true if the payload must be skipped
+    // Note: priorityIndex is cached by the caller per event definition
+    bool ShouldSkip(uint32_t eventId, uint32_t& priorityIndex, const std::wstring& providerName, uint32_t payloadSize)
+    {
+        if (!_isDegraded)
+            return false;
+
+        if (priorityIndex == UnknownPriorityIndex)
+            priorityIndex = GetPriorityIndex(providerName, eventId);
+
+        if (priorityIndex == NormalPriorityIndex)
+            return false;
+
+        _skippedCounts[priorityIndex - FirstLowPriorityIndex]++;
+        _skippedEventsCount++;
+        _skippedPayloadBytes += payloadSize;
+        return true;
+    }
+
+    // can be called from any thread
+    void GetStatistics(DegradedModeStatistics& stats);
+    uint64_t GetSkippedEventsCount(const std::wstring& providerName, uint32_t eventId);
+
+private:
+    static bool IsProtected(const std::wstring& providerName, uint32_t eventId);
+    uint32_t GetPriorityIndex(const std::wstring& providerName, uint32_t eventId);
+
+private:
+    std::atomic<bool> _isDegraded;
+    ProviderEventId _lowPriorityEvents[MaxLowPriorityEvents];
+    uint32_t _lowPriorityEventsCount;
+
+    // statistics
+    std::atomic<uint64_t> _skippedCounts[MaxLowPriorityEvents];
+    std::atomic<uint64_t> _degradedPeriodsCount;
+    std::atomic<uint64_t> _degradedBlocksCount;
+    std::atomic<uint64_t> _skippedEventsCount;
+    std::atomic<uint64_t> _skippedPayloadBytes;
+};
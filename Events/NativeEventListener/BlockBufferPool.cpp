@@ -0,0 +1,114 @@
+#include <new>
+
+#include "BlockBufferPool.h"
+
+
+void UpdatePeak(std::atomic<uint64_t>& peak, uint64_t value)
+{
+    uint64_t current = peak.load(std::memory_order_relaxed);
+    while ((value > current) && !peak.compare_exchange_weak(current, value, std::memory_order_relaxed))
+    {
+    }
+}
+
+
+BlockBufferPool::BlockBufferPool()
+{
+    for (auto& sizeClass : _classes)
+    {
+        ::InitializeSRWLock(&sizeClass.Lock);
+    }
+
+    _hitCount = 0;
+    _missCount = 0;
+    _allocatedBytes = 0;
+    _peakAllocatedBytes = 0;
+    _inUseBytes = 0;
+    _peakInUseBytes = 0;
+}
+
+BlockBufferPool::~BlockBufferPool()
+{
+    for (auto& sizeClass : _classes)
+    {
+        for (auto pBuffer : sizeClass.FreeBuffers)
+        {
+            delete [] pBuffer;
+        }
+    }
+}
+
+// index of the smallest class that fits the given size
+uint32_t BlockBufferPool::GetSizeClass(uint32_t size)
+{
+    uint32_t sizeClass = 0;
+    uint64_t classSize = (uint64_t)1 << MinBlockBufferSizeShift;
+    while (classSize < size)
+    {
+        classSize <<= 1;
+        sizeClass++;
+    }
+
+    return sizeClass;
+}
+
+uint8_t* BlockBufferPool::Acquire(uint32_t size, uint32_t& bufferSize)
+{
+    uint32_t sizeClass = GetSizeClass(size);
+    uint64_t classSize = (uint64_t)1 << (MinBlockBufferSizeShift + sizeClass);
+
+    // the largest class can't be represented as a 32 bit size
+    bufferSize = (classSize > UINT32_MAX) ? UINT32_MAX : (uint32_t)classSize;
+
+    uint8_t* pBuffer = nullptr;
+    auto& freeClass = _classes[sizeClass];
+    ::AcquireSRWLockExclusive(&freeClass.Lock);
+    if (!freeClass.FreeBuffers.empty())
+    {
+        pBuffer = freeClass.FreeBuffers.back();
+        freeClass.FreeBuffers.pop_back();
+    }
+    ::ReleaseSRWLockExclusive(&freeClass.Lock);
+
+    if (pBuffer != nullptr)
+    {
+        _hitCount++;
+    }
+    else
+    {
+        // no need to zero the buffer: it will be overwritten by the block
+        _missCount++;
+        pBuffer = new (std::nothrow) uint8_t[bufferSize];
+        if (pBuffer == nullptr)
+            return nullptr;
+
+        UpdatePeak(_peakAllocatedBytes, _allocatedBytes += bufferSize);
+    }
+
+    UpdatePeak(_peakInUseBytes, _inUseBytes += bufferSize);
+
+    return pBuffer;
+}
+
+void BlockBufferPool::Release(uint8_t* pBuffer, uint32_t bufferSize)
+{
+    if (pBuffer == nullptr)
+        return;
+
+    _inUseBytes -= bufferSize;
+
+    auto& freeClass = _classes[GetSizeClass(bufferSize)];
+    ::AcquireSRWLockExclusive(&freeClass.Lock);
+    freeClass.FreeBuffers.push_back(pBuffer);
+    ::ReleaseSRWLockExclusive(&freeClass.Lock);
+}
+
+void BlockBufferPool::GetStatistics(BlockBufferPoolStatistics& stats)
+{
+    stats.HitCount = _hitCount.load(std::memory_order_relaxed);
+    stats.MissCount = _missCount.load(std::memory_order_relaxed);
+    stats.AllocatedBytes = _allocatedBytes.load(std::memory_order_relaxed);
+    stats.PeakAllocatedBytes = _peakAllocatedBytes.load(std::memory_order_relaxed);
+    stats.InUseBytes = _inUseBytes.load(std::memory_order_relaxed);
+    stats.PeakInUseBytes = _peakInUseBytes.load(std::memory_order_relaxed);
+}
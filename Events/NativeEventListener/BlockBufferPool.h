@@ -0,0 +1,60 @@
+#pragma once
+#include <atomic>
+#include <vector>
+#include <windows.h>
+#include <stdint.h>
+
+
+// buffers are allocated by size classes: 4 KB, 8 KB, 16 KB... up to 4 GB
+const uint32_t MinBlockBufferSizeShift = 12;
+const uint32_t BlockBufferSizeClassCount = 32 - MinBlockBufferSizeShift + 1;
+
+
+// can be read from any thread while the session is running
+struct BlockBufferPoolStatistics
+{
+    uint64_t HitCount;              // buffers reused from the pool
+    uint64_t MissCount;             // buffers allocated because no free buffer was large enough
+    uint64_t AllocatedBytes;        // in use + kept in the pool
+    uint64_t PeakAllocatedBytes;
+    uint64_t InUseBytes;
+    uint64_t PeakInUseBytes;
+};
+
+
+// Reusable buffers for the nettrace blocks: there is no limit on the block size and
+// the buffers are never zeroed because they are always overwritten by the block content.
+// A buffer can be acquired and released by different threads (i.e. reader, parser and decoding workers)
+class BlockBufferPool
+{
+public:
+    BlockBufferPool();
+    ~BlockBufferPool();
+
+    // the returned buffer could be larger than the requested size
+    // Note: returns nullptr if the buffer can't be allocated
+    uint8_t* Acquire(uint32_t size, uint32_t& bufferSize);
+    void Release(uint8_t* pBuffer, uint32_t bufferSize);
+
+    void GetStatistics(BlockBufferPoolStatistics& stats);
+
+private:
+    uint32_t GetSizeClass(uint32_t size);
+
+private:
+    // free buffers per size class
+    struct SizeClass
+    {
+        SRWLOCK Lock;
+        std::vector<uint8_t*> FreeBuffers;
+    };
+    SizeClass _classes[BlockBufferSizeClassCount];
+
+    // statistics
+    std::atomic<uint64_t> _hitCount;
+    std::atomic<uint64_t> _missCount;
+    std::atomic<uint64_t> _allocatedBytes;
+    std::atomic<uint64_t> _peakAllocatedBytes;
+    std::atomic<uint64_t> _inUseBytes;
+    std::atomic<uint64_t> _peakInUseBytes;
+};
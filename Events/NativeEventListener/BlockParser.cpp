@@ -1,13 +1,19 @@
+#include <array>
 #include <iostream>
 #include <sstream>
+#include <utility>
 #include "BlockParser.h"
+#include "Log.h"
 
 
-EventParserBase::EventParserBase(std::unordered_map<uint32_t, EventCacheMetadata>& metadata)
+EventParserBase::EventParserBase(MetadataTable& metadata)
     :
     _metadata(metadata)
 {
-    _is64Bit = true;  // will be set later
+    SetHeaderDecoding(DefaultHeaderDecoding);
+
+    // will be set later when the pointer size is known
+    EventParserBase::SetPointerSize(sizeof(uint64_t));
 }
 
 // look at implementation:
@@ -19,7 +25,7 @@ bool EventParserBase::OnParse()
     EventBlockHeader ebHeader = {};
     if (!Read(&ebHeader, sizeof(ebHeader)))
     {
-        std::cout << "Error while reading " << GetBlockName() << "Block header\n";
+        LOG_ERROR("Error while reading " << GetBlockName() << "Block header\n");
         return false;
     }
 
@@ -29,7 +35,7 @@ bool EventParserBase::OnParse()
         uint8_t optionalSize = ebHeader.HeaderSize - sizeof(EventBlockHeader);
         if (!SkipBytes(optionalSize))
         {
-            std::cout << "Error while skipping optional info from " << GetBlockName() << "Block header\n";
+            LOG_ERROR("Error while skipping optional info from " << GetBlockName() << "Block header\n");
             return false;
         }
     }
@@ -56,7 +62,7 @@ bool EventParserBase::OnParse()
             uint8_t tag;
             if (!ReadByte(tag) || (tag != NettraceTag::EndObject))
             {
-                std::cout << "Missing end of block tag\n";
+                LOG_ERROR("Missing end of block tag\n");
                 return false;
             }
 
@@ -77,7 +83,7 @@ bool EventParserBase::ReadUncompressedHeader(EventBlobHeader& header, DWORD& siz
     EventBlobHeader_V4 headerV4;
     if (!Read(&headerV4, sizeof(headerV4)))
     {
-        std::cout << "Impossible to read uncompressed blob header\n";
+        LOG_ERROR("Impossible to read uncompressed blob header\n");
         return false;
     }
     size += sizeof(headerV4);
@@ -99,7 +105,349 @@ bool EventParserBase::ReadUncompressedHeader(EventBlobHeader& header, DWORD& siz
     return true;
 }
 
+// the largest compressed header: flags + 7 varints (3 of them 64 bit) + 2 GUIDs
+const uint32_t MaxCompressedHeaderSize = 1 + 5 + 5 + 10 + 5 + 10 + 5 + 10 + 16 + 16 + 5;
+
+// word-at-a-time LEB128 decoding: the 8 bytes starting at p are loaded at once, the first byte without
+// the continuation bit ends the value and the 7 bit groups are packed together with shifts and masks
+// instead of a loop with a branch per byte.
+// Returns the number of bytes of the value or 0 if it is longer than 8 bytes (i.e. more than 56 bits)
+// Note: at least 8 bytes must be readable from p
+static inline uint32_t DecodeVarUIntWord(const uint8_t* p, uint64_t& val)
+{
+    uint64_t word;
+    memcpy(&word, p, sizeof(word));
+
+    uint64_t stops = ~word & 0x8080808080808080ull;
+    if (stops == 0)
+        return 0;
+
+    // keep the bytes up to the first stop bit (included) and count them
+    uint64_t lastBit = stops & (0 - stops);
+    uint64_t mask = (lastBit << 1) - 1;
+    uint32_t length = (uint32_t)(((mask & 0x0101010101010101ull) * 0x0101010101010101ull) >> 56);
+
+    uint64_t bits = word & mask & 0x7F7F7F7F7F7F7F7Full;
+    bits = ((bits & 0x7F007F007F007F00ull) >> 1) | (bits & 0x007F007F007F007Full);
+    bits = ((bits & 0x3FFF00003FFF0000ull) >> 2) | (bits & 0x00003FFF00003FFFull);
+    bits = ((bits & 0x0FFFFFFF00000000ull) >> 4) | (bits & 0x000000000FFFFFFFull);
+    val = bits;
+
+    return length;
+}
+
+// Note: the caller must have checked that at least MaxCompressedHeaderSize + 8 bytes are readable from *pp
+static inline bool DecodeVarUInt32(const uint8_t*& p, uint32_t& val)
+{
+    uint64_t value;
+    uint32_t length = DecodeVarUIntWord(p, value);
+
+    // more than 5 bytes is invalid for a 32 bit value (same truncation as BlockParser::ReadVarUInt32)
+    if ((length == 0) || (length > 5))
+        return false;
+
+    val = (uint32_t)value;
+    p += length;
+    return true;
+}
+
+static inline bool DecodeVarUInt64(const uint8_t*& p, uint64_t& val)
+{
+    uint32_t length = DecodeVarUIntWord(p, val);
+    if (length != 0)
+    {
+        p += length;
+        return true;
+    }
+
+    // values of more than 56 bits are rare enough to be decoded byte per byte
+    val = 0;
+    int shift = 0;
+    uint8_t b;
+    do
+    {
+        if (shift == 10 * 7)
+        {
+            return false;
+        }
+        b = *p++;
+        val |= (uint64_t)(b & 0x7f) << shift;
+        shift += 7;
+    } while ((b & 0x80) != 0);
+
+    return true;
+}
+
+void EventParserBase::SetHeaderDecoding(const HeaderDecodingSettings& settings)
+{
+    _headerDecoding = settings;
+    _headerMismatchesCount = 0;
+}
+
+uint64_t EventParserBase::GetHeaderMismatchesCount()
+{
+    return _headerMismatchesCount;
+}
+
+// The flags byte of a compressed header tells which fields follow: instead of testing each flag
+// (8 data dependent branches per event that the CPU fails to predict when providers are mixed),
+// one decoder is instantiated per flags value with only the fields it needs and the header
+// decoding jumps through a table indexed by the flags byte (one indirect branch per event).
+// Returns false if a varint is invalid (p is then not meaningful)
+// Note: the caller must have checked that at least MaxCompressedHeaderSize + 8 bytes are readable from p
+typedef bool (*CompressedHeaderDecoder)(const uint8_t*& p, EventBlobHeader& header);
+
+template <uint8_t Flags>
+static bool DecodeCompressedHeaderFields(const uint8_t*& p, EventBlobHeader& header)
+{
+    if constexpr ((Flags & CompressedHeaderFlags::MetadataId) != 0)
+    {
+        if (!DecodeVarUInt32(p, header.MetadataId))
+            return false;
+    }
+
+    if constexpr ((Flags & CompressedHeaderFlags::CaptureThreadAndSequence) != 0)
+    {
+        uint32_t val;
+        if (!DecodeVarUInt32(p, val))
+            return false;
+        header.SequenceNumber += val + 1;
+
+        if (!DecodeVarUInt64(p, header.CaptureThreadId) || !DecodeVarUInt32(p, header.ProcessorNumber))
+            return false;
+    }
+    else
+    {
+        if (header.MetadataId != 0)
+        {
+            // !! reuse the header from the previous blob
+            header.SequenceNumber++;
+        }
+    }
+
+    if constexpr ((Flags & CompressedHeaderFlags::ThreadId) != 0)
+    {
+        if (!DecodeVarUInt64(p, header.ThreadId))
+            return false;
+    }
+
+    if constexpr ((Flags & CompressedHeaderFlags::StackId) != 0)
+    {
+        if (!DecodeVarUInt32(p, header.StackId))
+            return false;
+    }
+
+    uint64_t timestampDelta;
+    if (!DecodeVarUInt64(p, timestampDelta))
+        return false;
+    header.Timestamp += timestampDelta;
+
+    if constexpr ((Flags & CompressedHeaderFlags::ActivityId) != 0)
+    {
+        memcpy(&header.ActivityId, p, sizeof(header.ActivityId));
+        p += sizeof(header.ActivityId);
+    }
+
+    if constexpr ((Flags & CompressedHeaderFlags::RelatedActivityId) != 0)
+    {
+        memcpy(&header.RelatedActivityId, p, sizeof(header.RelatedActivityId));
+        p += sizeof(header.RelatedActivityId);
+    }
+
+    header.IsSorted = (Flags & CompressedHeaderFlags::Sorted) != 0;
+
+    if constexpr ((Flags & CompressedHeaderFlags::DataLength) != 0)
+    {
+        if (!DecodeVarUInt32(p, header.PayloadSize))
+            return false;
+    }
+
+    return true;
+}
+
+template <size_t... Flags>
+static constexpr std::array<CompressedHeaderDecoder, sizeof...(Flags)> MakeCompressedHeaderDecoders(std::index_sequence<Flags...>)
+{
+    return { { &DecodeCompressedHeaderFields<(uint8_t)Flags>... } };
+}
+
+static constexpr std::array<CompressedHeaderDecoder, 256> CompressedHeaderDecoders =
+    MakeCompressedHeaderDecoders(std::make_index_sequence<256>());
+
+
+static bool AreSameHeaders(const EventBlobHeader& left, const EventBlobHeader& right)
+{
+    return
+        (left.MetadataId == right.MetadataId) &&
+        (left.SequenceNumber == right.SequenceNumber) &&
+        (left.ThreadId == right.ThreadId) &&
+        (left.CaptureThreadId == right.CaptureThreadId) &&
+        (left.ProcessorNumber == right.ProcessorNumber) &&
+        (left.StackId == right.StackId) &&
+        (left.Timestamp == right.Timestamp) &&
+        (memcmp(&left.ActivityId, &right.ActivityId, sizeof(GUID)) == 0) &&
+        (memcmp(&left.RelatedActivityId, &right.RelatedActivityId, sizeof(GUID)) == 0) &&
+        (left.IsSorted == right.IsSorted) &&
+        (left.PayloadSize == right.PayloadSize) &&
+        (left.HeaderSize == right.HeaderSize);
+}
+
 bool EventParserBase::ReadCompressedHeader(EventBlobHeader& header, DWORD& size)
+{
+    // the byte per byte checked decoding is only needed for the last events of a block
+    if (_blockSize - _pos < MaxCompressedHeaderSize + sizeof(uint64_t))
+    {
+        return ReadCompressedHeaderChecked(header, size);
+    }
+
+    if (!_headerDecoding.IsValidated)
+    {
+        return ReadCompressedHeaderFast(header, size);
+    }
+
+    // decode the same bytes with both implementations (the header fields are relative to the previous event)
+    uint32_t startPos = _pos;
+    EventBlobHeader checkedHeader = header;
+    DWORD checkedSize = size;
+    bool isCheckedRead = ReadCompressedHeaderChecked(checkedHeader, checkedSize);
+    uint32_t checkedPos = _pos;
+
+    _pos = startPos;
+    bool isRead = ReadCompressedHeaderFast(header, size);
+    if ((isRead != isCheckedRead) || (isRead && ((_pos != checkedPos) || (size != checkedSize) || !AreSameHeaders(header, checkedHeader))))
+    {
+        _headerMismatchesCount++;
+        LOG_ERROR("Compressed header decoding mismatch at position " << startPos << " in " << GetBlockName() << "\n");
+    }
+
+    return isRead;
+}
+
+bool EventParserBase::ReadCompressedHeaderFast(EventBlobHeader& header, DWORD& size)
+{
+    // the caller checked that the largest possible header is available
+    const uint8_t* pHeader;
+    TryGetRange(0, pHeader);
+    const uint8_t* p = pHeader;
+
+    uint8_t flags = *p++;
+
+    if (_headerDecoding.IsFlagSpecialized)
+    {
+        if (!CompressedHeaderDecoders[flags](p, header))
+        {
+            LOG_ERROR("Error while reading compressed header with flags 0x" << std::hex << (uint32_t)flags << std::dec << "\n");
+            return false;
+        }
+
+        header.HeaderSize = (uint32_t)(p - pHeader);
+        header.TotalNonHeaderSize = header.PayloadSize;
+        size += header.HeaderSize;
+        _pos += header.HeaderSize;
+
+        return true;
+    }
+
+    // branch per flag (kept to be compared with the flag specialized decoders)
+
+    if ((flags & CompressedHeaderFlags::MetadataId) != 0)
+    {
+        if (!DecodeVarUInt32(p, header.MetadataId))
+        {
+            LOG_ERROR("Error while reading compressed header metadata ID\n");
+            return false;
+        }
+    }
+
+    if ((flags & CompressedHeaderFlags::CaptureThreadAndSequence) != 0)
+    {
+        uint32_t val;
+        if (!DecodeVarUInt32(p, val))
+        {
+            LOG_ERROR("Error while reading compressed header sequence number\n");
+            return false;
+        }
+        header.SequenceNumber += val + 1;
+
+        if (!DecodeVarUInt64(p, header.CaptureThreadId))
+        {
+            LOG_ERROR("Error while reading compressed header captured thread ID\n");
+            return false;
+        }
+
+        if (!DecodeVarUInt32(p, header.ProcessorNumber))
+        {
+            LOG_ERROR("Error while reading compressed header processor number\n");
+            return false;
+        }
+    }
+    else
+    {
+        if (header.MetadataId != 0)
+        {
+            // !! reuse the header from the previous blob
+            header.SequenceNumber++;
+        }
+    }
+
+    if ((flags & CompressedHeaderFlags::ThreadId) != 0)
+    {
+        if (!DecodeVarUInt64(p, header.ThreadId))
+        {
+            LOG_ERROR("Error while reading compressed header thread ID\n");
+            return false;
+        }
+    }
+
+    if ((flags & CompressedHeaderFlags::StackId) != 0)
+    {
+        if (!DecodeVarUInt32(p, header.StackId))
+        {
+            LOG_ERROR("Error while reading compressed header stack ID\n");
+            return false;
+        }
+    }
+
+    uint64_t timestampDelta;
+    if (!DecodeVarUInt64(p, timestampDelta))
+    {
+        LOG_ERROR("Error while reading compressed header timestamp delta\n");
+        return false;
+    }
+    header.Timestamp += timestampDelta;
+
+    if ((flags & CompressedHeaderFlags::ActivityId) != 0)
+    {
+        memcpy(&header.ActivityId, p, sizeof(header.ActivityId));
+        p += sizeof(header.ActivityId);
+    }
+
+    if ((flags & CompressedHeaderFlags::RelatedActivityId) != 0)
+    {
+        memcpy(&header.RelatedActivityId, p, sizeof(header.RelatedActivityId));
+        p += sizeof(header.RelatedActivityId);
+    }
+
+    header.IsSorted = (flags & CompressedHeaderFlags::Sorted) != 0;
+
+    if ((flags & CompressedHeaderFlags::DataLength) != 0)
+    {
+        if (!DecodeVarUInt32(p, header.PayloadSize))
+        {
+            LOG_ERROR("Error while reading compressed header payload size\n");
+            return false;
+        }
+    }
+
+    header.HeaderSize = (uint32_t)(p - pHeader);
+    header.TotalNonHeaderSize = header.PayloadSize;
+    size += header.HeaderSize;
+    _pos += header.HeaderSize;
+
+    return true;
+}
+
+bool EventParserBase::ReadCompressedHeaderChecked(EventBlobHeader& header, DWORD& size)
 {
     // used to compute the compressed header size
     uint32_t headerStartPos = _pos;
@@ -108,7 +456,7 @@ bool EventParserBase::ReadCompressedHeader(EventBlobHeader& header, DWORD& size)
     uint8_t flags;
     if (!ReadByte(flags))
     {
-        std::cout << "Error while reading compressed header flags\n";
+        LOG_ERROR("Error while reading compressed header flags\n");
         return false;
     }
     size += sizeof(flags);
@@ -118,7 +466,7 @@ bool EventParserBase::ReadCompressedHeader(EventBlobHeader& header, DWORD& size)
     {
         if (!ReadVarUInt32(header.MetadataId, size))
         {
-            std::cout << "Error while reading compressed header metadata ID\n";
+            LOG_ERROR("Error while reading compressed header metadata ID\n");
             return false;
         }
     }
@@ -128,20 +476,20 @@ bool EventParserBase::ReadCompressedHeader(EventBlobHeader& header, DWORD& size)
         uint32_t val;
         if (!ReadVarUInt32(val, size))
         {
-            std::cout << "Error while reading compressed header sequence number\n";
+            LOG_ERROR("Error while reading compressed header sequence number\n");
             return false;
         }
         header.SequenceNumber += val + 1;
 
         if (!ReadVarUInt64(header.CaptureThreadId, size))
         {
-            std::cout << "Error while reading compressed header captured thread ID\n";
+            LOG_ERROR("Error while reading compressed header captured thread ID\n");
             return false;
         }
 
         if (!ReadVarUInt32(header.ProcessorNumber, size))
         {
-            std::cout << "Error while reading compressed header processor number\n";
+            LOG_ERROR("Error while reading compressed header processor number\n");
             return false;
         }
     }
@@ -158,7 +506,7 @@ bool EventParserBase::ReadCompressedHeader(EventBlobHeader& header, DWORD& size)
     {
         if (!ReadVarUInt64(header.ThreadId, size))
         {
-            std::cout << "Error while reading compressed header thread ID\n";
+            LOG_ERROR("Error while reading compressed header thread ID\n");
             return false;
         }
     }
@@ -167,7 +515,7 @@ bool EventParserBase::ReadCompressedHeader(EventBlobHeader& header, DWORD& size)
     {
         if (!ReadVarUInt32(header.StackId, size))
         {
-            std::cout << "Error while reading compressed header stack ID\n";
+            LOG_ERROR("Error while reading compressed header stack ID\n");
             return false;
         }
     }
@@ -175,7 +523,7 @@ bool EventParserBase::ReadCompressedHeader(EventBlobHeader& header, DWORD& size)
     uint64_t timestampDelta = 0;
     if (!ReadVarUInt64(timestampDelta, size))
     {
-        std::cout << "Error while reading compressed header timestamp delta\n";
+        LOG_ERROR("Error while reading compressed header timestamp delta\n");
         return false;
     }
     header.Timestamp += timestampDelta;
@@ -184,7 +532,7 @@ bool EventParserBase::ReadCompressedHeader(EventBlobHeader& header, DWORD& size)
     {
         if (!Read(&header.ActivityId, sizeof(header.ActivityId)))
         {
-            std::cout << "Error while reading compressed header activity ID\n";
+            LOG_ERROR("Error while reading compressed header activity ID\n");
             return false;
         }
         size += sizeof(header.ActivityId);
@@ -194,7 +542,7 @@ bool EventParserBase::ReadCompressedHeader(EventBlobHeader& header, DWORD& size)
     {
         if (!Read(&header.RelatedActivityId, sizeof(header.RelatedActivityId)))
         {
-            std::cout << "Error while reading compressed header related activity ID\n";
+            LOG_ERROR("Error while reading compressed header related activity ID\n");
             return false;
         }
         size += sizeof(header.RelatedActivityId);
@@ -206,7 +554,7 @@ bool EventParserBase::ReadCompressedHeader(EventBlobHeader& header, DWORD& size)
     {
         if (!ReadVarUInt32(header.PayloadSize, size))
         {
-            std::cout << "Error while reading compressed header payload size\n";
+            LOG_ERROR("Error while reading compressed header payload size\n");
             return false;
         }
     }
@@ -249,14 +597,19 @@ void BlockParser::SetPointerSize(uint8_t pointerSize)
         }
 }
 
-bool BlockParser::Parse(uint8_t* pBlock, uint32_t bytesCount, uint64_t blockOriginInFile)
+bool BlockParser::Parse(const uint8_t* pBlock, uint32_t bytesCount, uint64_t blockOriginInFile)
+{
+    SetBlock(pBlock, bytesCount, blockOriginInFile);
+
+    return OnParse();
+}
+
+void BlockParser::SetBlock(const uint8_t* pBlock, uint32_t bytesCount, uint64_t blockOriginInFile)
 {
     _pBlock = pBlock;
     _blockSize = bytesCount;
     _pos = 0;
     _blockOriginInFile = blockOriginInFile;
-
-    return OnParse();
 }
 
 bool BlockParser::ReadByte(uint8_t& byte)
@@ -312,6 +665,17 @@ bool BlockParser::SkipBytes(uint32_t byteCount)
     return true;
 }
 
+bool BlockParser::TryGetRange(uint64_t byteCount, const uint8_t*& pRange)
+{
+    if (byteCount > _blockSize - _pos)
+        return false;
+
+    pRange = &_pBlock[_pos];
+    _pos += (uint32_t)byteCount;
+
+    return true;
+}
+
 bool BlockParser::ReadVarUInt32(uint32_t& val, DWORD& size)
 {
     val = 0;
@@ -359,36 +723,43 @@ bool BlockParser::ReadVarUInt64(uint64_t& val, DWORD& size)
     return true;
 }
 
-// read UTF16 character one after another until the \0 is found to rebuild a string
-bool BlockParser::ReadWString(std::wstring& wstring, DWORD& bytesRead)
+// look for the \0 ending the UTF16 string in the block without copying its characters
+bool BlockParser::ReadWStringView(WStringView& view, DWORD& bytesRead)
 {
+    const uint8_t* pChars = &_pBlock[_pos];
+    uint32_t charsCount = (_blockSize - _pos) / sizeof(uint16_t);
+    uint32_t length = WStringView::ScanForEnd(pChars, charsCount);
+    view = WStringView(pChars, length);
+    bytesRead = length * sizeof(uint16_t);
+    _pos += bytesRead;
+
+    // no \0 before the end of the block
+    if (length == charsCount)
+        return false;
+
+    // TODO: protect against invalid UNICODE character (due to missing fields in ExceptionThrown event)
     uint16_t character;
-    bytesRead = 0;  // in case of empty string
-    while (true)
+    memcpy(&character, &_pBlock[_pos], sizeof(character));
+    if (character != 0)
     {
-        if (!ReadWord(character))
-        {
-            return false;
-        }
-
-        // TODO: protect against invalid UNICODE character (due to missing fields in ExceptionThrown event)
-        if (character > 256)
-        {
-            // rewind the character
-            _pos = _pos - sizeof(character);
+        // this is only covering a missing string (the invalid character is not consumed)
+        return (length == 0);
+    }
 
-            // this is only covering a missing string
-            return (bytesRead == 0);
-        }
+    // Note that an empty string contains only that \0 character
+    bytesRead += sizeof(character);
+    _pos += sizeof(character);
 
-        bytesRead += sizeof(character);
+    return true;
+}
 
-        // Note that an empty string contains only that \0 character
-        if (character == 0) // \0 final character of the string
-            return true;
+bool BlockParser::ReadWString(std::wstring& wstring, DWORD& bytesRead)
+{
+    WStringView view;
+    bool success = ReadWStringView(view, bytesRead);
+    wstring.append(view.ToWString());
 
-        wstring.push_back(character);
-    }
+    return success;
 }
 
 // Check for block boundaries
@@ -411,7 +782,8 @@ bool BlockParser::CheckBoundaries(uint32_t byteCount)
 {
     if (byteCount > _blockSize - _pos)
     {
-        std::cout << "too many bytes to read + " << byteCount - (_blockSize - _pos) << " bytes\n";
+        TRACE_STEP(TraceId::ParseError, _pos, byteCount);
+        LOG_ERROR("too many bytes to read + " << byteCount - (_blockSize - _pos) << " bytes\n");
         return false;
     }
 
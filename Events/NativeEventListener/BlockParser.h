@@ -1,24 +1,32 @@
 #pragma once
 
+#include <atomic>
 #include <stdint.h>
+#include <string.h>
 #include <iostream>
 #include <unordered_map>
+#include <vector>
 #include <windows.h>
 
+#include "BackpressurePolicy.h"
+#include "EventListener.h"
+#include "EventLossTracker.h"
+#include "EventOrderer.h"
 #include "GcDumpState.h"
+#include "MetadataTable.h"
+#include "SessionStatistics.h"
+#include "WStringView.h"
 #include "NettraceFormat.h"
 
 
-class EventCacheMetadata
+// one event of an EventBlock with its header already decoded
+struct EventRecord
 {
-public:
-    uint32_t     MetadataId;
-    std::wstring ProviderName;
-    uint32_t     EventId;
-    std::wstring EventName; // empty most of the time
-    uint64_t     Keywords;
-    uint32_t     Version;
-    uint32_t     Level;
+    EventBlobHeader Header;
+    uint32_t PayloadOffset;         // from the beginning of the block
+    EventCacheMetadata* pMetadata;  // nullptr if no definition was received
+    bool IsPayloadDecoded;          // only the listened events are decoded into Event
+    ListenedEvent Event;
 };
 
 void DumpMetadataDefinition(EventCacheMetadata metadataDef);
@@ -61,11 +69,61 @@ enum EventIDs : uint32_t
 };
 
 
+// Read the fields of a range already validated by BlockParser::TryGetRange without any check.
+// Note: the nettrace fields are little endian like the supported platforms
+class RangeReader
+{
+public:
+    RangeReader(const uint8_t* pRange)
+    {
+        _p = pRange;
+    }
+
+    uint16_t ReadWord()
+    {
+        uint16_t word;
+        memcpy(&word, _p, sizeof(word));
+        _p += sizeof(word);
+        return word;
+    }
+
+    uint32_t ReadDWord()
+    {
+        uint32_t dword;
+        memcpy(&dword, _p, sizeof(dword));
+        _p += sizeof(dword);
+        return dword;
+    }
+
+    uint64_t ReadLong()
+    {
+        uint64_t ulong;
+        memcpy(&ulong, _p, sizeof(ulong));
+        _p += sizeof(ulong);
+        return ulong;
+    }
+
+    // TPointer is uint32_t or uint64_t depending on the bitness of the monitored process
+    template <class TPointer>
+    uint64_t Read()
+    {
+        TPointer value;
+        memcpy(&value, _p, sizeof(value));
+        _p += sizeof(value);
+        return value;
+    }
+
+private:
+    const uint8_t* _p;
+};
+
+
 class BlockParser
 {
 public:
     BlockParser();
-    bool Parse(uint8_t* pBlock, uint32_t bytesCount, uint64_t blockOriginInFile);
+    virtual ~BlockParser() = default;
+    bool Parse(const uint8_t* pBlock, uint32_t bytesCount, uint64_t blockOriginInFile);
     void SetPointerSize(uint8_t pointerSize);
 
 public:
@@ -74,6 +132,9 @@ public:
 protected:
     virtual bool OnParse() = 0;
 
+    // set the block to read from without parsing it
+    void SetBlock(const uint8_t* pBlock, uint32_t bytesCount, uint64_t blockOriginInFile);
+
     // Access helpers
     bool Read(LPVOID buffer, DWORD bufferSize);
     bool ReadByte(uint8_t& byte);
@@ -84,8 +145,26 @@ protected:
     bool ReadVarUInt32(uint32_t& val, DWORD& size);
     bool ReadVarUInt64(uint64_t& val, DWORD& size);
     bool ReadWString(std::wstring& wstring, DWORD& bytesRead);
+
+    // TPointer is uint32_t or uint64_t depending on the bitness of the monitored process
+    template <class TPointer>
+    bool ReadPointer(uint64_t& pointer)
+    {
+        TPointer value;
+        if (!Read(&value, sizeof(value)))
+            return false;
+
+        pointer = value;
+        return true;
+    }
+    bool ReadWStringView(WStringView& view, DWORD& bytesRead);
     bool SkipBytes(uint32_t byteCount);
 
+    // Fast path: check once that a whole blob/array is available, skip it and read its fields
+    // with a RangeReader; returns false (without any error) if the stream is too short so that
+    // the caller can fall back to the checked helpers above to report where it is malformed
+    bool TryGetRange(uint64_t byteCount, const uint8_t*& pRange);
+
 private:
     bool CheckBoundaries(uint32_t byteCount);
 
@@ -97,18 +176,30 @@ protected:
     uint32_t _pos;
 
 private:
-    uint8_t* _pBlock;
+    const uint8_t* _pBlock;
     uint64_t _blockOriginInFile;
 };
 
 
+// how the compressed headers are decoded (only changed by the replay benchmark)
+struct HeaderDecodingSettings
+{
+    bool IsFlagSpecialized;     // one decoder per flags value (default) instead of a branch per flag
+    bool IsValidated;           // also decode byte per byte and count the mismatches
+};
+const HeaderDecodingSettings DefaultHeaderDecoding = { true, false };
+
+
 class EventParserBase : public BlockParser
 {
 public:
-    EventParserBase(std::unordered_map<uint32_t, EventCacheMetadata>& metadata);
+    EventParserBase(MetadataTable& metadata);
+
+    // also select the payload decoders specialized for the pointer size of the monitored process
+    void SetPointerSize(uint8_t pointerSize);
 
 protected:
-    std::unordered_map<uint32_t, EventCacheMetadata>& _metadata;
+    MetadataTable& _metadata;
 
 protected:
     virtual bool OnParse();
@@ -119,6 +210,37 @@ protected:
 protected:
     bool ReadCompressedHeader(EventBlobHeader& header, DWORD& size);
     bool ReadUncompressedHeader(EventBlobHeader& header, DWORD& size);
+
+// decoders of the listened events payload, without side effect so that they can also run in the
+// EventBlockDecoder workers (the position must be at the beginning of the payload)
+protected:
+    bool DecodeListenedEvent(EventHandlerId handlerId, EventBlobHeader& header, EventCacheMetadata& metadataDef, ListenedEvent& event);
+    bool OnExceptionThrown(DWORD payloadSize, EventCacheMetadata& metadataDef, ExceptionThrownEvent& event);
+    bool OnAllocationTick(DWORD payloadSize, EventCacheMetadata& metadataDef, AllocationTickEvent& event)
+    {
+        return (this->*_pfnOnAllocationTick)(payloadSize, metadataDef, event);
+    }
+    bool OnContentionStop(uint64_t threadId, DWORD payloadSize, EventCacheMetadata& metadataDef, ContentionStopEvent& event);
+    bool DecodeGcStart(DWORD payloadSize, EventCacheMetadata& metadataDef, GcStartEvent& event);
+    bool DecodeGcEnd(DWORD payloadSize, EventCacheMetadata& metadataDef, GcEndEvent& event);
+
+private:
+    template <class TPointer>
+    bool DecodeAllocationTick(DWORD payloadSize, EventCacheMetadata& metadataDef, AllocationTickEvent& event);
+    bool (EventParserBase::*_pfnOnAllocationTick)(DWORD payloadSize, EventCacheMetadata& metadataDef, AllocationTickEvent& event);
+
+// compressed headers decoding of this parser (also resets the mismatches count)
+// Note: must be called before parsing; the count must be read by the parsing thread or once it is done
+public:
+    void SetHeaderDecoding(const HeaderDecodingSettings& settings);
+    uint64_t GetHeaderMismatchesCount();
+
+private:
+    bool ReadCompressedHeaderFast(EventBlobHeader& header, DWORD& size);
+    bool ReadCompressedHeaderChecked(EventBlobHeader& header, DWORD& size);
+
+    HeaderDecodingSettings _headerDecoding;
+    uint64_t _headerMismatchesCount;
 };
 
 
@@ -128,7 +250,7 @@ protected:
 class MetadataParser : public EventParserBase
 {
 public:
-    MetadataParser(std::unordered_map<uint32_t, EventCacheMetadata>& metadata);
+    MetadataParser(MetadataTable& metadata);
 
 protected:
     virtual bool OnParseBlob(EventBlobHeader& header, bool isCompressed, DWORD& blobSize);
@@ -141,9 +263,36 @@ protected:
 
 class EventParser : public EventParserBase
 {
-// TODO: probably pass a IEventListener interface that contains OnException, OnAllocationTick,...
 public:
-    EventParser(std::unordered_map<uint32_t, EventCacheMetadata>& metadata);
+    EventParser(MetadataTable& metadata, EventLossTracker& lossTracker, SessionStatistics& statistics);
+
+    // also select the decoders specialized for the pointer size of the monitored process
+    void SetPointerSize(uint8_t pointerSize);
+
+    // decode a BulkNode payload with the per field checks or with a single check per array
+    // Note: only used by the replay benchmark (the live objects are not kept before a GCStart)
+    bool DecodeBulkNode(const uint8_t* pPayload, uint32_t payloadSize, bool isCheckedPerField);
+
+    // the handler of the events of a definition depends on its provider, event ID and version
+    static EventHandlerId GetHandlerId(const EventCacheMetadata& metadataDef);
+
+    // the events whose payload can be decoded by the EventBlockDecoder workers instead of Dispatch()
+    // Note: must be called once the listener and the orderer are set
+    uint32_t GetPredecodedEvents();
+
+    // call the handlers for events already decoded by an EventBlockDecoder
+    bool Dispatch(const uint8_t* pBlock, uint32_t bytesCount, uint64_t blockOriginInFile, std::vector<EventRecord>& records);
+
+    // when set, the sorted events are buffered by the orderer and the handlers are called
+    // in timestamp order when FlushOrderedEvents() is called (i.e. before each sequence point)
+    void SetOrderer(EventOrderer* pOrderer);
+    bool FlushOrderedEvents(bool isForced);
+
+    // when set, the payload of the low priority events is skipped while the parser lags behind
+    void SetBackpressurePolicy(BackpressurePolicy* pPolicy);
+
+    // when set, the events without a dedicated handler are decoded with the plan of their metadata
+    void SetGenericEventHandler(IGenericEventHandler* pHandler);
 
 protected:
     virtual bool OnParseBlob(EventBlobHeader& header, bool isCompressed, DWORD& blobSize);
@@ -152,25 +301,141 @@ protected:
         return "Event";
     }
 
+    // called for the decoded events subscribed to by the listener of a ListenedEventParser
+    virtual void NotifyListener(EventHandlerId handlerId, const EventContext& context, const ListenedEvent& event)
+    {
+    }
+
+protected:
+    // set by ListenedEventParser from the events its listener subscribed to
+    uint32_t _subscribedEvents;
+
+private:
+    // pDecoded is not null if the payload has already been decoded by an EventBlockDecoder
+    bool OnEvent(EventBlobHeader& header, EventCacheMetadata& metadataDef, const ListenedEvent* pDecoded = nullptr);
+    bool OnListenedEvent(EventHandlerId handlerId, EventBlobHeader& header, EventCacheMetadata& metadataDef, const ListenedEvent* pDecoded);
+    bool BufferEvent(EventBlobHeader& header, EventCacheMetadata& metadataDef);
+
 // event handlers
 private:
-    bool OnExceptionThrown(DWORD payloadSize, EventCacheMetadata& metadataDef);
-    bool OnAllocationTick(DWORD payloadSize, EventCacheMetadata& metadataDef);
-    bool OnContentionStop(uint64_t threadId, DWORD payloadSize, EventCacheMetadata& metadataDef);
+    bool OnGenericEvent(DWORD payloadSize, EventCacheMetadata& metadataDef);
 
     // for gcdump
-    bool OnGcStart(DWORD payloadSize, EventCacheMetadata& metadataDef);
-    bool OnGcEnd(DWORD payloadSize, EventCacheMetadata& metadataDef);
+    bool OnGcStart(DWORD payloadSize, EventCacheMetadata& metadataDef, GcStartEvent& event);
+    bool OnGcEnd(DWORD payloadSize, EventCacheMetadata& metadataDef, GcEndEvent& event);
     bool OnBulkType(DWORD payloadSize, EventCacheMetadata& metadataDef);
     bool OnBulkNode(DWORD payloadSize, EventCacheMetadata& metadataDef);
+    bool ParseBulkNode(DWORD payloadSize, bool isCheckedPerField);
     bool OnBulkEdge(DWORD payloadSize, EventCacheMetadata& metadataDef);
 
-// helpers
 private:
-    std::string ToString(const wchar_t* str);
+    GcDumpState _gcDump;
+    BulkNodeBatch _nodeBatch;  // reused to avoid allocations
+
+    // sequence numbers of the events
+    EventLossTracker& _lossTracker;
+
+    // nullptr if the events are delivered in stream order
+    EventOrderer* _pOrderer;
+
+    // nullptr if all events are always parsed
+    BackpressurePolicy* _pBackpressurePolicy;
+
+    SessionStatistics& _statistics;
+
+    // nullptr if the events without handler are skipped
+    IGenericEventHandler* _pGenericHandler;
+    DecodedPayload _decodedPayload;  // reused to avoid allocations
+
+    // decoders specialized for the pointer size (see SetPointerSize)
+    template <class TPointer>
+    void AddLiveObjects(const uint8_t* pNodes, uint32_t count);
+    template <class TPointer>
+    bool ReadBulkNodesChecked(uint32_t count, DWORD& readBytesCount);
+    template <class TPointer>
+    void AddEdges(const uint8_t* pEdges, uint32_t count);
+
+    void (EventParser::*_pfnAddLiveObjects)(const uint8_t* pNodes, uint32_t count);
+    bool (EventParser::*_pfnReadBulkNodesChecked)(uint32_t count, DWORD& readBytesCount);
+    void (EventParser::*_pfnAddEdges)(const uint8_t* pEdges, uint32_t count);
+    uint32_t _bulkNodeSize;
+    uint32_t _bulkEdgeSize;
+};
+
+
+// EventParser passing the CLR events subscribed to by its listener to the handlers
+// Note: TListener is either IEventListener (virtual handlers) or any class with the same handlers
+//       such as the ones deriving from EventListenerBase<TListener>: the parser is instantiated
+//       for that class so that its handlers are called directly (and inlined)
+template <class TListener>
+class ListenedEventParser : public EventParser
+{
+public:
+    ListenedEventParser(MetadataTable& metadata, EventLossTracker& lossTracker, SessionStatistics& statistics, TListener* pListener)
+        :
+        EventParser(metadata, lossTracker, statistics),
+        _pListener(pListener)
+    {
+        _subscribedEvents = pListener->GetSubscribedEvents() & AllListenedEvents;
+    }
+
+protected:
+    virtual void NotifyListener(EventHandlerId handlerId, const EventContext& context, const ListenedEvent& event) override
+    {
+        switch (handlerId)
+        {
+            case EventHandlerId::AllocationTick:
+                _pListener->OnAllocationTick(context, event.AllocationTick);
+                break;
+
+            case EventHandlerId::ContentionStop:
+                _pListener->OnContentionStop(context, event.ContentionStop);
+                break;
+
+            case EventHandlerId::ExceptionThrown:
+                _pListener->OnExceptionThrown(context, event.ExceptionThrown);
+                break;
+
+            case EventHandlerId::GcStart:
+                _pListener->OnGcStart(context, event.GcStart);
+                break;
+
+            case EventHandlerId::GcEnd:
+                _pListener->OnGcEnd(context, event.GcEnd);
+                break;
+
+            default:
+                break;
+        }
+    }
+
+private:
+    TListener* _pListener;
+};
+
+
+// Decodes the blob headers of an EventBlock and the payload of the listened events without calling
+// any handler. Since the compressed header state is reset at the beginning of each block,
+// several blocks can be decoded at the same time by different instances/threads.
+// Note: the metadata table must not be updated while a block is decoded
+class EventBlockDecoder : public EventParserBase
+{
+public:
+    // decodedEvents: SubscribeTo() bits of the events whose payload is decoded
+    EventBlockDecoder(MetadataTable& metadata, uint32_t decodedEvents);
+
+    bool Decode(const uint8_t* pBlock, uint32_t bytesCount, uint64_t blockOriginInFile, std::vector<EventRecord>& records);
+
+protected:
+    virtual bool OnParseBlob(EventBlobHeader& header, bool isCompressed, DWORD& blobSize);
+    virtual const char* GetBlockName()
+    {
+        return "Event";
+    }
 
 private:
-    GcDumpState _gcDump;
+    uint32_t _decodedEvents;
+    std::vector<EventRecord>* _pRecords;
 };
 
 
@@ -212,15 +477,22 @@ public:
         std::unordered_map<uint32_t, EventCacheStack64>& stacks64
         );
 
+    // also select the frames decoder for the pointer size of the monitored process
+    void SetPointerSize(uint8_t pointerSize);
+
 protected:
     virtual bool OnParse();
 
 private:
-    bool ParseStack(uint32_t stackId, DWORD& size);
+    template <class TPointer, class TStack>
+    bool ParseStack(uint32_t stackId, DWORD& size, std::unordered_map<uint32_t, TStack>& stacks);
+    bool ParseStack32(uint32_t stackId, DWORD& size);
+    bool ParseStack64(uint32_t stackId, DWORD& size);
 
 private:
     std::unordered_map<uint32_t, EventCacheStack32>& _stacks32;
     std::unordered_map<uint32_t, EventCacheStack64>& _stacks64;
+    bool (StackParser::*_pfnParseStack)(uint32_t stackId, DWORD& size);
 };
 
 
@@ -229,7 +501,8 @@ class SequencePointParser : public BlockParser
 public:
     SequencePointParser(
         std::unordered_map<uint32_t, EventCacheStack32>& stacks32,
-        std::unordered_map<uint32_t, EventCacheStack64>& stacks64
+        std::unordered_map<uint32_t, EventCacheStack64>& stacks64,
+        EventLossTracker& lossTracker
     );
 
 protected:
@@ -238,4 +511,5 @@ protected:
 private:
     std::unordered_map<uint32_t, EventCacheStack32>& _stacks32;
     std::unordered_map<uint32_t, EventCacheStack64>& _stacks64;
+    EventLossTracker& _lossTracker;
 };
\ No newline at end of file
@@ -0,0 +1,117 @@
+#include "BlockQueue.h"
+
+// the events are only a way to avoid spinning: a missed signal costs at most this delay
+const DWORD BlockQueueWaitMs = 1;
+
+
+BlockQueue::BlockQueue(BlockBufferPool& pool, uint32_t capacity)
+    :
+    _blocks(capacity),
+    _pool(pool)
+{
+    _isCompleted = false;
+    _isAborted = false;
+
+    _pushedCount = 0;
+    _maxDepth = 0;
+    _readerStallCount = 0;
+    _parserStallCount = 0;
+
+    _hNotEmptyEvent = ::CreateEvent(nullptr, FALSE, FALSE, nullptr);
+    _hNotFullEvent = ::CreateEvent(nullptr, FALSE, FALSE, nullptr);
+}
+
+BlockQueue::~BlockQueue()
+{
+    FramedBlock block;
+    while (_blocks.TryPop(block))
+    {
+        Release(block);
+    }
+
+    ::CloseHandle(_hNotEmptyEvent);
+    ::CloseHandle(_hNotFullEvent);
+}
+
+bool BlockQueue::Push(const FramedBlock& block)
+{
+    bool hasStalled = false;
+    while (!_blocks.TryPush(block))
+    {
+        if (_isAborted.load(std::memory_order_acquire))
+            return false;
+
+        if (!hasStalled)
+        {
+            hasStalled = true;
+            _readerStallCount++;
+        }
+
+        ::WaitForSingleObject(_hNotFullEvent, BlockQueueWaitMs);
+    }
+
+    _pushedCount++;
+    uint32_t depth = _blocks.GetCount();
+    if (depth > _maxDepth.load(std::memory_order_relaxed))
+        _maxDepth.store(depth, std::memory_order_relaxed);
+
+    // wake up the parser only if it was waiting for this block
+    if (depth == 1)
+        ::SetEvent(_hNotEmptyEvent);
+
+    return true;
+}
+
+void BlockQueue::Complete()
+{
+    _isCompleted.store(true, std::memory_order_release);
+    ::SetEvent(_hNotEmptyEvent);
+}
+
+bool BlockQueue::Pop(FramedBlock& block)
+{
+    bool hasStalled = false;
+    while (!_blocks.TryPop(block))
+    {
+        // check the ring again after the completion to get the last pushed blocks
+        if (_isCompleted.load(std::memory_order_acquire))
+            return _blocks.TryPop(block);
+
+        if (!hasStalled)
+        {
+            hasStalled = true;
+            _parserStallCount++;
+        }
+
+        ::WaitForSingleObject(_hNotEmptyEvent, BlockQueueWaitMs);
+    }
+
+    // wake up the reader only if it was waiting for a free slot
+    if (_blocks.GetCount() == _blocks.GetCapacity() - 1)
+        ::SetEvent(_hNotFullEvent);
+
+    return true;
+}
+
+void BlockQueue::Release(FramedBlock& block)
+{
+    _pool.Release(block.pBuffer, block.BufferSize);
+
+    block.pBuffer = nullptr;
+    block.pBlock = nullptr;
+}
+
+void BlockQueue::Abort()
+{
+    _isAborted.store(true, std::memory_order_release);
+    ::SetEvent(_hNotFullEvent);
+}
+
+void BlockQueue::GetStatistics(BlockQueueStatistics& stats)
+{
+    stats.PushedCount = _pushedCount.load(std::memory_order_relaxed);
+    stats.Depth = _blocks.GetCount();
+    stats.MaxDepth = _maxDepth.load(std::memory_order_relaxed);
+    stats.ReaderStallCount = _readerStallCount.load(std::memory_order_relaxed);
+    stats.ParserStallCount = _parserStallCount.load(std::memory_order_relaxed);
+}
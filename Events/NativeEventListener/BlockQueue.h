@@ -0,0 +1,142 @@
+#pragma once
+#include <atomic>
+#include <windows.h>
+#include <stdint.h>
+
+#include "BlockBufferPool.h"
+#include "NettraceFormat.h"
+
+
+// max number of blocks read from the pipe but not yet parsed
+const uint32_t DefaultBlockQueueCapacity = 256;     // ~1 MB with the usual 4 KB CLR blocks
+
+
+// A block extracted from the nettrace stream by the reader thread
+struct FramedBlock
+{
+    ObjectType Type;
+    const uint8_t* pBlock;
+    uint32_t BlockSize;         // including the final EndObject tag
+    uint64_t OriginInFile;      // needed by the parsers to compute padding
+
+    // buffer from the pool (nullptr if the block has been read in place)
+    uint8_t* pBuffer;
+    uint32_t BufferSize;        // could be larger than BlockSize
+};
+
+// can be read from any thread while the session is running
+struct BlockQueueStatistics
+{
+    uint64_t PushedCount;
+    uint32_t Depth;             // blocks waiting to be parsed
+    uint32_t MaxDepth;
+    uint64_t ReaderStallCount;  // number of times the reader had to wait for the parser (queue full)
+    uint64_t ParserStallCount;  // number of times the parser had to wait for the reader (queue empty)
+};
+
+
+// Lock-free single producer/single consumer circular array (capacity is a power of 2)
+template <typename T>
+class SpscRing
+{
+public:
+    SpscRing(uint32_t capacity)
+    {
+        _capacity = 1;
+        while (_capacity < capacity)
+        {
+            _capacity <<= 1;
+        }
+        _pItems = new T[_capacity];
+        _head = 0;
+        _tail = 0;
+    }
+
+    ~SpscRing()
+    {
+        delete [] _pItems;
+    }
+
+    // producer side
+    bool TryPush(const T& item)
+    {
+        uint32_t tail = _tail.load(std::memory_order_relaxed);
+        if (tail - _head.load(std::memory_order_acquire) == _capacity)
+            return false;
+
+        _pItems[tail & (_capacity - 1)] = item;
+        _tail.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    // consumer side
+    bool TryPop(T& item)
+    {
+        uint32_t head = _head.load(std::memory_order_relaxed);
+        if (head == _tail.load(std::memory_order_acquire))
+            return false;
+
+        item = _pItems[head & (_capacity - 1)];
+        _head.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    uint32_t GetCount() const
+    {
+        return _tail.load(std::memory_order_acquire) - _head.load(std::memory_order_acquire);
+    }
+
+    uint32_t GetCapacity() const
+    {
+        return _capacity;
+    }
+
+private:
+    T* _pItems;
+    uint32_t _capacity;
+
+    // monotonic positions: [_head, _tail) are available
+    std::atomic<uint32_t> _head;    // updated by the consumer
+    std::atomic<uint32_t> _tail;    // updated by the producer
+};
+
+
+// Blocks are passed from the reader thread (that drains the pipe) to the parser thread.
+// The parser gives the block buffers back to the pool so that the reader
+// can reuse them instead of allocating a new buffer per block.
+class BlockQueue
+{
+public:
+    BlockQueue(BlockBufferPool& pool, uint32_t capacity = DefaultBlockQueueCapacity);
+    ~BlockQueue();
+
+    // reader side
+    bool Push(const FramedBlock& block);    // false if the parser has aborted
+    void Complete();                        // no more blocks will be pushed
+
+    // parser side
+    bool Pop(FramedBlock& block);           // false when completed and empty
+    void Release(FramedBlock& block);       // the block buffer can be reused by the reader
+    void Abort();                           // the parser won't pop anymore
+
+    void GetStatistics(BlockQueueStatistics& stats);
+
+    // blocks waiting to be parsed
+    uint32_t GetDepth() const { return _blocks.GetCount(); }
+    uint32_t GetCapacity() const { return _blocks.GetCapacity(); }
+
+private:
+    SpscRing<FramedBlock> _blocks;
+    BlockBufferPool& _pool;
+
+    HANDLE _hNotEmptyEvent;
+    HANDLE _hNotFullEvent;
+    std::atomic<bool> _isCompleted;
+    std::atomic<bool> _isAborted;
+
+    // statistics
+    std::atomic<uint64_t> _pushedCount;
+    std::atomic<uint32_t> _maxDepth;
+    std::atomic<uint64_t> _readerStallCount;
+    std::atomic<uint64_t> _parserStallCount;
+};
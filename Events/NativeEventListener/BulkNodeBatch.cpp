@@ -0,0 +1,48 @@
+#include <string.h>
+
+#include "BulkNodeBatch.h"
+
+
+BulkNodeBatch::BulkNodeBatch()
+{
+    _count = 0;
+}
+
+void BulkNodeBatch::Resize(uint32_t count)
+{
+    _count = count;
+    if (Addresses.size() >= count)
+        return;
+
+    Addresses.resize(count);
+    Sizes.resize(count);
+    TypeIds.resize(count);
+    EdgeCounts.resize(count);
+}
+
+template <class TPointer>
+void BulkNodeBatch::Decode(const uint8_t* pNodes, uint32_t count)
+{
+    Resize(count);
+
+    const uint32_t nodeSize = GetNodeSize<TPointer>();
+    const uint32_t sizeOffset = sizeof(TPointer);
+    const uint32_t typeIdOffset = sizeOffset + sizeof(uint64_t);
+    const uint32_t edgeCountOffset = typeIdOffset + sizeof(uint64_t);
+
+    // the fields are at fixed offsets so the compiler can unroll this loop without any dependency between nodes
+    for (uint32_t i = 0; i < count; i++)
+    {
+        const uint8_t* pNode = pNodes + (size_t)i * nodeSize;
+
+        TPointer address;
+        memcpy(&address, pNode, sizeof(address));
+        Addresses[i] = address;
+        memcpy(&Sizes[i], pNode + sizeOffset, sizeof(uint64_t));
+        memcpy(&TypeIds[i], pNode + typeIdOffset, sizeof(uint64_t));
+        memcpy(&EdgeCounts[i], pNode + edgeCountOffset, sizeof(uint64_t));
+    }
+}
+
+template void BulkNodeBatch::Decode<uint32_t>(const uint8_t* pNodes, uint32_t count);
+template void BulkNodeBatch::Decode<uint64_t>(const uint8_t* pNodes, uint32_t count);
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+
+
+// The nodes of a BulkNode payload are stored in columns (structure of arrays) so that they can be
+// decoded in one pass over the fixed size records and then given to the GcDumpState in one call
+// instead of one call per node.
+class BulkNodeBatch
+{
+public:
+    BulkNodeBatch();
+
+    // decode the given count of nodes: Address (TPointer) followed by Size, TypeID and EdgeCount (UInt64)
+    // TPointer is uint32_t or uint64_t depending on the bitness of the monitored process
+    // Note: the caller must have checked that count * GetNodeSize<TPointer>() bytes are readable
+    template <class TPointer>
+    void Decode(const uint8_t* pNodes, uint32_t count);
+
+    template <class TPointer>
+    static constexpr uint32_t GetNodeSize() { return sizeof(TPointer) + 3 * sizeof(uint64_t); }
+
+    uint32_t GetCount() const { return _count; }
+
+public:
+    std::vector<uint64_t> Addresses;
+    std::vector<uint64_t> Sizes;
+    std::vector<uint64_t> TypeIds;
+    std::vector<uint64_t> EdgeCounts;
+
+private:
+    // the columns are reused from one payload to the next to avoid allocations
+    void Resize(uint32_t count);
+
+private:
+    uint32_t _count;
+};
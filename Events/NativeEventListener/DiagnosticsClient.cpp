@@ -1,7 +1,9 @@
 #include "DiagnosticsClient.h"
 #include "PidEndpoint.h"
 #include "RecordedEndpoint.h"
+#include "MappedEndpoint.h"
 #include "FileRecorder.h"
+#include "Log.h"
 
 DiagnosticsClient* DiagnosticsClient::Create(int pid, const wchar_t* recordingFilename)
 {
@@ -11,14 +13,20 @@ DiagnosticsClient* DiagnosticsClient::Create(int pid, const wchar_t* recordingFi
 
     IIpcEndpoint* pEndpoint = PidEndpoint::Create(pid, pRecorder);
     if (pEndpoint == nullptr)
+    {
+        delete pRecorder;
         return nullptr;
+    }
 
-    return new DiagnosticsClient(pid, pEndpoint);
+    return new DiagnosticsClient(pid, pEndpoint, pRecorder);
 }
 
 DiagnosticsClient* DiagnosticsClient::Create(const wchar_t* recordFilename, const wchar_t* recordingFilename)
 {
-    IIpcEndpoint* pEndpoint = RecordedEndpoint::Create(recordFilename);
+    // parse the blocks directly from the memory mapped file if possible
+    IIpcEndpoint* pEndpoint = MappedEndpoint::Create(recordFilename);
+    if (pEndpoint == nullptr)
+        pEndpoint = RecordedEndpoint::Create(recordFilename);
     if (pEndpoint == nullptr)
         return nullptr;
 
@@ -26,14 +34,15 @@ DiagnosticsClient* DiagnosticsClient::Create(const wchar_t* recordFilename, cons
     if (recordingFilename != nullptr)
         pRecorder = new FileRecorder(recordingFilename);
 
-    return new DiagnosticsClient(-1, pEndpoint);
+    return new DiagnosticsClient(-1, pEndpoint, pRecorder);
 }
 
 
-DiagnosticsClient::DiagnosticsClient(int pid, IIpcEndpoint* pEndpoint)
+DiagnosticsClient::DiagnosticsClient(int pid, IIpcEndpoint* pEndpoint, FileRecorder* pRecorder)
 {
     _pid = pid;
     _pEndpoint = pEndpoint;
+    _pRecorder = pRecorder;
 }
 
 DiagnosticsClient::~DiagnosticsClient()
@@ -43,6 +52,25 @@ DiagnosticsClient::~DiagnosticsClient()
         _pEndpoint->Close();
         _pEndpoint = nullptr;
     }
+
+    // the endpoint does not write into the recorder anymore
+    if (_pRecorder != nullptr)
+    {
+        _pRecorder->Close();
+
+        RecorderStatistics stats;
+        _pRecorder->GetStatistics(stats);
+        LOG_INFO("Recording: " << stats.BytesWritten / 1024 << " KB written in " << stats.BatchCount << " batches ("
+            << stats.SyncCount << " syncs) - max flush latency " << stats.MaxFlushLatencyUs << " us\n");
+        if (stats.SpillCount > 0)
+        {
+            LOG_INFO("   " << stats.SpillCount << " writes spilled (up to " << stats.MaxBytesSpilled / 1024 << " KB) - "
+                << stats.BytesDropped / 1024 << " KB dropped\n");
+        }
+
+        delete _pRecorder;
+        _pRecorder = nullptr;
+    }
 }
 
 
@@ -3,6 +3,7 @@
 #include "IIpcEndpoint.h"
 #include "EventPipeSession.h"
 #include "DiagnosticsProtocol.h"
+#include "FileRecorder.h"
 
 // This class is used to send and process ONE request: create one instance per command.
 // For example, listening to CLR events requires one instance to start the session
@@ -32,10 +33,13 @@ public:
     // COUNTER
     //
 private:
-    DiagnosticsClient(int pid, IIpcEndpoint* pEndpoint);
+    DiagnosticsClient(int pid, IIpcEndpoint* pEndpoint, FileRecorder* pRecorder);
 
 private:
     int _pid;
     IIpcEndpoint* _pEndpoint;
+
+    // nullptr if the received bytes are not recorded
+    FileRecorder* _pRecorder;
 };
 
@@ -2,6 +2,7 @@
 #include <iomanip>
 
 #include "DiagnosticsProtocol.h"
+#include "Log.h"
 
 // dump the buffer every 16 bytes + corresponding ASCII characters
 // ex:  44 4F 54 4E 45 54 5F 49  50 43 5F 56 31 00 77 00    DOTNET_IPC_V1.w.
@@ -102,7 +103,7 @@ bool ProcessInfoRequest::Send(HANDLE hPipe)
     if (!::WriteFile(hPipe, &message, sizeof(message), &bytesWrittenCount, nullptr))
     {
         Error = ::GetLastError();
-        std::cout << "Error while sending ProcessInfo message to the CLR: 0x" << std::hex << Error << std::dec << "\n";
+        LOG_ERROR("Error while sending ProcessInfo message to the CLR: 0x" << std::hex << Error << std::dec << "\n");
         return false;
     }
 
@@ -113,14 +114,14 @@ bool ProcessInfoRequest::Send(HANDLE hPipe)
     if (!::ReadFile(hPipe, &message, sizeof(message), &bytesReadCount, nullptr))
     {
         Error = ::GetLastError();
-        std::cout << "Error while getting ProcessInfo response from the CLR: 0x" << std::hex << Error<< std::dec << "\n";
+        LOG_ERROR("Error while getting ProcessInfo response from the CLR: 0x" << std::hex << Error<< std::dec << "\n");
         return false;
     }
 
     if (message.CommandId != (uint8_t)DiagnosticServerResponseId::OK)
     {
         Error = message.CommandId;
-        std::cout << "Error returned by the CLR in ProcessInfo response: 0x" << std::hex << Error<< std::dec << "\n";
+        LOG_ERROR("Error returned by the CLR in ProcessInfo response: 0x" << std::hex << Error<< std::dec << "\n");
         return false;
     }
 
@@ -130,7 +131,7 @@ bool ProcessInfoRequest::Send(HANDLE hPipe)
     if (!::ReadFile(hPipe, _buffer, payloadSize, &bytesReadCount, nullptr))
     {
         Error = ::GetLastError();
-        std::cout << "Error while getting ProcessInfo payload: 0x" << std::hex << Error << std::dec << "\n";
+        LOG_ERROR("Error while getting ProcessInfo payload: 0x" << std::hex << Error << std::dec << "\n");
         return false;
     }
     // Note: bytesReadCount == payloadSize
@@ -146,7 +147,7 @@ bool ProcessInfoRequest::Process(IIpcEndpoint* pEndpoint)
     if (!pEndpoint->Write(&message, sizeof(message), &bytesWrittenCount))
     {
         Error = ::GetLastError();
-        std::cout << "Error while sending ProcessInfo message to the CLR: 0x" << std::hex << Error << std::dec << "\n";
+        LOG_ERROR("Error while sending ProcessInfo message to the CLR: 0x" << std::hex << Error << std::dec << "\n");
         return false;
     }
 
@@ -157,14 +158,14 @@ bool ProcessInfoRequest::Process(IIpcEndpoint* pEndpoint)
     if (!pEndpoint->Read(&message, sizeof(message), &bytesReadCount))
     {
         Error = ::GetLastError();
-        std::cout << "Error while getting ProcessInfo response from the CLR: 0x" << std::hex << Error << std::dec << "\n";
+        LOG_ERROR("Error while getting ProcessInfo response from the CLR: 0x" << std::hex << Error << std::dec << "\n");
         return false;
     }
 
     if (message.CommandId != (uint8_t)DiagnosticServerResponseId::OK)
     {
         Error = message.CommandId;
-        std::cout << "Error returned by the CLR in ProcessInfo response: 0x" << std::hex << Error << std::dec << "\n";
+        LOG_ERROR("Error returned by the CLR in ProcessInfo response: 0x" << std::hex << Error << std::dec << "\n");
         return false;
     }
 
@@ -174,7 +175,7 @@ bool ProcessInfoRequest::Process(IIpcEndpoint* pEndpoint)
     if (!pEndpoint->Read(_buffer, payloadSize, &bytesReadCount))
     {
         Error = ::GetLastError();
-        std::cout << "Error while getting ProcessInfo payload: 0x" << std::hex << Error << std::dec << "\n";
+        LOG_ERROR("Error while getting ProcessInfo payload: 0x" << std::hex << Error << std::dec << "\n");
         return false;
     }
     // Note: bytesReadCount == payloadSize
@@ -243,6 +244,70 @@ bool ProcessInfoRequest::ParseResponse(DWORD payloadSize)
 }
 
 
+ResumeRuntimeRequest::ResumeRuntimeRequest()
+{
+    Error = 0;
+}
+
+bool ResumeRuntimeRequest::Process(IIpcEndpoint* pEndpoint)
+{
+    if (!Send(pEndpoint))
+        return false;
+
+    IpcHeader response = {};
+    DWORD bytesReadCount = 0;
+    if (!pEndpoint->Read(&response, sizeof(response), &bytesReadCount))
+    {
+        Error = ::GetLastError();
+        LOG_ERROR("Error while getting ResumeRuntime response from the CLR: 0x" << std::hex << Error << std::dec << "\n");
+        return false;
+    }
+
+    if (!CheckResponse(response))
+        return false;
+
+    // the OK response payload is the 32 bit result code
+    uint16_t payloadSize = response.Size - sizeof(response);
+    if (payloadSize >= sizeof(uint32_t))
+    {
+        uint32_t result = 0;
+        if (!pEndpoint->ReadDWord(result))
+        {
+            Error = ::GetLastError();
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool ResumeRuntimeRequest::Send(IIpcEndpoint* pEndpoint)
+{
+    IpcHeader message = ResumeRuntimeMessage;
+    DWORD bytesWrittenCount = 0;
+    if (!pEndpoint->Write(&message, sizeof(message), &bytesWrittenCount))
+    {
+        Error = ::GetLastError();
+        LOG_ERROR("Error while sending ResumeRuntime message to the CLR: 0x" << std::hex << Error << std::dec << "\n");
+        return false;
+    }
+
+    return true;
+}
+
+bool ResumeRuntimeRequest::CheckResponse(const IpcHeader& response)
+{
+    if (response.CommandId != (uint8_t)DiagnosticServerResponseId::OK)
+    {
+        Error = response.CommandId;
+        LOG_ERROR("Error returned by the CLR in ResumeRuntime response: 0x" << std::hex << Error << std::dec << "\n");
+        return false;
+    }
+
+    return true;
+}
+
+
 EventPipeStartRequest::EventPipeStartRequest()
 {
     Error = 0;
@@ -274,50 +339,66 @@ StartSessionMessage* CreateStartSessionMessage(uint64_t keywords, EventVerbosity
 bool EventPipeStartRequest::Process(IIpcEndpoint* pEndpoint, uint64_t keywords, EventVerbosityLevel verbosity)
 {
     // send an StartSessionMessage and parse the response
+    if (!Send(pEndpoint, keywords, verbosity))
+        return false;
+
+    // analyze the response
+    IpcHeader response = {};
+    DWORD bytesReadCount = 0;
+    if (!pEndpoint->Read(&response, sizeof(response), &bytesReadCount))
+    {
+        Error = ::GetLastError();
+        LOG_ERROR("Error while getting EventPipe collect response from the CLR: 0x" << std::hex << Error << std::dec << "\n");
+        return false;
+    }
+
+    if (!CheckResponse(response))
+        return false;
+
+    // get the session ID from the payload
+    if (!pEndpoint->ReadLong(SessionId))
+    {
+        Error = ::GetLastError();
+        LOG_ERROR("Error while getting Session ID from EventPipe collect reponse payload: 0x" << std::hex << Error << std::dec << "\n");
+        return false;
+    }
+
+    return true;
+}
+
+bool EventPipeStartRequest::Send(IIpcEndpoint* pEndpoint, uint64_t keywords, EventVerbosityLevel verbosity)
+{
     StartSessionMessage* pMessage = CreateStartSessionMessage(keywords, verbosity);
 
-    DumpBuffer((uint8_t*)pMessage, pMessage->Size);
+    LOG_VERBOSE_DUMP(DumpBuffer((uint8_t*)pMessage, pMessage->Size));
 
     DWORD writtenBytes = 0;
     if (!pEndpoint->Write(pMessage, pMessage->Size, &writtenBytes))
     {
         Error = ::GetLastError();
-        std::cout << "Error while sending EventPipe collect message to the CLR: 0x" << std::hex << Error << std::dec << "\n";
+        LOG_ERROR("Error while sending EventPipe collect message to the CLR: 0x" << std::hex << Error << std::dec << "\n");
         delete pMessage;
         return false;
     }
     delete pMessage;
 
-    // analyze the response
-    IpcHeader response = {};
-    DWORD bytesReadCount = 0;
-    if (!pEndpoint->Read(&response, sizeof(response), &bytesReadCount))
-    {
-        Error = ::GetLastError();
-        std::cout << "Error while getting EventPipe collect response from the CLR: 0x" << std::hex << Error << std::dec << "\n";
-        return false;
-    }
+    return true;
+}
 
+bool EventPipeStartRequest::CheckResponse(const IpcHeader& response)
+{
     if (response.CommandId != (uint8_t)DiagnosticServerResponseId::OK)
     {
         Error = response.CommandId;
-        std::cout << "Error returned by the CLR in EventPipe collect response: 0x" << std::hex << Error << std::dec << "\n";
+        LOG_ERROR("Error returned by the CLR in EventPipe collect response: 0x" << std::hex << Error << std::dec << "\n");
         return false;
     }
 
-    // get the session ID from the payload
     uint16_t payloadSize = response.Size - sizeof(response);
     if (payloadSize < sizeof(uint64_t))
     {
         Error = 0;
-        std::cout << "Unexpected EventPipe collect reponse payload size: " << payloadSize << "\n";
-        return false;
-    }
-
-    if (!pEndpoint->ReadLong(SessionId))
-    {
-        Error = ::GetLastError();
-        std::cout << "Error while getting Session ID from EventPipe collect reponse payload: 0x" << std::hex << Error << std::dec << "\n";
+        LOG_ERROR("Unexpected EventPipe collect reponse payload size: " << payloadSize << "\n");
         return false;
     }
 
@@ -351,7 +432,7 @@ bool EventPipeStopRequest::Process(IIpcEndpoint* pEndpoint, uint64_t sessionId)
     if (!pEndpoint->Write(pMessage, pMessage->Size, &writtenBytes))
     {
         Error = ::GetLastError();
-        std::cout << "Error while sending EventPipe Stop message to the CLR: 0x" << std::hex << Error << std::dec << "\n";
+        LOG_ERROR("Error while sending EventPipe Stop message to the CLR: 0x" << std::hex << Error << std::dec << "\n");
         delete pMessage;
         return false;
     }
@@ -363,7 +444,7 @@ bool EventPipeStopRequest::Process(IIpcEndpoint* pEndpoint, uint64_t sessionId)
     if (!pEndpoint->Read(&response, sizeof(response), &bytesReadCount))
     {
         Error = ::GetLastError();
-        std::cout << "Error while reading EventPipe Stop message response from the CLR: 0x" << std::hex << Error << std::dec << "\n";
+        LOG_ERROR("Error while reading EventPipe Stop message response from the CLR: 0x" << std::hex << Error << std::dec << "\n");
         return false;
     }
 
@@ -378,17 +459,17 @@ bool EventPipeStopRequest::Process(IIpcEndpoint* pEndpoint, uint64_t sessionId)
     if (payloadSize < sizeof(uint32_t))
     {
         Error = 0;
-        std::cout << "Unexpected EventPipe stop reponse payload size: " << payloadSize << "\n";
+        LOG_ERROR("Unexpected EventPipe stop reponse payload size: " << payloadSize << "\n");
         return false;
     }
     uint32_t error = 0;
     if (!pEndpoint->ReadDWord(error))
     {
         Error = ::GetLastError();
-        std::cout << "Error while getting Session ID from EventPipe stop reponse payload: 0x" << std::hex << Error << std::dec << "\n";
+        LOG_ERROR("Error while getting Session ID from EventPipe stop reponse payload: 0x" << std::hex << Error << std::dec << "\n");
         return false;
     }
 
-    std::cout << "Error while getting Session ID from EventPipe stop reponse payload: 0x" << std::hex << error << std::dec << "\n";
+    LOG_ERROR("Error returned by the CLR in EventPipe stop response: 0x" << std::hex << error << std::dec << "\n");
     return false;
 }
\ No newline at end of file
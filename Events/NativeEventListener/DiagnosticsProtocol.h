@@ -116,12 +116,29 @@ const IpcHeader GenericErrorHeader =
 
 // PROCESS commands (available in .NET 5+)
 //
+enum class ProcessCommandId : uint8_t
+{
+    GetProcessInfo = 0x00,
+    ResumeRuntime = 0x01,
+};
+
 const IpcHeader ProcessInfoMessage =
 {
     { DotnetIpcMagic_V1 },
     (uint16_t)sizeof(IpcHeader),
     (uint8_t)DiagnosticServerCommandSet::Process,
-    (uint8_t)DiagnosticServerResponseId::OK,
+    (uint8_t)ProcessCommandId::GetProcessInfo,
+    (uint16_t)0x0000
+};
+
+// sent to a runtime that has been started with DOTNET_DiagnosticPorts (in suspend mode)
+// to let it continue its startup
+const IpcHeader ResumeRuntimeMessage =
+{
+    { DotnetIpcMagic_V1 },
+    (uint16_t)sizeof(IpcHeader),
+    (uint8_t)DiagnosticServerCommandSet::Process,
+    (uint8_t)ProcessCommandId::ResumeRuntime,
     (uint16_t)0x0000
 };
 
@@ -151,6 +168,23 @@ private:
 };
 
 
+class ResumeRuntimeRequest
+{
+public:
+    ResumeRuntimeRequest();
+
+    bool Process(IIpcEndpoint* pEndpoint);
+
+    // asynchronous version: send the command and check the response when it is received
+    // Note: the response payload (32 bit result code) is ignored
+    bool Send(IIpcEndpoint* pEndpoint);
+    bool CheckResponse(const IpcHeader& response);
+
+public:
+    DWORD Error;
+};
+
+
 // EVENTPIPE commands
 //
 enum class EventPipeCommandId : uint8_t
@@ -280,6 +314,11 @@ public:
 
     bool Process(IIpcEndpoint* pEndpoint, uint64_t keywords, EventVerbosityLevel verbosity);
 
+    // asynchronous version: send the command and check the response when it is received
+    // Note: the session ID is the first 8 bytes of the response payload
+    bool Send(IIpcEndpoint* pEndpoint, uint64_t keywords, EventVerbosityLevel verbosity);
+    bool CheckResponse(const IpcHeader& response);
+
 public:
     DWORD Error;
     uint64_t SessionId;
@@ -0,0 +1,70 @@
+#include <iostream>
+
+#include "BlockParser.h"
+
+
+EventBlockDecoder::EventBlockDecoder(MetadataTable& metadata, uint32_t decodedEvents)
+    :
+    EventParserBase(metadata),
+    _decodedEvents(decodedEvents)
+{
+    _pRecords = nullptr;
+}
+
+bool EventBlockDecoder::Decode(const uint8_t* pBlock, uint32_t bytesCount, uint64_t blockOriginInFile, std::vector<EventRecord>& records)
+{
+    _pRecords = &records;
+    bool success = Parse(pBlock, bytesCount, blockOriginInFile);
+    _pRecords = nullptr;
+
+    return success;
+}
+
+bool EventBlockDecoder::OnParseBlob(EventBlobHeader& header, bool isCompressed, DWORD& blobSize)
+{
+    if (isCompressed)
+    {
+        if (!ReadCompressedHeader(header, blobSize))
+        {
+            return false;
+        }
+    }
+    else
+    {
+        if (!ReadUncompressedHeader(header, blobSize))
+        {
+            return false;
+        }
+    }
+
+    _pRecords->emplace_back();
+    EventRecord& record = _pRecords->back();
+    record.Header = header;
+    record.PayloadOffset = _pos;
+    record.IsPayloadDecoded = false;
+
+    // no MetadataBlock is parsed while blocks are being decoded (see EventPipeSession::ProcessBlock)
+    record.pMetadata = _metadata.Find(header.MetadataId);
+
+    // the payload of the listened events is decoded here instead of by the EventParser
+    if ((record.pMetadata != nullptr) && ((_decodedEvents & SubscribeTo(record.pMetadata->HandlerId)) != 0))
+    {
+        if (DecodeListenedEvent(record.pMetadata->HandlerId, record.Header, *record.pMetadata, record.Event))
+        {
+            record.IsPayloadDecoded = true;
+            blobSize += header.PayloadSize;
+            return true;
+        }
+
+        // let the EventParser decode it again to report the error in stream order
+        _pos = record.PayloadOffset;
+    }
+
+    // the payload will be read by the EventParser handlers
+    if (!SkipBytes(header.PayloadSize))
+        return false;
+
+    blobSize += header.PayloadSize;
+
+    return true;
+}
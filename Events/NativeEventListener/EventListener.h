@@ -0,0 +1,127 @@
+#pragma once
+#include <stdint.h>
+
+#include "GcDumpState.h"
+#include "SessionStatistics.h"
+#include "WStringView.h"
+
+
+// what is known about any event from its header and metadata
+struct EventContext
+{
+    uint64_t ThreadId;
+    uint64_t Timestamp;
+    uint32_t ProcessorNumber;
+    uint32_t MetadataId;
+    uint32_t Version;
+};
+
+// Note: the strings point to the block being parsed (see WStringView)
+struct AllocationTickEvent
+{
+    uint32_t Amount;
+    uint32_t Kind;              // 0 = small object heap, 1 = LOH
+    uint16_t ClrInstanceId;
+    uint64_t Amount64;
+    uint64_t TypeId;            // MethodTable address
+    WStringView TypeName;
+    uint32_t HeapIndex;
+    uint64_t Address;           // 0 before V3
+};
+
+struct ExceptionThrownEvent
+{
+    WStringView Type;
+    WStringView Message;        // empty if no message
+};
+
+struct ContentionStopEvent
+{
+    uint8_t Flags;              // 0 = managed, 1 = native
+    uint16_t ClrInstanceId;
+    double DurationNs;
+};
+
+struct GcStartEvent
+{
+    uint32_t Count;
+    uint32_t Depth;
+    GCReason Reason;
+    GCType Type;
+    uint16_t ClrInstanceId;
+    uint64_t ClientSequenceNumber;  // 0 before V2
+};
+
+struct GcEndEvent
+{
+    uint32_t Count;
+    uint32_t Depth;
+    uint16_t ClrInstanceId;
+};
+
+// payload of any of the events above, decoded ahead of the dispatch (see EventBlockDecoder)
+union ListenedEvent
+{
+    ListenedEvent() : GcEnd() {}
+
+    AllocationTickEvent AllocationTick;
+    ExceptionThrownEvent ExceptionThrown;
+    ContentionStopEvent ContentionStop;
+    GcStartEvent GcStart;
+    GcEndEvent GcEnd;
+};
+
+
+// bit to set in the value returned by GetSubscribedEvents() for each event to be notified of
+constexpr uint32_t SubscribeTo(EventHandlerId id)
+{
+    return 1u << (uint32_t)id;
+}
+
+const uint32_t AllListenedEvents =
+    SubscribeTo(EventHandlerId::AllocationTick) |
+    SubscribeTo(EventHandlerId::ContentionStop) |
+    SubscribeTo(EventHandlerId::ExceptionThrown) |
+    SubscribeTo(EventHandlerId::GcStart) |
+    SubscribeTo(EventHandlerId::GcEnd);
+
+
+// Receive the CLR events decoded by the EventParser: the payload of the events that are not
+// subscribed to is skipped without being decoded (unless they are logged).
+// There are 2 ways to listen to the events:
+//  - derive from IEventListener and override the handlers (virtual calls)
+//  - pass any class with the same (non virtual) handlers and a static constexpr SubscribedEvents
+//    to EventPipeSession::SetEventListener<T>(): the session then parses the events with a
+//    ListenedEventParser<T> instantiated for that class
+//    so that the handlers can be inlined (derive from EventListenerBase<T> to get empty handlers)
+class IEventListener
+{
+public:
+    virtual uint32_t GetSubscribedEvents() { return AllListenedEvents; }
+
+    virtual void OnAllocationTick(const EventContext& context, const AllocationTickEvent& event) {}
+    virtual void OnExceptionThrown(const EventContext& context, const ExceptionThrownEvent& event) {}
+    virtual void OnContentionStop(const EventContext& context, const ContentionStopEvent& event) {}
+    virtual void OnGcStart(const EventContext& context, const GcStartEvent& event) {}
+    virtual void OnGcEnd(const EventContext& context, const GcEndEvent& event) {}
+
+    virtual ~IEventListener() = default;
+};
+
+
+// CRTP base class for statically dispatched listeners: TListener hides the handlers it needs
+// and defines SubscribedEvents accordingly
+template <class TListener>
+class EventListenerBase
+{
+public:
+    static constexpr uint32_t SubscribedEvents = 0;
+
+    uint32_t GetSubscribedEvents() { return TListener::SubscribedEvents; }
+
+    void OnAllocationTick(const EventContext& context, const AllocationTickEvent& event) {}
+    void OnExceptionThrown(const EventContext& context, const ExceptionThrownEvent& event) {}
+    void OnContentionStop(const EventContext& context, const ContentionStopEvent& event) {}
+    void OnGcStart(const EventContext& context, const GcStartEvent& event) {}
+    void OnGcEnd(const EventContext& context, const GcEndEvent& event) {}
+};
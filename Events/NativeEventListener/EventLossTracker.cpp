@@ -0,0 +1,130 @@
+#include <algorithm>
+#include <iostream>
+
+#include "EventLossTracker.h"
+#include "Log.h"
+
+
+EventLossTracker::EventLossTracker(std::unordered_map<uint64_t, EventCacheThread>& threads)
+    :
+    _threads(threads)
+{
+    _intervalDroppedEventsCount = 0;
+    _stats = {};
+    ::InitializeSRWLock(&_lock);
+}
+
+void EventLossTracker::OnGap(EventCacheThread& thread, uint32_t expectedSequenceNumber, uint32_t sequenceNumber)
+{
+    // sequence numbers wrap around
+    uint32_t droppedCount = sequenceNumber - expectedSequenceNumber;
+    if ((int32_t)droppedCount <= 0)
+        return;
+
+    thread.DroppedEventsCount += droppedCount;
+    thread.IntervalDroppedEventsCount += droppedCount;
+    _intervalDroppedEventsCount += droppedCount;
+}
+
+void EventLossTracker::OnEvent(uint64_t captureThreadId, uint32_t sequenceNumber, uint64_t timestamp)
+{
+    auto result = _threads.try_emplace(captureThreadId);
+    EventCacheThread& thread = result.first->second;
+    if (result.second)
+    {
+        // the sequence numbers start at 1 for each thread of the session
+        thread = {};
+        OnGap(thread, 1, sequenceNumber);
+    }
+    else
+    {
+        OnGap(thread, thread.SequenceNumber + 1, sequenceNumber);
+    }
+
+    thread.SequenceNumber = sequenceNumber;
+    thread.LastCachedEventTimestamp = timestamp;
+}
+
+void EventLossTracker::OnSequencePoint(uint64_t threadId, uint32_t sequenceNumber)
+{
+    _sequencePointThreads.push_back(threadId);
+
+    auto result = _threads.try_emplace(threadId);
+    EventCacheThread& thread = result.first->second;
+    if (result.second)
+    {
+        // all events of this thread since the beginning of the session have been dropped
+        thread = {};
+        OnGap(thread, 1, sequenceNumber + 1);
+    }
+    else
+    {
+        // the sequence number of the last event written by the thread
+        OnGap(thread, thread.SequenceNumber, sequenceNumber);
+    }
+
+    thread.SequenceNumber = sequenceNumber;
+}
+
+void EventLossTracker::EndSequencePoint(uint64_t timestamp)
+{
+    std::vector<ThreadEventLoss> threadsEventLoss;
+    threadsEventLoss.reserve(_threads.size());
+
+    std::sort(_sequencePointThreads.begin(), _sequencePointThreads.end());
+    for (auto current = _threads.begin(); current != _threads.end(); )
+    {
+        EventCacheThread& thread = current->second;
+        if (thread.IntervalDroppedEventsCount > 0)
+        {
+            LOG_INFO("Thread #" << current->first << " : " << thread.IntervalDroppedEventsCount << " events dropped\n");
+        }
+
+        threadsEventLoss.push_back({ current->first, thread.DroppedEventsCount, thread.IntervalDroppedEventsCount });
+        thread.IntervalDroppedEventsCount = 0;
+
+        // the threads that are not listed have exited
+        if (!std::binary_search(_sequencePointThreads.begin(), _sequencePointThreads.end(), current->first))
+        {
+            current = _threads.erase(current);
+        }
+        else
+        {
+            ++current;
+        }
+    }
+    _sequencePointThreads.clear();
+
+    if (_intervalDroppedEventsCount > 0)
+    {
+        LOG_INFO(_intervalDroppedEventsCount << " events dropped by the runtime before " << timestamp << "\n");
+    }
+
+    ::AcquireSRWLockExclusive(&_lock);
+    _stats.DroppedEventsCount += _intervalDroppedEventsCount;
+    _stats.IntervalsCount++;
+    _stats.LastIntervalDroppedEventsCount = _intervalDroppedEventsCount;
+    if (_intervalDroppedEventsCount > _stats.MaxIntervalDroppedEventsCount)
+    {
+        _stats.MaxIntervalDroppedEventsCount = _intervalDroppedEventsCount;
+    }
+    _stats.ThreadsCount = (uint32_t)_threads.size();
+    _threadsEventLoss.swap(threadsEventLoss);
+    ::ReleaseSRWLockExclusive(&_lock);
+
+    _intervalDroppedEventsCount = 0;
+}
+
+void EventLossTracker::GetStatistics(EventLossStatistics& stats)
+{
+    ::AcquireSRWLockShared(&_lock);
+    stats = _stats;
+    ::ReleaseSRWLockShared(&_lock);
+}
+
+void EventLossTracker::GetThreadsEventLoss(std::vector<ThreadEventLoss>& threads)
+{
+    ::AcquireSRWLockShared(&_lock);
+    threads = _threadsEventLoss;
+    ::ReleaseSRWLockShared(&_lock);
+}
@@ -0,0 +1,74 @@
+#pragma once
+#include <unordered_map>
+#include <vector>
+#include <windows.h>
+#include <stdint.h>
+
+
+class EventCacheThread
+{
+public:
+    uint32_t SequenceNumber;
+    uint64_t LastCachedEventTimestamp;
+
+    // events dropped by the runtime for this thread
+    uint64_t DroppedEventsCount;            // since the beginning of the session
+    uint64_t IntervalDroppedEventsCount;    // since the last sequence point
+};
+
+
+// events dropped for a thread between two sequence points
+struct ThreadEventLoss
+{
+    uint64_t ThreadId;
+    uint64_t DroppedEventsCount;
+    uint64_t IntervalDroppedEventsCount;
+};
+
+// can be read from any thread while the session is running
+// Note: updated at each sequence point (i.e. interval)
+struct EventLossStatistics
+{
+    uint64_t DroppedEventsCount;
+    uint64_t IntervalsCount;
+    uint64_t LastIntervalDroppedEventsCount;
+    uint64_t MaxIntervalDroppedEventsCount;
+    uint32_t ThreadsCount;
+};
+
+
+// Each event contains the sequence number of its capture thread and each SequencePoint block
+// contains the sequence number of the last event written by each thread: a gap means that the
+// runtime has dropped events because its buffers were full (i.e. too many events are enabled).
+// look at EventPipeEventSource/EventCache implementation in TraceEvent
+class EventLossTracker
+{
+public:
+    EventLossTracker(std::unordered_map<uint64_t, EventCacheThread>& threads);
+
+    // called for each event in stream order
+    void OnEvent(uint64_t captureThreadId, uint32_t sequenceNumber, uint64_t timestamp);
+
+    // called for each thread listed in a SequencePoint block and then at the end of the block
+    void OnSequencePoint(uint64_t threadId, uint32_t sequenceNumber);
+    void EndSequencePoint(uint64_t timestamp);
+
+    // can be called from any thread while listening
+    void GetStatistics(EventLossStatistics& stats);
+    void GetThreadsEventLoss(std::vector<ThreadEventLoss>& threads);
+
+private:
+    void OnGap(EventCacheThread& thread, uint32_t expectedSequenceNumber, uint32_t sequenceNumber);
+
+private:
+    std::unordered_map<uint64_t, EventCacheThread>& _threads;
+
+    // threads listed by the current SequencePoint block: the others have exited
+    std::vector<uint64_t> _sequencePointThreads;
+    uint64_t _intervalDroppedEventsCount;
+
+    // copied at each sequence point for the other threads
+    SRWLOCK _lock;
+    EventLossStatistics _stats;
+    std::vector<ThreadEventLoss> _threadsEventLoss;
+};
@@ -0,0 +1,165 @@
+#include <algorithm>
+
+#include "EventOrderer.h"
+
+
+EventOrderer::EventOrderer(uint32_t maxBufferedBytes)
+{
+    _maxBufferedBytes = maxBufferedBytes;
+    _runsCount = 0;
+    _bufferedEventsCount = 0;
+    _bufferedTimeSumUs = 0;
+    _firstPushTimeUs = 0;
+    ::QueryPerformanceFrequency(&_frequency);
+
+    _orderedEventsCount = 0;
+    _unsortedEventsCount = 0;
+    _flushCount = 0;
+    _forcedFlushCount = 0;
+    _peakBufferedBytes = 0;
+    _totalAddedLatencyUs = 0;
+    _maxAddedLatencyUs = 0;
+}
+
+uint64_t EventOrderer::GetTimeUs()
+{
+    LARGE_INTEGER now;
+    ::QueryPerformanceCounter(&now);
+
+    return (uint64_t)(now.QuadPart / _frequency.QuadPart * 1000000 + (now.QuadPart % _frequency.QuadPart) * 1000000 / _frequency.QuadPart);
+}
+
+uint8_t* EventOrderer::Push(const EventBlobHeader& header, EventCacheMetadata* pMetadata)
+{
+    // one run per capture thread
+    auto result = _runIndexes.try_emplace(header.CaptureThreadId, _runsCount);
+    if (result.second)
+    {
+        if (_runsCount == _runs.size())
+        {
+            _runs.emplace_back();
+        }
+        _runs[_runsCount].Next = 0;
+        _runsCount++;
+    }
+    ThreadRun& run = _runs[result.first->second];
+
+    uint64_t payloadOffset = _payloads.size();
+    run.Events.push_back({ header, pMetadata, payloadOffset });
+    _payloads.resize(payloadOffset + header.PayloadSize);
+
+    // the clock is read once per event: negligible compared to the payload copy
+    uint64_t now = GetTimeUs();
+    if (_bufferedEventsCount == 0)
+    {
+        _firstPushTimeUs = now;
+    }
+    _bufferedTimeSumUs += now;
+    _bufferedEventsCount++;
+
+    return _payloads.data() + payloadOffset;
+}
+
+void EventOrderer::OnUnsortedEvent()
+{
+    _unsortedEventsCount++;
+}
+
+// the heap is a min-heap on the timestamp
+bool EventOrderer::IsLater(const HeapEntry& left, const HeapEntry& right)
+{
+    return left.Timestamp > right.Timestamp;
+}
+
+void EventOrderer::BeginFlush(bool isForced)
+{
+    _flushCount++;
+    if (isForced)
+    {
+        _forcedFlushCount++;
+    }
+
+    uint64_t bufferedBytes = GetBufferedBytes();
+    if (bufferedBytes > _peakBufferedBytes)
+    {
+        _peakBufferedBytes = bufferedBytes;
+    }
+
+    _heap.clear();
+    for (uint32_t i = 0; i < _runsCount; i++)
+    {
+        ThreadRun& run = _runs[i];
+        if (!run.Events.empty())
+        {
+            _heap.push_back({ run.Events[0].Header.Timestamp, i });
+        }
+    }
+    std::make_heap(_heap.begin(), _heap.end(), IsLater);
+}
+
+bool EventOrderer::PopNext(EventBlobHeader*& pHeader, EventCacheMetadata*& pMetadata, const uint8_t*& pPayload)
+{
+    if (_heap.empty())
+        return false;
+
+    std::pop_heap(_heap.begin(), _heap.end(), IsLater);
+    HeapEntry& oldest = _heap.back();
+    ThreadRun& run = _runs[oldest.RunIndex];
+    BufferedEvent& event = run.Events[run.Next];
+    run.Next++;
+
+    pHeader = &event.Header;
+    pMetadata = event.pMetadata;
+    pPayload = _payloads.data() + event.PayloadOffset;
+
+    // the next event of the same thread replaces the delivered one
+    if (run.Next < run.Events.size())
+    {
+        oldest.Timestamp = run.Events[run.Next].Header.Timestamp;
+        std::push_heap(_heap.begin(), _heap.end(), IsLater);
+    }
+    else
+    {
+        _heap.pop_back();
+    }
+
+    return true;
+}
+
+void EventOrderer::EndFlush()
+{
+    if (_bufferedEventsCount > 0)
+    {
+        uint64_t now = GetTimeUs();
+        _totalAddedLatencyUs += now * _bufferedEventsCount - _bufferedTimeSumUs;
+        uint64_t maxLatency = now - _firstPushTimeUs;
+        if (maxLatency > _maxAddedLatencyUs)
+        {
+            _maxAddedLatencyUs = maxLatency;
+        }
+        _orderedEventsCount += _bufferedEventsCount;
+    }
+
+    // keep the allocated memory for the next events
+    for (uint32_t i = 0; i < _runsCount; i++)
+    {
+        _runs[i].Events.clear();
+    }
+    _runsCount = 0;
+    _runIndexes.clear();
+    _payloads.clear();
+    _heap.clear();
+    _bufferedEventsCount = 0;
+    _bufferedTimeSumUs = 0;
+}
+
+void EventOrderer::GetStatistics(OrderingStatistics& stats)
+{
+    stats.OrderedEventsCount = _orderedEventsCount;
+    stats.UnsortedEventsCount = _unsortedEventsCount;
+    stats.FlushCount = _flushCount;
+    stats.ForcedFlushCount = _forcedFlushCount;
+    stats.PeakBufferedBytes = _peakBufferedBytes;
+    stats.TotalAddedLatencyUs = _totalAddedLatencyUs;
+    stats.MaxAddedLatencyUs = _maxAddedLatencyUs;
+}
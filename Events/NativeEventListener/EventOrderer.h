@@ -0,0 +1,106 @@
+#pragma once
+#include <atomic>
+#include <unordered_map>
+#include <vector>
+#include <windows.h>
+#include <stdint.h>
+
+#include "NettraceFormat.h"
+
+
+class EventCacheMetadata;
+
+// the events are flushed before the buffered events (headers + payloads) reach that size
+const uint32_t DefaultMaxOrderedBytes = 32 * 1024 * 1024;
+
+
+// can be read from any thread while the session is running
+struct OrderingStatistics
+{
+    uint64_t OrderedEventsCount;
+    uint64_t UnsortedEventsCount;       // delivered immediately (not flagged as sorted by the runtime)
+    uint64_t FlushCount;
+    uint64_t ForcedFlushCount;          // before a sequence point because of the memory limit
+    uint64_t PeakBufferedBytes;
+    uint64_t TotalAddedLatencyUs;       // sum of the time spent by each event in the orderer
+    uint64_t MaxAddedLatencyUs;
+};
+
+
+// The events of an EventBlock are grouped by thread and each thread run is sorted by timestamp
+// but the runs of different threads are interleaved. The events are buffered until the next
+// sequence point (or until the memory limit is reached) and then delivered in timestamp order
+// with a k-way merge of the per thread runs (a heap of the first event of each run).
+// look at EventPipeEventSource/EventCache implementation in TraceEvent
+class EventOrderer
+{
+public:
+    EventOrderer(uint32_t maxBufferedBytes = DefaultMaxOrderedBytes);
+
+    // return where to copy the payload of the event (valid until the next call)
+    uint8_t* Push(const EventBlobHeader& header, EventCacheMetadata* pMetadata);
+    void OnUnsortedEvent();
+
+    // too many bytes are buffered: a flush is needed before the next sequence point
+    bool IsFull() const { return GetBufferedBytes() >= _maxBufferedBytes; }
+    bool IsEmpty() const { return _bufferedEventsCount == 0; }
+
+    // deliver the buffered events in timestamp order:
+    //    BeginFlush(); while (PopNext(...)) {...} EndFlush();
+    void BeginFlush(bool isForced);
+    bool PopNext(EventBlobHeader*& pHeader, EventCacheMetadata*& pMetadata, const uint8_t*& pPayload);
+    void EndFlush();
+
+    void GetStatistics(OrderingStatistics& stats);
+
+private:
+    struct BufferedEvent
+    {
+        EventBlobHeader Header;
+        EventCacheMetadata* pMetadata;
+        uint64_t PayloadOffset;
+    };
+
+    // events of one thread in stream order
+    struct ThreadRun
+    {
+        std::vector<BufferedEvent> Events;
+        size_t Next;
+    };
+
+    // next event of each run (the heap top is the oldest)
+    struct HeapEntry
+    {
+        uint64_t Timestamp;
+        uint32_t RunIndex;
+    };
+
+    static bool IsLater(const HeapEntry& left, const HeapEntry& right);
+    uint64_t GetBufferedBytes() const { return _payloads.size() + _bufferedEventsCount * sizeof(BufferedEvent); }
+    uint64_t GetTimeUs();
+
+private:
+    uint32_t _maxBufferedBytes;
+
+    //                 capture thread id -> index in _runs
+    std::unordered_map<uint64_t, uint32_t> _runIndexes;
+    std::vector<ThreadRun> _runs;           // kept (with their capacity) between flushes
+    uint32_t _runsCount;
+    std::vector<uint8_t> _payloads;
+    std::vector<HeapEntry> _heap;
+    uint64_t _bufferedEventsCount;
+
+    // the added latency of an event is the time between the parsing of its block and its delivery
+    uint64_t _bufferedTimeSumUs;            // sum of the push time of the buffered events
+    uint64_t _firstPushTimeUs;
+    LARGE_INTEGER _frequency;
+
+    // statistics
+    std::atomic<uint64_t> _orderedEventsCount;
+    std::atomic<uint64_t> _unsortedEventsCount;
+    std::atomic<uint64_t> _flushCount;
+    std::atomic<uint64_t> _forcedFlushCount;
+    std::atomic<uint64_t> _peakBufferedBytes;
+    std::atomic<uint64_t> _totalAddedLatencyUs;
+    std::atomic<uint64_t> _maxAddedLatencyUs;
+};
@@ -3,12 +3,79 @@
 
 #include "DiagnosticsProtocol.h"
 #include "BlockParser.h"
+#include "Log.h"
 
 
-EventParser::EventParser(std::unordered_map<uint32_t, EventCacheMetadata>& metadata)
+// the events without subscriber are decoded only if their fields are logged
+const bool AreEventsLogged = (LOG_LEVEL >= LOG_LEVEL_INFO);
+
+EventParser::EventParser(MetadataTable& metadata, EventLossTracker& lossTracker, SessionStatistics& statistics)
     :
-    EventParserBase(metadata)
+    EventParserBase(metadata),
+    _lossTracker(lossTracker),
+    _statistics(statistics)
 {
+    _pOrderer = nullptr;
+    _pBackpressurePolicy = nullptr;
+    _pGenericHandler = nullptr;
+    _subscribedEvents = 0;
+
+    // will be set later when the pointer size is known
+    SetPointerSize(sizeof(uint64_t));
+}
+
+void EventParserBase::SetPointerSize(uint8_t pointerSize)
+{
+    BlockParser::SetPointerSize(pointerSize);
+
+    // the decoders are specialized once for the bitness of the process instead of checking it for each field
+    if (pointerSize == sizeof(uint64_t))
+    {
+        _pfnOnAllocationTick = &EventParserBase::DecodeAllocationTick<uint64_t>;
+    }
+    else
+    {
+        _pfnOnAllocationTick = &EventParserBase::DecodeAllocationTick<uint32_t>;
+    }
+}
+
+void EventParser::SetPointerSize(uint8_t pointerSize)
+{
+    EventParserBase::SetPointerSize(pointerSize);
+
+    if (pointerSize == sizeof(uint64_t))
+    {
+        _pfnAddLiveObjects = &EventParser::AddLiveObjects<uint64_t>;
+        _pfnReadBulkNodesChecked = &EventParser::ReadBulkNodesChecked<uint64_t>;
+        _pfnAddEdges = &EventParser::AddEdges<uint64_t>;
+    }
+    else
+    {
+        _pfnAddLiveObjects = &EventParser::AddLiveObjects<uint32_t>;
+        _pfnReadBulkNodesChecked = &EventParser::ReadBulkNodesChecked<uint32_t>;
+        _pfnAddEdges = &EventParser::AddEdges<uint32_t>;
+    }
+
+    // Address (pointer) + Size + TypeID + EdgeCount
+    _bulkNodeSize = pointerSize + 3 * sizeof(uint64_t);
+
+    // Value (pointer) + ReferencingFieldID
+    _bulkEdgeSize = pointerSize + sizeof(uint32_t);
+}
+
+void EventParser::SetOrderer(EventOrderer* pOrderer)
+{
+    _pOrderer = pOrderer;
+}
+
+void EventParser::SetBackpressurePolicy(BackpressurePolicy* pPolicy)
+{
+    _pBackpressurePolicy = pPolicy;
+}
+
+void EventParser::SetGenericEventHandler(IGenericEventHandler* pHandler)
+{
+    _pGenericHandler = pHandler;
 }
 
 
@@ -34,95 +101,365 @@ bool EventParser::OnParseBlob(EventBlobHeader& header, bool isCompressed, DWORD&
     // TODO: uncomment to show blob header
     //DumpBlobHeader(header);
 
-    auto& metadataDef = _metadata[header.MetadataId];
-    if (metadataDef.MetadataId == 0)
+    _lossTracker.OnEvent(header.CaptureThreadId, header.SequenceNumber, header.Timestamp);
+
+    EventCacheMetadata* pMetadataDef = _metadata.Find(header.MetadataId);
+    if (pMetadataDef == nullptr)
     {
         // this should never occur: no definition was previously received
+        LOG_ERROR("Event blob without metadata #" << header.MetadataId << "\n");
+        if (!SkipBytes(header.PayloadSize))
+            return false;
 
-        uint8_t* pBuffer = new uint8_t[header.PayloadSize];
-        if (!Read(pBuffer, header.PayloadSize))
+        blobSize += header.PayloadSize;
+        return true;
+    }
+
+    // delivered later in timestamp order
+    if (_pOrderer != nullptr)
+    {
+        if (!BufferEvent(header, *pMetadataDef))
+            return false;
+
+        blobSize += header.PayloadSize;
+        return true;
+    }
+
+    if (!OnEvent(header, *pMetadataDef))
+        return false;
+
+    blobSize += header.PayloadSize;
+
+    return true;
+}
+
+bool EventParser::Dispatch(const uint8_t* pBlock, uint32_t bytesCount, uint64_t blockOriginInFile, std::vector<EventRecord>& records)
+{
+    SetBlock(pBlock, bytesCount, blockOriginInFile);
+
+    for (auto& record : records)
+    {
+        _lossTracker.OnEvent(record.Header.CaptureThreadId, record.Header.SequenceNumber, record.Header.Timestamp);
+
+        if (record.pMetadata == nullptr)
         {
-            std::cout << "Error while reading EventBlob payload: 0x" << std::hex << Error << std::dec << "\n";
+            // this should never occur: no definition was previously received
+            LOG_ERROR("Event blob\n");
+            continue;
+        }
+
+        _pos = record.PayloadOffset;
+        if (_pOrderer != nullptr)
+        {
+            if (!BufferEvent(record.Header, *record.pMetadata))
+                return false;
 
-            delete[] pBuffer;
+            continue;
+        }
+
+        if (!OnEvent(record.Header, *record.pMetadata, record.IsPayloadDecoded ? &record.Event : nullptr))
             return false;
+    }
+
+    return true;
+}
+
+uint32_t EventParser::GetPredecodedEvents()
+{
+    // the workers must not log and the buffered payloads are decoded when the events are flushed
+    if (AreEventsLogged || (_pOrderer != nullptr))
+        return 0;
+
+    return _subscribedEvents;
+}
+
+// the position must be at the beginning of the payload
+bool EventParser::BufferEvent(EventBlobHeader& header, EventCacheMetadata& metadataDef)
+{
+    // no order is guaranteed for these events so there is no need to wait
+    if (!header.IsSorted)
+    {
+        _pOrderer->OnUnsortedEvent();
+        return OnEvent(header, metadataDef);
+    }
+
+    uint8_t* pPayload = _pOrderer->Push(header, &metadataDef);
+    if (!Read(pPayload, header.PayloadSize))
+    {
+        LOG_ERROR("Error while buffering EventBlob payload (" << header.PayloadSize << " bytes)\n");
+        return false;
+    }
+
+    return true;
+}
+
+// Note: must not be called while a block is being parsed
+bool EventParser::FlushOrderedEvents(bool isForced)
+{
+    if ((_pOrderer == nullptr) || _pOrderer->IsEmpty())
+        return true;
+
+    bool success = true;
+    EventBlobHeader* pHeader = nullptr;
+    EventCacheMetadata* pMetadata = nullptr;
+    const uint8_t* pPayload = nullptr;
+
+    _pOrderer->BeginFlush(isForced);
+    while (_pOrderer->PopNext(pHeader, pMetadata, pPayload))
+    {
+        // each payload is read as a block of its own
+        SetBlock(pPayload, pHeader->PayloadSize, 0);
+        if (!OnEvent(*pHeader, *pMetadata))
+        {
+            success = false;
+            break;
         }
+    }
+    _pOrderer->EndFlush();
+
+    return success;
+}
 
-        std::cout << "Event blob\n";
-        //DumpBuffer(pBuffer, header.PayloadSize);
-        delete[] pBuffer;
+// only the events of the CLR provider are handled and their older versions
+// do not contain all the fields read by the handlers
+const std::wstring DotnetRuntimeProvider = L"Microsoft-Windows-DotNETRuntime";
+
+uint32_t GetMinHandledVersion(uint32_t eventId)
+{
+    switch (eventId)
+    {
+        case EventIDs::AllocationTick:  return 2;   // Amount64, TypeId, TypeName, HeapIndex
+        case EventIDs::ContentionStop:  return 1;   // DurationNs
+        case EventIDs::GCStart:         return 1;   // Depth, Reason, Type, ClrInstanceID
+        case EventIDs::GCEnd:           return 1;   // ClrInstanceID
+
+        default:
+            return 0;
     }
+}
+
+EventHandlerId EventParser::GetHandlerId(const EventCacheMetadata& metadataDef)
+{
+    if (metadataDef.ProviderName != DotnetRuntimeProvider)
+        return EventHandlerId::None;
+
+    if (metadataDef.Version < GetMinHandledVersion(metadataDef.EventId))
+        return EventHandlerId::None;
 
     switch (metadataDef.EventId)
     {
-        case EventIDs::AllocationTick:
-            if (!OnAllocationTick(header.PayloadSize, metadataDef))
+        case EventIDs::AllocationTick:  return EventHandlerId::AllocationTick;
+        case EventIDs::ContentionStop:  return EventHandlerId::ContentionStop;
+        case EventIDs::ExceptionThrown: return EventHandlerId::ExceptionThrown;
+        case EventIDs::GCStart:         return EventHandlerId::GcStart;
+        case EventIDs::GCEnd:           return EventHandlerId::GcEnd;
+        case EventIDs::BulkType:        return EventHandlerId::BulkType;
+        case EventIDs::GCBulkNode:      return EventHandlerId::BulkNode;
+        case EventIDs::GCBulkEdge:      return EventHandlerId::BulkEdge;
+
+        default:
+            return EventHandlerId::None;
+    }
+}
+
+// the position must be at the beginning of the payload
+bool EventParser::OnEvent(EventBlobHeader& header, EventCacheMetadata& metadataDef, const ListenedEvent* pDecoded)
+{
+    TRACE_STEP(TraceId::EventDispatched, metadataDef.EventId, header.PayloadSize);
+    _statistics.OnEvent(metadataDef.EventId, metadataDef.ProviderIndex, metadataDef.EventIdIndex, metadataDef.ProviderName);
+
+    // nothing to decode for the events without handler
+    if (metadataDef.IsSkipped && (_pGenericHandler == nullptr))
+    {
+        return SkipBytes(header.PayloadSize);
+    }
+
+    // only the handled events are timed
+    EventHandlerId handlerId = metadataDef.HandlerId;
+    uint64_t startTicks = (handlerId != EventHandlerId::None) ? SessionStatistics::GetTicks() : 0;
+
+    // only counted while the parser is lagging behind
+    if ((_pBackpressurePolicy != nullptr) && _pBackpressurePolicy->ShouldSkip(metadataDef.EventId, metadataDef.PriorityIndex, metadataDef.ProviderName, header.PayloadSize))
+    {
+        return SkipBytes(header.PayloadSize);
+    }
+
+    // the listener gets the decoded events it subscribed to
+    if ((_subscribedEvents & SubscribeTo(handlerId)) != 0)
+    {
+        if (!OnListenedEvent(handlerId, header, metadataDef, pDecoded))
+        {
+            return false;
+        }
+    }
+    else
+    switch (handlerId)
+    {
+        // without subscriber, these events are only decoded to be logged
+        case EventHandlerId::AllocationTick:
+        {
+            AllocationTickEvent event;
+            if (!AreEventsLogged)
+            {
+                if (!SkipBytes(header.PayloadSize))
+                    return false;
+            }
+            else
+            if (!OnAllocationTick(header.PayloadSize, metadataDef, event))
             {
                 return false;
             }
             break;
+        }
 
         // TODO: check in which version of the CLR, the ContentionStop_V1 is available
         //       before that, it is needed to compute, per thread, the difference between Start and Stop
-        case EventIDs::ContentionStop:
-            if (!OnContentionStop(header.ThreadId, header.PayloadSize, metadataDef))
+        case EventHandlerId::ContentionStop:
+        {
+            ContentionStopEvent event;
+            if (!AreEventsLogged)
+            {
+                if (!SkipBytes(header.PayloadSize))
+                    return false;
+            }
+            else
+            if (!OnContentionStop(header.ThreadId, header.PayloadSize, metadataDef, event))
             {
                 return false;
             }
             break;
+        }
 
-        case EventIDs::ExceptionThrown:
-            if (!OnExceptionThrown(header.PayloadSize, metadataDef))
+        case EventHandlerId::ExceptionThrown:
+        {
+            ExceptionThrownEvent event;
+            if (!AreEventsLogged)
+            {
+                if (!SkipBytes(header.PayloadSize))
+                    return false;
+            }
+            else
+            if (!OnExceptionThrown(header.PayloadSize, metadataDef, event))
             {
                 return false;
             }
             break;
+        }
 
 
         // events related to .gcdump generation
-        case EventIDs::GCStart:
-            if (!OnGcStart(header.PayloadSize, metadataDef))
+        case EventHandlerId::GcStart:
+        {
+            GcStartEvent event;
+            if (!OnGcStart(header.PayloadSize, metadataDef, event))
             {
                 return false;
             }
             break;
+        }
 
-        case EventIDs::GCEnd:
-            if (!OnGcEnd(header.PayloadSize, metadataDef))
+        case EventHandlerId::GcEnd:
+        {
+            GcEndEvent event;
+            if (!OnGcEnd(header.PayloadSize, metadataDef, event))
             {
                 return false;
             }
             break;
+        }
 
-        case EventIDs::BulkType:
+        case EventHandlerId::BulkType:
             if (!OnBulkType(header.PayloadSize, metadataDef))
             {
                 return false;
             }
             break;
 
-        case EventIDs::GCBulkNode:
+        case EventHandlerId::BulkNode:
             if (!OnBulkNode(header.PayloadSize, metadataDef))
             {
                 return false;
             }
             break;
 
-        case EventIDs::GCBulkEdge:
+        case EventHandlerId::BulkEdge:
             if (!OnBulkEdge(header.PayloadSize, metadataDef))
             {
                 return false;
             }
             break;
 
-        default:  // skip events we are not interested in
+        default:  // skip events we are not interested in (i.e. metadataDef.IsSkipped)
         {
-            std::cout << "Event = " << metadataDef.EventId << "\n";
-            SkipBytes(header.PayloadSize);
+            LOG_VERBOSE("Event = " << metadataDef.EventId << "\n");
+            if ((_pGenericHandler != nullptr) && metadataDef.Plan.IsValid())
+            {
+                if (!OnGenericEvent(header.PayloadSize, metadataDef))
+                {
+                    return false;
+                }
+            }
+            else
+            {
+                SkipBytes(header.PayloadSize);
+            }
         }
     }
 
-    blobSize += header.PayloadSize;
+    if (handlerId != EventHandlerId::None)
+    {
+        _statistics.OnHandlerCalled(handlerId, SessionStatistics::GetTicks() - startTicks);
+    }
+
+    return true;
+}
+
+
+// the gcdump state is updated before the listener gets the event
+bool EventParser::OnListenedEvent(EventHandlerId handlerId, EventBlobHeader& header, EventCacheMetadata& metadataDef, const ListenedEvent* pDecoded)
+{
+    ListenedEvent event;
+    if (pDecoded == nullptr)
+    {
+        if (!DecodeListenedEvent(handlerId, header, metadataDef, event))
+            return false;
+        pDecoded = &event;
+    }
+
+    if (handlerId == EventHandlerId::GcStart)
+    {
+        _gcDump.OnGcStart(pDecoded->GcStart.Count, pDecoded->GcStart.Depth, pDecoded->GcStart.Reason, pDecoded->GcStart.Type);
+    }
+    else
+    if (handlerId == EventHandlerId::GcEnd)
+    {
+        _gcDump.OnGcEnd(pDecoded->GcEnd.Count, pDecoded->GcEnd.Depth);
+    }
+
+    EventContext context = { header.ThreadId, header.Timestamp, header.ProcessorNumber, metadataDef.MetadataId, metadataDef.Version };
+    NotifyListener(handlerId, context, *pDecoded);
+
+    return true;
+}
+
+// the fields are found with the decode plan built from the metadata field descriptors
+bool EventParser::OnGenericEvent(DWORD payloadSize, EventCacheMetadata& metadataDef)
+{
+    const uint8_t* pPayload;
+    if (!TryGetRange(payloadSize, pPayload))
+    {
+        // to get the error
+        return SkipBytes(payloadSize);
+    }
+
+    if (!metadataDef.Plan.Decode(pPayload, payloadSize, _decodedPayload))
+    {
+        LOG_VERBOSE("Payload does not match the fields of metadata #" << metadataDef.MetadataId << "\n");
+        return true;
+    }
+
+    LOG_VERBOSE_DUMP(_decodedPayload.Dump());
+    _pGenericHandler->OnGenericEvent(metadataDef.MetadataId, metadataDef.EventId, metadataDef.ProviderName, _decodedPayload);
 
     return true;
 }
@@ -136,74 +473,88 @@ bool EventParser::OnParseBlob(EventBlobHeader& header, bool isCompressed, DWORD&
 //  ClrInstanceID           UInt16  Unique ID for the instance of CLR or CoreCLR.
 //  ClientSequenceNumber    UInt64  ?
 //
-bool EventParser::OnGcStart(DWORD payloadSize, EventCacheMetadata& metadataDef)
+bool EventParser::OnGcStart(DWORD payloadSize, EventCacheMetadata& metadataDef, GcStartEvent& event)
+{
+    if (!DecodeGcStart(payloadSize, metadataDef, event))
+        return false;
+
+    _gcDump.OnGcStart(event.Count, event.Depth, event.Reason, event.Type);
+    return true;
+}
+
+bool EventParserBase::DecodeGcStart(DWORD payloadSize, EventCacheMetadata& metadataDef, GcStartEvent& event)
 {
     DWORD readBytesCount = 0;
     DWORD size = 0;
-    std::cout << "\nGC Start:\n";
+    LOG_INFO("\nGC Start:\n");
 
 
     uint32_t index = 0;
     if (!ReadDWord(index))
     {
-        std::cout << "Error while reading count\n";
+        LOG_ERROR("Error while reading count\n");
         return false;
     }
     readBytesCount += sizeof(index);
-    std::cout << "   Count         = #" << index << "\n";
+    LOG_INFO("   Count         = #" << index << "\n");
 
     uint32_t generation;
     if (!ReadDWord(generation))
     {
-        std::cout << "Error while reading depth\n";
+        LOG_ERROR("Error while reading depth\n");
         return false;
     }
     readBytesCount += sizeof(generation);
-    std::cout << "   Depth         = " << generation << "\n";
+    LOG_INFO("   Depth         = " << generation << "\n");
 
     GCReason reason;
     uint32_t dword = 0;
     if (!ReadDWord(dword))
     {
-        std::cout << "Error while reading reason\n";
+        LOG_ERROR("Error while reading reason\n");
         return false;
     }
     readBytesCount += sizeof(dword);
-    std::cout << "   Reason        = " << dword << "\n";
+    LOG_INFO("   Reason        = " << dword << "\n");
     reason = (GCReason)dword;
 
     GCType type;
     if (!ReadDWord(dword))
     {
-        std::cout << "Error while reading type\n";
+        LOG_ERROR("Error while reading type\n");
         return false;
     }
     readBytesCount += sizeof(dword);
-    std::cout << "   Type          = " << dword << "\n";
+    LOG_INFO("   Type          = " << dword << "\n");
     type = (GCType)dword;
 
     uint16_t word = 0;
     if (!ReadWord(word))
     {
-        std::cout << "Error while reading CLR instance ID\n";
+        LOG_ERROR("Error while reading CLR instance ID\n");
         return false;
     }
     readBytesCount += sizeof(word);
-    std::cout << "   CLR ID        = " << word << "\n";
+    LOG_INFO("   CLR ID        = " << word << "\n");
 
+    uint64_t ulong = 0;
     if (metadataDef.Version >= 2)
     {
-        uint64_t ulong = 0;
         if (!ReadLong(ulong))
         {
-            std::cout << "Error while reading client sequence number\n";
+            LOG_ERROR("Error while reading client sequence number\n");
             return false;
         }
         readBytesCount += sizeof(ulong);
-        std::cout << "   client sequence " << ulong << "\n";
+        LOG_INFO("   client sequence " << ulong << "\n");
     }
 
-    _gcDump.OnGcStart(index, generation, reason, type);
+    event.Count = index;
+    event.Depth = generation;
+    event.Reason = reason;
+    event.Type = type;
+    event.ClrInstanceId = word;
+    event.ClientSequenceNumber = ulong;
 
     // skip the rest of the payload
     return SkipBytes(payloadSize - readBytesCount);
@@ -214,40 +565,51 @@ bool EventParser::OnGcStart(DWORD payloadSize, EventCacheMetadata& metadataDef)
 // Depth            UInt32  collected generation
 // ClrInstanceID    UInt16  Unique ID for the instance of CLR or CoreCLR.
 //
-bool EventParser::OnGcEnd(DWORD payloadSize, EventCacheMetadata& metadataDef)
+bool EventParser::OnGcEnd(DWORD payloadSize, EventCacheMetadata& metadataDef, GcEndEvent& event)
+{
+    if (!DecodeGcEnd(payloadSize, metadataDef, event))
+        return false;
+
+    _gcDump.OnGcEnd(event.Count, event.Depth);
+    return true;
+}
+
+bool EventParserBase::DecodeGcEnd(DWORD payloadSize, EventCacheMetadata& metadataDef, GcEndEvent& event)
 {
     DWORD readBytesCount = 0;
     DWORD size = 0;
-    std::cout << "\nGC End:\n";
+    LOG_INFO("\nGC End:\n");
 
     uint32_t index = 0;
     if (!ReadDWord(index))
     {
-        std::cout << "Error while reading count\n";
+        LOG_ERROR("Error while reading count\n");
         return false;
     }
     readBytesCount += sizeof(index);
-    std::cout << "   Count         = #" << index << "\n";
+    LOG_INFO("   Count         = #" << index << "\n");
 
     uint32_t generation;
     if (!ReadDWord(generation))
     {
-        std::cout << "Error while reading depth\n";
+        LOG_ERROR("Error while reading depth\n");
         return false;
     }
     readBytesCount += sizeof(generation);
-    std::cout << "   Depth         = " << generation << "\n";
+    LOG_INFO("   Depth         = " << generation << "\n");
 
     uint16_t word = 0;
     if (!ReadWord(word))
     {
-        std::cout << "Error while reading CLR instance ID\n";
+        LOG_ERROR("Error while reading CLR instance ID\n");
         return false;
     }
     readBytesCount += sizeof(word);
-    std::cout << "   CLR ID        = " << word << "\n";
+    LOG_INFO("   CLR ID        = " << word << "\n");
 
-    _gcDump.OnGcEnd(index, generation);
+    event.Count = index;
+    event.Depth = generation;
+    event.ClrInstanceId = word;
 
     // skip the rest of the payload
     return SkipBytes(payloadSize - readBytesCount);
@@ -270,25 +632,25 @@ bool EventParser::OnBulkType(DWORD payloadSize, EventCacheMetadata& metadataDef)
 {
     DWORD readBytesCount = 0;
     DWORD size = 0;
-    std::cout << "\nBulk Type:\n";
+    LOG_INFO("\nBulk Type:\n");
 
     uint32_t dword = 0;
     if (!ReadDWord(dword))
     {
-        std::cout << "Error while reading count\n";
+        LOG_ERROR("Error while reading count\n");
         return false;
     }
     readBytesCount += sizeof(dword);
-    std::cout << "   Count         = " << dword << "\n";
+    LOG_INFO("   Count         = " << dword << "\n");
 
     uint16_t word = 0;
     if (!ReadWord(word))
     {
-        std::cout << "Error while reading CLR instance ID\n";
+        LOG_ERROR("Error while reading CLR instance ID\n");
         return false;
     }
     readBytesCount += sizeof(word);
-    std::cout << "   CLR ID        = " << word << "\n";
+    LOG_INFO("   CLR ID        = " << word << "\n");
 
     uint32_t count = dword;
     for (size_t i = 0; i < count; i++)
@@ -301,71 +663,70 @@ bool EventParser::OnBulkType(DWORD payloadSize, EventCacheMetadata& metadataDef)
         uint64_t ulong = 0;
         if (!ReadLong(ulong))
         {
-            std::cout << "Error while reading type ID\n";
+            LOG_ERROR("Error while reading type ID\n");
             return false;
         }
         readBytesCount += sizeof(ulong);
-        std::cout << "      TypeID    = 0x" << std::hex << ulong << std::dec << "\n";
+        LOG_VERBOSE("      TypeID    = 0x" << std::hex << ulong << std::dec << "\n");
         id = ulong;
 
         if (!ReadLong(ulong))
         {
-            std::cout << "Error while reading module ID\n";
+            LOG_ERROR("Error while reading module ID\n");
             return false;
         }
         readBytesCount += sizeof(ulong);
-        std::cout << "      ModuleID  = 0x" << std::hex << ulong << std::dec << "\n";
+        LOG_VERBOSE("      ModuleID  = 0x" << std::hex << ulong << std::dec << "\n");
 
         uint32_t dword;
         if (!ReadDWord(dword))
         {
-            std::cout << "Error while reading type name ID\n";
+            LOG_ERROR("Error while reading type name ID\n");
             return false;
         }
         readBytesCount += sizeof(dword);
-        std::cout << "      Name ID   = 0x" << std::hex << dword << std::dec << "\n";
+        LOG_VERBOSE("      Name ID   = 0x" << std::hex << dword << std::dec << "\n");
         nameId = dword;
 
         if (!ReadDWord(dword))
         {
-            std::cout << "Error while reading flags\n";
+            LOG_ERROR("Error while reading flags\n");
             return false;
         }
         readBytesCount += sizeof(dword);
-        std::cout << "      Flags     = 0x" << std::hex << dword << std::dec << "\n";
+        LOG_VERBOSE("      Flags     = 0x" << std::hex << dword << std::dec << "\n");
         isArray = ((dword & 0x8) == 0x8);
 
         uint8_t byte;
         if (!ReadByte(byte))
         {
-            std::cout << "Error while reading Cor element type\n";
+            LOG_ERROR("Error while reading Cor element type\n");
             return false;
         }
         readBytesCount += sizeof(byte);
-        std::cout << "      Element   = 0x" << std::hex << dword << std::dec << "\n";
+        LOG_VERBOSE("      Element   = 0x" << std::hex << dword << std::dec << "\n");
         isArray = ((dword & 0x8) == 0x8);
 
-        std::wstring strBuffer;
-        strBuffer.reserve(256);
-        if (!ReadWString(strBuffer, size))
+        WStringView typeName;
+        if (!ReadWStringView(typeName, size))
         {
-            std::cout << "Error while reading type name\n";
+            LOG_ERROR("Error while reading type name\n");
             return false;
         }
         readBytesCount += size;
-        if (strBuffer.empty())
-            std::wcout << L"      Type      = ''\n";
+        if (typeName.IsEmpty())
+            LOG_VERBOSE_W(L"      Type      = ''\n");
         else
-            std::wcout << L"      Type      = " << strBuffer.c_str() << L"\n";
-        std::string name = ToString(strBuffer.c_str());
+            LOG_VERBOSE_W(L"      Type      = " << typeName << L"\n");
+        std::string name = typeName.ToString();
 
         if (!ReadDWord(dword))
         {
-            std::cout << "Error while reading generics count\n";
+            LOG_ERROR("Error while reading generics count\n");
             return false;
         }
         readBytesCount += sizeof(dword);
-        std::cout << "      #generics = " << dword << "\n";
+        LOG_VERBOSE("      #generics = " << dword << "\n");
         isGeneric = (dword > 0);
 
         // skip generics parameters if any
@@ -373,13 +734,13 @@ bool EventParser::OnBulkType(DWORD payloadSize, EventCacheMetadata& metadataDef)
         {
             if (!ReadLong(ulong))
             {
-                std::cout << "Error while reading generic parameter\n";
+                LOG_ERROR("Error while reading generic parameter\n");
                 return false;
             }
             readBytesCount += sizeof(ulong);
         }
         _gcDump.OnTypeMapping(id, nameId, name);
-        std::cout << "\n";
+        LOG_VERBOSE("\n");
     }
 
     // skip the rest of the payload
@@ -397,72 +758,106 @@ bool EventParser::OnBulkType(DWORD payloadSize, EventCacheMetadata& metadataDef)
 //  EdgeCount UInt64
 //
 bool EventParser::OnBulkNode(DWORD payloadSize, EventCacheMetadata& metadataDef)
+{
+    return ParseBulkNode(payloadSize, false);
+}
+
+bool EventParser::DecodeBulkNode(const uint8_t* pPayload, uint32_t payloadSize, bool isCheckedPerField)
+{
+    SetBlock(pPayload, payloadSize, 0);
+
+    return ParseBulkNode(payloadSize, isCheckedPerField);
+}
+
+bool EventParser::ParseBulkNode(DWORD payloadSize, bool isCheckedPerField)
 {
     DWORD readBytesCount = 0;
-    DWORD size = 0;
-    std::cout << "\nBulk Node:\n";
+    LOG_INFO("\nBulk Node:\n");
 
     uint32_t dword = 0;
     if (!ReadDWord(dword))
     {
-        std::cout << "Error while reading Index\n";
+        LOG_ERROR("Error while reading Index\n");
         return false;
     }
     readBytesCount += sizeof(dword);
-    std::cout << "   Index         = " << dword << "\n";
+    LOG_INFO("   Index         = " << dword << "\n");
 
     if (!ReadDWord(dword))
     {
-        std::cout << "Error while reading count\n";
+        LOG_ERROR("Error while reading count\n");
         return false;
     }
     readBytesCount += sizeof(dword);
-    std::cout << "   Count         = " << dword << "\n";
+    LOG_INFO("   Count         = " << dword << "\n");
 
     uint16_t word = 0;
     if (!ReadWord(word))
     {
-        std::cout << "Error while reading CLR instance ID\n";
+        LOG_ERROR("Error while reading CLR instance ID\n");
         return false;
     }
     readBytesCount += sizeof(word);
-    std::cout << "   CLR ID        = " << word << "\n";
+    LOG_INFO("   CLR ID        = " << word << "\n");
 
     uint32_t count = dword;
+
+    // the nodes must fit in the payload of this event and not only in the block:
+    // a larger count means a malformed event that is rejected without adding any node
+    // Note: the count comes from the stream so the size is computed on 64 bit to avoid overflow
+    uint64_t nodesSize = (uint64_t)count * _bulkNodeSize;
+    if ((readBytesCount > payloadSize) || (nodesSize > payloadSize - readBytesCount))
+    {
+        LOG_ERROR("BulkNode count (" << count << ") does not fit in the payload (" << payloadSize << " bytes)\n");
+        return (readBytesCount <= payloadSize) && SkipBytes(payloadSize - readBytesCount);
+    }
+
+    // the whole array is checked once and the nodes are then read without any check
+    const uint8_t* pNodes = nullptr;
+    if (isCheckedPerField || !TryGetRange(nodesSize, pNodes))
+    {
+        // malformed stream: read one field after the other to report which one is missing
+        if (!(this->*_pfnReadBulkNodesChecked)(count, readBytesCount))
+            return false;
+
+        return SkipBytes(payloadSize - readBytesCount);
+    }
+    readBytesCount += (DWORD)nodesSize;
+
+    (this->*_pfnAddLiveObjects)(pNodes, count);
+
+    return SkipBytes(payloadSize - readBytesCount);
+}
+
+template <class TPointer>
+void EventParser::AddLiveObjects(const uint8_t* pNodes, uint32_t count)
+{
+    // decode all the nodes in columns and add them at once
+    _nodeBatch.Decode<TPointer>(pNodes, count);
+    _gcDump.AddLiveObjects(_nodeBatch);
+}
+
+template <class TPointer>
+bool EventParser::ReadBulkNodesChecked(uint32_t count, DWORD& readBytesCount)
+{
     for (size_t i = 0; i < count; i++)
     {
         uint64_t address = 0;
         uint64_t size = 0;
         uint64_t typeId = 0;
-        uint64_t edgeCount = 0;
 
         uint64_t ulong = 0;
-        if (_is64Bit)
-        {
-            if (!ReadLong(ulong))
-            {
-                std::cout << "Error while reading address\n";
-                return false;
-            }
-            readBytesCount += sizeof(ulong);
-            //std::cout << "      Address    = 0x" << std::hex << ulong << std::dec << "\n";
-            address = ulong;
-        }
-        else
+        if (!ReadPointer<TPointer>(address))
         {
-            if (!ReadDWord(dword))
-            {
-                std::cout << "Error while reading address\n";
-                return false;
-            }
-            readBytesCount += sizeof(dword);
-            //std::cout << "      Address    = 0x" << std::hex << dword << std::dec << "\n";
-            address = dword;
+            LOG_ERROR("Error while reading address\n");
+            return false;
         }
+        readBytesCount += sizeof(TPointer);
+        //std::cout << "      Address    = 0x" << std::hex << address << std::dec << "\n";
 
         if (!ReadLong(ulong))
         {
-            std::cout << "Error while reading size\n";
+            LOG_ERROR("Error while reading size\n");
             return false;
         }
         readBytesCount += sizeof(ulong);
@@ -471,7 +866,7 @@ bool EventParser::OnBulkNode(DWORD payloadSize, EventCacheMetadata& metadataDef)
 
         if (!ReadLong(ulong))
         {
-            std::cout << "Error while reading type id\n";
+            LOG_ERROR("Error while reading type id\n");
             return false;
         }
         readBytesCount += sizeof(ulong);
@@ -480,18 +875,18 @@ bool EventParser::OnBulkNode(DWORD payloadSize, EventCacheMetadata& metadataDef)
 
         if (!ReadLong(ulong))
         {
-            std::cout << "Error while reading edge count\n";
+            LOG_ERROR("Error while reading edge count\n");
             return false;
         }
         readBytesCount += sizeof(ulong);
         //std::cout << "      Edges      = " << ulong << "\n";
 
-        _gcDump.AddLiveObject(address, typeId, size);
+        _gcDump.AddLiveObject(address, typeId, size, ulong);
 
         //std::cout << "\n";
     }
 
-    return SkipBytes(payloadSize - readBytesCount);
+    return true;
 }
 
 //
@@ -504,10 +899,93 @@ bool EventParser::OnBulkNode(DWORD payloadSize, EventCacheMetadata& metadataDef)
 //
 bool EventParser::OnBulkEdge(DWORD payloadSize, EventCacheMetadata& metadataDef)
 {
-    return SkipBytes(payloadSize);
+    DWORD readBytesCount = 0;
+    LOG_INFO("\nBulk Edge:\n");
+
+    uint32_t dword = 0;
+    if (!ReadDWord(dword))
+    {
+        LOG_ERROR("Error while reading Index\n");
+        return false;
+    }
+    readBytesCount += sizeof(dword);
+    LOG_INFO("   Index         = " << dword << "\n");
+
+    if (!ReadDWord(dword))
+    {
+        LOG_ERROR("Error while reading count\n");
+        return false;
+    }
+    readBytesCount += sizeof(dword);
+    LOG_INFO("   Count         = " << dword << "\n");
+
+    uint16_t word = 0;
+    if (!ReadWord(word))
+    {
+        LOG_ERROR("Error while reading CLR instance ID\n");
+        return false;
+    }
+    readBytesCount += sizeof(word);
+    LOG_INFO("   CLR ID        = " << word << "\n");
+
+    uint32_t count = dword;
+
+    // same as BulkNode: the edges must fit in the payload of this event
+    // Note: the edges are matched to their node by position so the missing ones would shift
+    //       all the next edges to the wrong nodes: they are all dropped instead
+    uint64_t edgesSize = (uint64_t)count * _bulkEdgeSize;
+    if ((readBytesCount > payloadSize) || (edgesSize > payloadSize - readBytesCount))
+    {
+        LOG_ERROR("BulkEdge count (" << count << ") does not fit in the payload (" << payloadSize << " bytes)\n");
+        _gcDump.OnInvalidEdges();
+        return (readBytesCount <= payloadSize) && SkipBytes(payloadSize - readBytesCount);
+    }
+
+    // the edges follow the ones of the previous event: they are all added at once
+    const uint8_t* pEdges = nullptr;
+    if (!TryGetRange(edgesSize, pEdges))
+    {
+        LOG_ERROR("Error while reading " << count << " edges\n");
+        return false;
+    }
+    readBytesCount += (DWORD)edgesSize;
+
+    (this->*_pfnAddEdges)(pEdges, count);
+
+    return SkipBytes(payloadSize - readBytesCount);
+}
+
+template <class TPointer>
+void EventParser::AddEdges(const uint8_t* pEdges, uint32_t count)
+{
+    _gcDump.AddEdges<TPointer>(pEdges, count);
 }
 
 
+// the position is moved after the payload, even for the events that are not listened to
+bool EventParserBase::DecodeListenedEvent(EventHandlerId handlerId, EventBlobHeader& header, EventCacheMetadata& metadataDef, ListenedEvent& event)
+{
+    switch (handlerId)
+    {
+        case EventHandlerId::AllocationTick:
+            return OnAllocationTick(header.PayloadSize, metadataDef, event.AllocationTick);
+
+        case EventHandlerId::ContentionStop:
+            return OnContentionStop(header.ThreadId, header.PayloadSize, metadataDef, event.ContentionStop);
+
+        case EventHandlerId::ExceptionThrown:
+            return OnExceptionThrown(header.PayloadSize, metadataDef, event.ExceptionThrown);
+
+        case EventHandlerId::GcStart:
+            return DecodeGcStart(header.PayloadSize, metadataDef, event.GcStart);
+
+        case EventHandlerId::GcEnd:
+            return DecodeGcEnd(header.PayloadSize, metadataDef, event.GcEnd);
+
+        default:
+            return SkipBytes(header.PayloadSize);
+    }
+}
 
 // from https://docs.microsoft.com/en-us/dotnet/framework/performance/garbage-collection-etw-events#gcallocationtick_v3-event
 //  AllocationAmount    UInt32          The allocation size, in bytes.
@@ -525,114 +1003,96 @@ bool EventParser::OnBulkEdge(DWORD payloadSize, EventCacheMetadata& metadataDef)
 //  HeapIndex           UInt32          The heap where the object was allocated.This value is 0 (zero)when running with workstation garbage collection.
 //  Address             Pointer         The address of the last allocated object.
 //
-bool EventParser::OnAllocationTick(DWORD payloadSize, EventCacheMetadata& metadataDef)
+template <class TPointer>
+bool EventParserBase::DecodeAllocationTick(DWORD payloadSize, EventCacheMetadata& metadataDef, AllocationTickEvent& event)
 {
     DWORD readBytesCount = 0;
     DWORD size = 0;
-    std::cout << "\nAllocation Tick:\n";
+    LOG_INFO("\nAllocation Tick:\n");
 
     // get common fields
     uint32_t dword = 0;
     if (!ReadDWord(dword))
     {
-        std::cout << "Error while reading allocation tick amount\n";
+        LOG_ERROR("Error while reading allocation tick amount\n");
         return false;
     }
     readBytesCount += sizeof(dword);
-    std::cout << "   Amount        = " << dword << " bytes\n";
+    LOG_INFO("   Amount        = " << dword << " bytes\n");
+    event.Amount = dword;
 
     if (!ReadDWord(dword))
     {
-        std::cout << "Error while reading allocation tick kind\n";
+        LOG_ERROR("Error while reading allocation tick kind\n");
         return false;
     }
     readBytesCount += sizeof(dword);
-    std::cout << "   Kind          = " << ((dword == 1) ? "LOH" : "small") << " bytes\n";
+    LOG_INFO("   Kind          = " << ((dword == 1) ? "LOH" : "small") << " bytes\n");
+    event.Kind = dword;
 
     uint16_t word = 0;
     if (!ReadWord(word))
     {
-        std::cout << "Error while reading allocation tick CLR instance ID\n";
+        LOG_ERROR("Error while reading allocation tick CLR instance ID\n");
         return false;
     }
     readBytesCount += sizeof(word);
-    std::cout << "   CLR ID        = " << word << "\n";
+    LOG_INFO("   CLR ID        = " << word << "\n");
+    event.ClrInstanceId = word;
 
     uint64_t ulong = 0;
     if (!ReadLong(ulong))
     {
-        std::cout << "Error while reading allocation tick amount64\n";
+        LOG_ERROR("Error while reading allocation tick amount64\n");
         return false;
     }
     readBytesCount += sizeof(ulong);
-    std::cout << "   Amount64      = " << ulong << " bytes\n";
+    LOG_INFO("   Amount64      = " << ulong << " bytes\n");
+    event.Amount64 = ulong;
 
-    // skip useless MT address
-    // Note: handle 32/64 bit difference
-    if (_is64Bit)
-    {
-        if (!ReadLong(ulong))
-        {
-            std::cout << "Error while reading allocation tick MT address\n";
-            return false;
-        }
-        readBytesCount += sizeof(ulong);
-    }
-    else
+    // MT address
+    if (!ReadPointer<TPointer>(ulong))
     {
-        if (!ReadDWord(dword))
-        {
-            std::cout << "Error while reading allocation tick MT address\n";
-            return false;
-        }
-        readBytesCount += sizeof(dword);
+        LOG_ERROR("Error while reading allocation tick MT address\n");
+        return false;
     }
+    readBytesCount += sizeof(TPointer);
+    event.TypeId = ulong;
 
-    std::wstring strBuffer;
-    strBuffer.reserve(128);
-    if (!ReadWString(strBuffer, size))
+    WStringView typeName;
+    if (!ReadWStringView(typeName, size))
     {
-        std::cout << "Error while reading allocation tick type name\n";
+        LOG_ERROR("Error while reading allocation tick type name\n");
         return false;
     }
     readBytesCount += size;
-    if (strBuffer.empty())
-        std::wcout << L"   Type          = ''\n";
+    if (typeName.IsEmpty())
+        LOG_INFO_W(L"   Type          = ''\n");
     else
-        std::wcout << L"   Type          = " << strBuffer.c_str() << L"\n";
+        LOG_INFO_W(L"   Type          = " << typeName << L"\n");
+    event.TypeName = typeName;
 
     if (!ReadDWord(dword))
     {
-        std::cout << "Error while reading allocation tick heap index\n";
+        LOG_ERROR("Error while reading allocation tick heap index\n");
         return false;
     }
     readBytesCount += sizeof(dword);
-    std::cout << "   Heap index    = " << dword << "\n";
+    LOG_INFO("   Heap index    = " << dword << "\n");
+    event.HeapIndex = dword;
 
     // get additional fields if any
+    event.Address = 0;
     if (metadataDef.Version >= 3)
     {
-        // Note: handle 32/64 bit difference
-        if (_is64Bit)
-        {
-            if (!ReadLong(ulong))
-            {
-                std::cout << "Error while reading allocation tick object address\n";
-                return false;
-            }
-            readBytesCount += sizeof(ulong);
-            std::cout << "   Object addr   = 0x" << std::hex << ulong << std::dec << "\n";
-        }
-        else
+        if (!ReadPointer<TPointer>(ulong))
         {
-            if (!ReadDWord(dword))
-            {
-                std::cout << "Error while reading allocation tick object address\n";
-                return false;
-            }
-            readBytesCount += sizeof(dword);
-            std::cout << "   Object addr   = 0x" << std::hex << dword << std::dec << "\n";
+            LOG_ERROR("Error while reading allocation tick object address\n");
+            return false;
         }
+        readBytesCount += sizeof(TPointer);
+        LOG_INFO("   Object addr   = 0x" << std::hex << ulong << std::dec << "\n");
+        event.Address = ulong;
     }
 
     // skip the rest of the payload
@@ -645,39 +1105,43 @@ bool EventParser::OnAllocationTick(DWORD payloadSize, EventCacheMetadata& metada
 //  ClrInstanceID   win:UInt16
 //  DurationNs      win:Double  duration of the contention in nanoseconds (only in V1)
 //
-bool EventParser::OnContentionStop(uint64_t threadId, DWORD payloadSize, EventCacheMetadata& metadataDef)
+bool EventParserBase::OnContentionStop(uint64_t threadId, DWORD payloadSize, EventCacheMetadata& metadataDef, ContentionStopEvent& event)
 {
     DWORD readBytesCount = 0;
     DWORD size = 0;
-    std::cout << "\nContention:\n";
-    std::cout << "   Thread ID  = " << threadId << "\n";
+    LOG_INFO("\nContention:\n");
+    LOG_INFO("   Thread ID  = " << threadId << "\n");
 
     uint8_t flags = 0;
     if (!ReadByte(flags))
     {
-        std::cout << "Error while reading contention end flags ID\n";
+        LOG_ERROR("Error while reading contention end flags ID\n");
         return false;
     }
     readBytesCount += sizeof(flags);
-    std::cout << "   Lock type  = " << ((flags == 0) ? "Managed" : "Native") << "\n";
+    LOG_INFO("   Lock type  = " << ((flags == 0) ? "Managed" : "Native") << "\n");
 
     uint16_t word = 0;
     if (!ReadWord(word))
     {
-        std::cout << "Error while reading contention end CLR instance ID\n";
+        LOG_ERROR("Error while reading contention end CLR instance ID\n");
         return false;
     }
     readBytesCount += sizeof(word);
-    std::cout << "   CLR ID     = " << word << "\n";
+    LOG_INFO("   CLR ID     = " << word << "\n");
 
     double d = 0;
     if (!ReadDouble(d))
     {
-        std::cout << "Error while reading contention end duration\n";
+        LOG_ERROR("Error while reading contention end duration\n");
         return false;
     }
     readBytesCount += sizeof(d);
-    std::cout << "   Duration   = " << d / 1000000 << " ms\n";
+    LOG_INFO("   Duration   = " << d / 1000000 << " ms\n");
+
+    event.Flags = flags;
+    event.ClrInstanceId = word;
+    event.DurationNs = d;
 
     // skip the rest of the payload
     return SkipBytes(payloadSize - readBytesCount);
@@ -698,54 +1162,54 @@ bool EventParser::OnContentionStop(uint64_t threadId, DWORD payloadSize, EventCa
 //      0x10: IsCLSCompliant (an exception that derives from Exception is CLS-compliant; otherwise, it is not CLS-compliant).
 // ClrInstanceID	win:UInt16	Unique ID for the instance of CLR or CoreCLR.
 //
-bool EventParser::OnExceptionThrown(DWORD payloadSize, EventCacheMetadata& metadataDef)
+bool EventParserBase::OnExceptionThrown(DWORD payloadSize, EventCacheMetadata& metadataDef, ExceptionThrownEvent& event)
 {
     DWORD readBytesCount = 0;
     DWORD size = 0;
 
     // string: exception type
     // string: exception message
-    std::wstring strBuffer;
-    strBuffer.reserve(128);
-    std::cout << "\nException thrown:\n";
+    WStringView strView;
+    LOG_INFO("\nException thrown:\n");
 
-    if (!ReadWString(strBuffer, size))
+    if (!ReadWStringView(strView, size))
     {
-        std::cout << "Error while reading exception thrown type name\n";
+        LOG_ERROR("Error while reading exception thrown type name\n");
         return false;
     }
     readBytesCount += size;
-    if (strBuffer.empty())
-        std::wcout << L"   type    = ''\n";
+    if (strView.IsEmpty())
+        LOG_INFO_W(L"   type    = ''\n");
     else
-        std::wcout << L"   type    = " << strBuffer.c_str() << L"\n";
-
-    strBuffer.clear();
+        LOG_INFO_W(L"   type    = " << strView << L"\n");
+    event.Type = strView;
+    event.Message = WStringView();
 
     // Size of the ExceptionThrown payload AFTER the Message field
-    uint16_t exceptionRemainingPayloadSize = (_is64Bit ? 8 : 4) + 4 + 2 + 2;
+    uint16_t exceptionRemainingPayloadSize = PointerSize + 4 + 2 + 2;
 
     // In case of "empty" message, it might not be even visible as "\0" before .NET Core 6 (and after, will be "NULL")
     // so it is needed to check if the remaining payload contains such a string
     if ((payloadSize - readBytesCount) == exceptionRemainingPayloadSize)
     {
-        std::wcout << L"   message = ''\n";
+        LOG_INFO_W(L"   message = ''\n");
     }
     else
     {
-        if (!ReadWString(strBuffer, size))
+        if (!ReadWStringView(strView, size))
         {
-            std::cout << "Error while reading exception thrown message text\n";
+            LOG_ERROR("Error while reading exception thrown message text\n");
             return false;
         }
         readBytesCount += size;
 
         // handle empty string case (check for "NULL" in case of .NET 6+)
-        if (strBuffer.empty() || (wcscmp(strBuffer.c_str(), L"NULL") == 0))
-            std::wcout << L"   message = ''\n";
+        if (strView.IsEmpty() || strView.Equals(L"NULL"))
+            LOG_INFO_W(L"   message = ''\n");
         else
         {
-            std::wcout << L"   message = " << strBuffer.c_str() << L"\n";
+            LOG_INFO_W(L"   message = " << strView << L"\n");
+            event.Message = strView;
         }
     }
 
@@ -753,14 +1217,6 @@ bool EventParser::OnExceptionThrown(DWORD payloadSize, EventCacheMetadata& metad
     return SkipBytes(payloadSize - readBytesCount);
 }
 
-std::string EventParser::ToString(const wchar_t* wstr)
-{
-    int size = WideCharToMultiByte(CP_ACP, 0, wstr, -1, NULL, 0, NULL, NULL);
-    char* str = (char*)alloca(size);
-    size = WideCharToMultiByte(CP_ACP, 0, wstr, -1, str, size, NULL, NULL);
-    return std::string(str);
-}
-
 
 void DumpBlobHeader(EventBlobHeader& header)
 {
@@ -3,6 +3,7 @@
 #include "EventPipeSession.h"
 #include "DiagnosticsProtocol.h"
 #include "DiagnosticsClient.h"
+#include "Log.h"
 
 // from https://github.com/microsoft/perfview/blob/main/src/TraceEvent/EventPipe/EventPipeFormat.md
 //
@@ -76,36 +77,193 @@ bool CheckTraceObjectHeader(TraceObjectHeader& header)
     return true;
 }
 
-const uint32_t BLOCK_SIZE = 4*1024;
-const uint32_t MAX_BLOCK_SIZE = 100*1024;  // max buffer size sent by CLR
+const char* EventBlockName = "EventBlock";
+const char* MetadataBlockName = "MetadataBlock";
+const char* StackBlockName = "StackBlock";
+const char* SequencePointBlockName = "SPBlock";
+const uint32_t MaxObjectNameLength = 13;
+
+// there is no limit on the block size but the buffer also contains the final EndObject tag
+// Note: a larger size would wrap to 0 once the tag is added
+const uint32_t InvalidBlockSize = 0xFFFFFFFF;
+
+// when hosted, the reads of a session in a row before letting the event loop serve the others
+const uint32_t MaxReadsPerSignal = 16;
+
+// the runtime has closed its end of the EventPipe
+bool IsDisconnection(DWORD error)
+{
+    return (error == ERROR_PIPE_NOT_CONNECTED) || (error == ERROR_BROKEN_PIPE) || (error == ERROR_HANDLE_EOF);
+}
+
+bool IsValidObjectHeader(ObjectHeader& header)
+{
+    if (header.TagTraceObject != NettraceTag::BeginPrivateObject) return false;
+    if (header.TagTypeObjectForTrace != NettraceTag::BeginPrivateObject) return false;
+    if (header.TagType != NettraceTag::NullReference) return false;
+
+    return true;
+}
+
+// figure out which type it is based on the name:
+//   EventBlock -> "EventBlock"  (size = 10)
+//   MetadataBlock -> "MetadataBlock" (size = 13)
+//   StackBlock -> "StackBlock" (size = 10)
+//   SequencePointBlock -> "SPBlock" (size = 7)
+ObjectType GetObjectTypeFromName(uint8_t* pName, uint32_t nameLength)
+{
+    if (nameLength == 13)
+    {
+        if (IsSameAsString(pName, 13, MetadataBlockName))
+            return ObjectType::MetadataBlock;
+    }
+    else
+    if (nameLength == 10)
+    {
+        if (IsSameAsString(pName, 10, EventBlockName))
+            return ObjectType::EventBlock;
+        else
+        if (IsSameAsString(pName, 10, StackBlockName))
+            return ObjectType::StackBlock;
+    }
+    else
+    if (nameLength == 7)
+    {
+        if (IsSameAsString(pName, 7, SequencePointBlockName))
+            return ObjectType::SequencePointBlock;
+    }
+
+    return ObjectType::Unknown;
+}
+
+void DumpObjectHeader(ObjectHeader& header)
+{
+    std::cout << "\nObjectHeader: \n";
+    std::cout << "   TagTraceObject         = " << (uint8_t)header.TagTraceObject << "\n";
+    std::cout << "   TagTypeObjectForTrace  = " << (uint8_t)header.TagTypeObjectForTrace << "\n";
+    std::cout << "   TagType                = " << (uint8_t)header.TagType << "\n";
+    std::cout << "   Version                = " << header.Version << "\n";
+    std::cout << "   MinReaderVersion       = " << header.MinReaderVersion << "\n";
+    std::cout << "   NameLength             = " << header.NameLength << "\n";
+}
+
+// the objects headers are received into EventPipeSession::_frame when listening asynchronously
+static_assert(sizeof(NettraceHeader) <= 64, "NettraceHeader does not fit in a frame");
+static_assert(sizeof(TraceObjectHeader) <= 64, "TraceObjectHeader does not fit in a frame");
+static_assert(sizeof(ObjectFields) + 1 <= 64, "ObjectFields do not fit in a frame");
+static_assert(MaxObjectNameLength + 1 + sizeof(uint32_t) <= 64, "Object name does not fit in a frame");
+static_assert(sizeof(IpcHeader) <= 64, "IpcHeader does not fit in a frame");
 
 EventPipeSession::EventPipeSession(int pid, IIpcEndpoint* pEndpoint, uint64_t sessionId)
     :
     _pid(pid),
     _metadataParser(_metadata),
-    _eventParser(_metadata),
     _stackParser(_stacks32, _stacks64),
-    _sequencePointParser(_stacks32, _stacks64),
+    _sequencePointParser(_stacks32, _stacks64, _lossTracker),
     _pEndpoint(pEndpoint),
+    _blockQueue(_bufferPool),
+    _lossTracker(_threads),
     SessionId(sessionId)
 {
     Is64Bit = true;  // will be computed when the nettrace stream will be read in Listen()
     Error = 0;
     _position = 0;
     _stopRequested = false;
+    _hasFailed = false;
+    _isDisconnected = false;
     _blobHeader = {};
-    _blockSize = BLOCK_SIZE;
-    _pBlock = new uint8_t[_blockSize];
-    ::ZeroMemory(_pBlock, _blockSize);
+    _decodingThreadsCount = 0;
+    _pDecoder = nullptr;
+    _pOrderer = nullptr;
+    _pBackpressurePolicy = nullptr;
+    _pGenericHandler = nullptr;
+    _headerDecoding = DefaultHeaderDecoding;
+    _pEventParser = new EventParser(_metadata, _lossTracker, _statistics);
+
+    _pendingBlock = {};
+    _isStartPending = false;
+    _backToBackReadsCount = 0;
+    ExpectFrame(FramingState::NettraceHeader, _frame, sizeof(NettraceHeader));
 }
 
 EventPipeSession::~EventPipeSession()
 {
-    delete [] _pBlock;
+    // the session could have ended in the middle of a block
+    if (_pendingBlock.pBuffer != nullptr)
+    {
+        _bufferPool.Release(_pendingBlock.pBuffer, _pendingBlock.BufferSize);
+    }
+
+    // kept until now for the statistics
+    delete _pDecoder;
+    delete _pOrderer;
+    delete _pBackpressurePolicy;
+    delete _pEventParser;
+}
+
+// the settings already applied to the previous parser are kept
+void EventPipeSession::SetEventParser(EventParser* pParser)
+{
+    delete _pEventParser;
+    _pEventParser = pParser;
+    _pEventParser->SetOrderer(_pOrderer);
+    _pEventParser->SetBackpressurePolicy(_pBackpressurePolicy);
+    _pEventParser->SetGenericEventHandler(_pGenericHandler);
+    _pEventParser->SetHeaderDecoding(_headerDecoding);
+}
+
+void EventPipeSession::SetHeaderDecoding(const HeaderDecodingSettings& settings)
+{
+    _headerDecoding = settings;
+    _metadataParser.SetHeaderDecoding(settings);
+    _pEventParser->SetHeaderDecoding(settings);
+}
+
+void EventPipeSession::SetDecodingThreadsCount(uint32_t count)
+{
+    _decodingThreadsCount = count;
+}
+
+bool EventPipeSession::EnableDegradedMode(const std::vector<ProviderEventId>& lowPriorityEvents)
+{
+    if (_pBackpressurePolicy == nullptr)
+    {
+        _pBackpressurePolicy = new BackpressurePolicy();
+        _pEventParser->SetBackpressurePolicy(_pBackpressurePolicy);
+    }
+
+    bool success = true;
+    for (auto& lowPriorityEvent : lowPriorityEvents)
+    {
+        success = _pBackpressurePolicy->SetLowPriority(lowPriorityEvent.ProviderName, lowPriorityEvent.EventId) && success;
+    }
+
+    return success;
+}
+
+void EventPipeSession::SetGenericEventHandler(IGenericEventHandler* pHandler)
+{
+    _pGenericHandler = pHandler;
+    _pEventParser->SetGenericEventHandler(pHandler);
+}
+
+void EventPipeSession::ExpectStartResponse()
+{
+    _isStartPending = true;
+    ExpectFrame(FramingState::StartResponse, _frame, sizeof(IpcHeader));
+}
+
+void EventPipeSession::EnableEventOrdering(uint32_t maxBufferedBytes)
+{
+    delete _pOrderer;
+    _pOrderer = new EventOrderer(maxBufferedBytes);
+    _pEventParser->SetOrderer(_pOrderer);
 }
 
 bool EventPipeSession::Listen()
 {
+    TRACE_SET_CONTEXT(_pid);
+
     if (!ReadHeader())
         return false;
 
@@ -116,74 +274,662 @@ bool EventPipeSession::Listen()
     if (!ReadObjectFields(ofTrace))
         return false;
 
-    // use the "trace object" fields to figure out the bitness of the application
-    Is64Bit = ofTrace.PointerSize == 8;
-    _stackParser.SetPointerSize(ofTrace.PointerSize);
-    _metadataParser.SetPointerSize(ofTrace.PointerSize);
-    _eventParser.SetPointerSize(ofTrace.PointerSize);
-
     // don't forget to check the end object tag
     uint8_t tag;
     if (!ReadByte(tag) || (tag != NettraceTag::EndObject))
         return false;
 
-    // read one "object" after the other
+    if (!OnTraceObjectFields(ofTrace))
+        return false;
+
+    // no need for another thread when the blocks are already in memory
+    // (i.e. memory mapped recording) and their pointers are only valid until the next read
+    if (_pEndpoint->CanReadInPlace() && (_decodingThreadsCount == 0))
+    {
+        // read one "object" after the other
+        // until the end of the recording
+        uint64_t startTicks = SessionStatistics::GetTicks();
+        while (ReadNextObject())
+        {
+            uint64_t endTicks = SessionStatistics::GetTicks();
+            _statistics.OnParserBusy(endTicks - startTicks);
+            startTicks = endTicks;
+
+            LOG_VERBOSE("------------------------------------------------\n");
+            LOG_VERBOSE("\n________________________________________________\n");
+        }
+
+        // deliver the events received after the last sequence point
+        if (!_pEventParser->FlushOrderedEvents(false))
+            _hasFailed = true;
+
+        return _stopRequested;
+    }
+
+    // a reader thread drains the EventPipe while the blocks are parsed in this thread
+    // so that the CLR buffers don't fill up while the events are being processed
+    DWORD tid = 0;
+    HANDLE hReaderThread = ::CreateThread(nullptr, 0, ReaderThreadProc, this, 0, &tid);
+    if (hReaderThread == nullptr)
+    {
+        Error = ::GetLastError();
+        LOG_ERROR("Impossible to start the EventPipe reader thread: 0x" << std::hex << Error << std::dec << "\n");
+        return false;
+    }
+
+    // parse one "object" after the other
     // until the EventPipe gets deconnected
     // after the Stop command has been processed
-    while (ReadNextObject())
+    FramedBlock block;
+    bool success = true;
+    uint64_t startTicks = SessionStatistics::GetTicks();
+    while (_blockQueue.Pop(block))
+    {
+        uint64_t poppedTicks = SessionStatistics::GetTicks();
+        _statistics.OnParserWait(poppedTicks - startTicks);
+
+        // the lag is the number of blocks still waiting after this one
+        if (_pBackpressurePolicy != nullptr)
+        {
+            _pBackpressurePolicy->Update(_blockQueue.GetDepth(), _blockQueue.GetCapacity());
+        }
+
+        success = ProcessBlock(block);
+
+        startTicks = SessionStatistics::GetTicks();
+        _statistics.OnParserBusy(startTicks - poppedTicks);
+        if (!success)
+            break;
+    }
+
+    FlushDecoder(success);
+
+    if (!success)
+    {
+        _hasFailed = true;
+
+        // the reader thread could be waiting for the next bytes from the CLR
+        _blockQueue.Abort();
+        SendStopCommand();
+    }
+
+    ::WaitForSingleObject(hReaderThread, INFINITE);
+    ::CloseHandle(hReaderThread);
+
+    return _stopRequested;
+}
+
+bool EventPipeSession::OnTraceObjectFields(ObjectFields& ofTrace)
+{
+    // use the "trace object" fields to figure out the bitness of the application
+    Is64Bit = ofTrace.PointerSize == 8;
+    _stackParser.SetPointerSize(ofTrace.PointerSize);
+    _metadataParser.SetPointerSize(ofTrace.PointerSize);
+    _pEventParser->SetPointerSize(ofTrace.PointerSize);
+
+    if (_decodingThreadsCount > 0)
+    {
+        // the listener and the orderer are set before listening
+        _pDecoder = new ParallelEventDecoder(_metadata, ofTrace.PointerSize, _headerDecoding, _pEventParser->GetPredecodedEvents(), _decodingThreadsCount, _pid);
+    }
+
+    return true;
+}
+
+// deliver the blocks still being decoded (or just release them after an error)
+// and then the events received after the last sequence point
+void EventPipeSession::FlushDecoder(bool& success)
+{
+    if (_pDecoder != nullptr)
+    {
+        while (!_pDecoder->IsEmpty())
+        {
+            if (success)
+            {
+                success = DeliverOldestBlock();
+            }
+            else
+            {
+                _blockQueue.Release(_pDecoder->WaitForOldest()->Block);
+                _pDecoder->ReleaseOldest();
+            }
+        }
+    }
+
+    if (success)
+    {
+        success = _pEventParser->FlushOrderedEvents(false);
+    }
+}
+
+// don't wait for the next sequence point if too many events are buffered
+bool EventPipeSession::FlushOrderedEventsIfFull()
+{
+    if ((_pOrderer == nullptr) || !_pOrderer->IsFull())
+        return true;
+
+    return _pEventParser->FlushOrderedEvents(true);
+}
+
+bool EventPipeSession::CanListenAsync()
+{
+    // the memory mapped recordings are simply read by Listen()
+    return _pEndpoint->CanReadAsync() && !_pEndpoint->CanReadInPlace();
+}
+
+// called by the event loop thread each time the endpoint is signaled
+bool EventPipeSession::OnReadAvailable()
+{
+    // the event loop thread is shared with other sessions
+    TRACE_SET_CONTEXT(_pid);
+
+    // no block queue to look at: the parser lags behind when the next read has already
+    // completed each time the bytes of the previous one have been parsed
+    // Note: a runtime keeping the pipe full must not hold the thread forever so the other sessions
+    //       are given a chance after MaxReadsPerSignal reads; the read event stays signaled by
+    //       the completed read so the loop comes back to this session
+    uint32_t readsCount = 0;
+    while (true)
     {
-        std::cout << "------------------------------------------------\n";
-        std::cout << "\n________________________________________________\n";
+        if (!_pEndpoint->IsReadAvailable())
+        {
+            _backToBackReadsCount = 0;
+            break;
+        }
+
+        if (readsCount == MaxReadsPerSignal)
+            break;
+        readsCount++;
+
+        const uint8_t* pBytes = nullptr;
+        DWORD readBytes = 0;
+        if (!_pEndpoint->ReadAvailable(pBytes, readBytes))
+        {
+            Error = ::GetLastError();
+            if (IsDisconnection(Error))
+            {
+                _isDisconnected = true;
+                LOG_INFO("EventPipe has been deconnected...\n");
+            }
+            else
+            {
+                LOG_ERROR("Error while reading EventPipe: 0x" << std::hex << Error << std::dec << "\n");
+            }
+
+            return false;
+        }
+
+        if (_pBackpressurePolicy != nullptr)
+        {
+            _pBackpressurePolicy->Update(_backToBackReadsCount, HostedLagCapacity);
+        }
+        _backToBackReadsCount++;
+
+        uint64_t startTicks = SessionStatistics::GetTicks();
+        bool success = Feed(pBytes, readBytes);
+        _statistics.OnParserBusy(SessionStatistics::GetTicks() - startTicks);
+        if (!success)
+        {
+            _hasFailed = true;
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool EventPipeSession::EndListening()
+{
+    TRACE_SET_CONTEXT(_pid);
+
+    bool success = !_hasFailed;
+    FlushDecoder(success);
+    if (!success)
+        _hasFailed = true;
+
+    // no session to stop if the runtime did not start it
+    if (!success && !_isStartPending)
+    {
+        SendStopCommand();
     }
 
     return _stopRequested;
 }
 
+void EventPipeSession::ExpectFrame(FramingState state, uint8_t* pFrame, uint32_t frameSize)
+{
+    _framingState = state;
+    _pFrame = pFrame;
+    _frameSize = frameSize;
+    _frameReceived = 0;
+}
+
+// the bytes are received in chunks that don't match the objects boundaries:
+// they are accumulated into the current frame until it is complete
+bool EventPipeSession::Feed(const uint8_t* pBytes, DWORD size)
+{
+    while (true)
+    {
+        uint32_t count = _frameSize - _frameReceived;
+        if (count > size)
+            count = size;
+
+        memcpy(_pFrame + _frameReceived, pBytes, count);
+        _frameReceived += count;
+        _position += count;
+        pBytes += count;
+        size -= count;
+
+        // wait for the next bytes
+        // Note: empty frames (i.e. no padding) are processed immediately
+        if (_frameReceived < _frameSize)
+            return true;
+
+        if (!OnFrameReceived())
+            return false;
+    }
+}
+
+// same checks as the Read* helpers used by Listen()
+bool EventPipeSession::OnFrameReceived()
+{
+    switch (_framingState)
+    {
+        case FramingState::StartResponse:
+        {
+            IpcHeader& response = *reinterpret_cast<IpcHeader*>(_frame);
+            EventPipeStartRequest request;
+            if (!request.CheckResponse(response))
+            {
+                Error = request.Error;
+                return false;
+            }
+
+            uint32_t payloadSize = response.Size - sizeof(IpcHeader);
+            if (payloadSize > sizeof(_frame))
+            {
+                LOG_ERROR("Unexpected EventPipe collect reponse payload size: " << payloadSize << "\n");
+                return false;
+            }
+
+            ExpectFrame(FramingState::StartResponsePayload, _frame, payloadSize);
+            return true;
+        }
+
+        case FramingState::StartResponsePayload:
+            memcpy(&SessionId, _frame, sizeof(SessionId));
+            _isStartPending = false;
+
+            // the positions are relative to the beginning of the nettrace stream
+            _position = 0;
+            ExpectFrame(FramingState::NettraceHeader, _frame, sizeof(NettraceHeader));
+            return true;
+
+        case FramingState::NettraceHeader:
+            if (!CheckNettraceHeader(*reinterpret_cast<NettraceHeader*>(_frame)))
+                return false;
+
+            ExpectFrame(FramingState::TraceObjectHeader, _frame, sizeof(TraceObjectHeader));
+            return true;
+
+        case FramingState::TraceObjectHeader:
+            if (!CheckTraceObjectHeader(*reinterpret_cast<TraceObjectHeader*>(_frame)))
+                return false;
+
+            ExpectFrame(FramingState::TraceObjectFields, _frame, sizeof(ObjectFields) + 1);
+            return true;
+
+        case FramingState::TraceObjectFields:
+        {
+            if (_frame[sizeof(ObjectFields)] != NettraceTag::EndObject)
+                return false;
+
+            ObjectFields ofTrace;
+            memcpy(&ofTrace, _frame, sizeof(ObjectFields));
+            if (!OnTraceObjectFields(ofTrace))
+                return false;
+
+            ExpectFrame(FramingState::ObjectHeader, _frame, sizeof(ObjectHeader));
+            return true;
+        }
+
+        case FramingState::ObjectHeader:
+        {
+            ObjectHeader& header = *reinterpret_cast<ObjectHeader*>(_frame);
+            if (!IsValidObjectHeader(header) || (header.NameLength > MaxObjectNameLength))
+            {
+                LOG_ERROR("Invalid object header type:\n");
+                DumpObjectHeader(header);
+                return false;
+            }
+
+            // all blocks share the same layout
+            if (header.MinReaderVersion != 2) return false;
+
+            // name + end object tag + block size
+            ExpectFrame(FramingState::ObjectName, _frame, header.NameLength + 1 + sizeof(uint32_t));
+            return true;
+        }
+
+        case FramingState::ObjectName:
+        {
+            uint32_t nameLength = _frameSize - 1 - sizeof(uint32_t);
+            ObjectType ot = GetObjectTypeFromName(_frame, nameLength);
+            if (ot == ObjectType::Unknown)
+            {
+                LOG_ERROR("Invalid object name\n");
+                return false;
+            }
+
+            uint8_t tag = _frame[nameLength];
+            if (tag != NettraceTag::EndObject)
+            {
+                LOG_ERROR("Missing end of object tag: " << tag << "\n");
+                return false;
+            }
+
+            // the block + final EndOfObject tag
+            uint32_t blockSize = 0;
+            memcpy(&blockSize, _frame + nameLength + 1, sizeof(uint32_t));
+            if (blockSize == InvalidBlockSize)
+            {
+                LOG_ERROR("Invalid " << GetBlockName(ot) << " block size: " << blockSize << " bytes\n");
+                return false;
+            }
+            _pendingBlock.Type = ot;
+            _pendingBlock.BlockSize = blockSize + 1;
+
+            // the rest of the block must be 4 bytes aligned with the beginning of the file
+            ExpectFrame(FramingState::Padding, _frame, (4 - (_position % 4)) % 4);
+            return true;
+        }
+
+        case FramingState::Padding:
+            _pendingBlock.OriginInFile = _position;
+            _pendingBlock.pBuffer = _bufferPool.Acquire(_pendingBlock.BlockSize, _pendingBlock.BufferSize);
+            if (_pendingBlock.pBuffer == nullptr)
+            {
+                LOG_ERROR("Impossible to allocate " << _pendingBlock.BlockSize << " bytes for " << GetBlockName(_pendingBlock.Type) << " block\n");
+                return false;
+            }
+            _pendingBlock.pBlock = _pendingBlock.pBuffer;
+
+            ExpectFrame(FramingState::Block, _pendingBlock.pBuffer, _pendingBlock.BlockSize);
+            return true;
+
+        case FramingState::Block:
+        {
+            TRACE_STEP(TraceId::BlockExtracted, _pendingBlock.Type, _pendingBlock.BlockSize);
+
+            // the buffer is now owned by the parsers/decoder
+            FramedBlock block = _pendingBlock;
+            _pendingBlock = {};
+
+            ExpectFrame(FramingState::ObjectHeader, _frame, sizeof(ObjectHeader));
+            return ProcessBlock(block);
+        }
+
+        default:
+            return false;
+    }
+}
+
+DWORD WINAPI EventPipeSession::ReaderThreadProc(void* pParam)
+{
+    EventPipeSession* pSession = static_cast<EventPipeSession*>(pParam);
+    pSession->ReaderLoop();
+
+    return 0;
+}
+
+void EventPipeSession::ReaderLoop()
+{
+    TRACE_SET_CONTEXT(_pid);
+
+    FramedBlock block;
+    uint64_t startTicks = SessionStatistics::GetTicks();
+    while (ExtractNextBlock(block))
+    {
+        uint64_t readTicks = SessionStatistics::GetTicks();
+        _statistics.OnReaderRead(readTicks - startTicks);
+
+        // the parser has failed
+        if (!_blockQueue.Push(block))
+        {
+            _bufferPool.Release(block.pBuffer, block.BufferSize);
+            break;
+        }
+
+        startTicks = SessionStatistics::GetTicks();
+        _statistics.OnReaderStall(startTicks - readTicks);
+    }
+
+    _blockQueue.Complete();
+}
+
+void EventPipeSession::GetBlockQueueStatistics(BlockQueueStatistics& stats)
+{
+    _blockQueue.GetStatistics(stats);
+}
+
+void EventPipeSession::GetBufferPoolStatistics(BlockBufferPoolStatistics& stats)
+{
+    _bufferPool.GetStatistics(stats);
+}
+
+void EventPipeSession::GetDecoderStatistics(DecoderStatistics& stats)
+{
+    if (_pDecoder == nullptr)
+    {
+        stats = {};
+        return;
+    }
+
+    _pDecoder->GetStatistics(stats);
+}
+
+uint64_t EventPipeSession::GetHeaderMismatchesCount()
+{
+    uint64_t count = _metadataParser.GetHeaderMismatchesCount() + _pEventParser->GetHeaderMismatchesCount();
+    if (_pDecoder != nullptr)
+    {
+        count += _pDecoder->GetHeaderMismatchesCount();
+    }
+
+    return count;
+}
+
+void EventPipeSession::GetStatistics(SessionStatisticsSnapshot& snapshot)
+{
+    _statistics.GetSnapshot(snapshot);
+}
+
+void EventPipeSession::GetDegradedModeStatistics(DegradedModeStatistics& stats)
+{
+    if (_pBackpressurePolicy == nullptr)
+    {
+        stats = {};
+        return;
+    }
+
+    _pBackpressurePolicy->GetStatistics(stats);
+}
+
+uint64_t EventPipeSession::GetSkippedEventsCount(const std::wstring& providerName, uint32_t eventId)
+{
+    if (_pBackpressurePolicy == nullptr)
+        return 0;
+
+    return _pBackpressurePolicy->GetSkippedEventsCount(providerName, eventId);
+}
+
+void EventPipeSession::GetOrderingStatistics(OrderingStatistics& stats)
+{
+    if (_pOrderer == nullptr)
+    {
+        stats = {};
+        return;
+    }
+
+    _pOrderer->GetStatistics(stats);
+}
+
+void EventPipeSession::GetEventLossStatistics(EventLossStatistics& stats)
+{
+    _lossTracker.GetStatistics(stats);
+}
+
+void EventPipeSession::GetThreadsEventLoss(std::vector<ThreadEventLoss>& threads)
+{
+    _lossTracker.GetThreadsEventLoss(threads);
+}
+
+bool EventPipeSession::ProcessBlock(FramedBlock& block)
+{
+    _statistics.OnBlock(block.Type, block.BlockSize);
+
+    if (_pDecoder == nullptr)
+    {
+        bool success = ParseBlock(block);
+        _blockQueue.Release(block);
+        if (!success)
+            return false;
+
+        LOG_VERBOSE("------------------------------------------------\n");
+        LOG_VERBOSE("\n________________________________________________\n");
+        return true;
+    }
+
+    // the definitions must be known before the next EventBlocks get decoded but the metadata table
+    // is read without lock by the workers: wait for the blocks in flight to be delivered first so that
+    // each block is decoded against an immutable snapshot of the definitions
+    if (block.Type == ObjectType::MetadataBlock)
+    {
+        while (!_pDecoder->IsEmpty())
+        {
+            if (!DeliverOldestBlock())
+            {
+                _blockQueue.Release(block);
+                return false;
+            }
+        }
+
+        bool success = ParseBlock(block);
+        _blockQueue.Release(block);
+
+        return success;
+    }
+
+    _pDecoder->Submit(block);
+    while (_pDecoder->IsFull())
+    {
+        if (!DeliverOldestBlock())
+            return false;
+    }
+
+    return true;
+}
+
+// call the handlers in stream order
+bool EventPipeSession::DeliverOldestBlock()
+{
+    DecodedBlock* pDecoded = _pDecoder->WaitForOldest();
+    FramedBlock& block = pDecoded->Block;
+
+    bool success = pDecoded->Success;
+    if (success)
+    {
+        if (pDecoded->IsDecoded)
+        {
+            LOG_VERBOSE("\n" << GetBlockName(block.Type) << " block (" << block.BlockSize << " bytes)\n");
+            success = _pEventParser->Dispatch(block.pBlock, block.BlockSize, block.OriginInFile, pDecoded->Records) &&
+                      FlushOrderedEventsIfFull();
+        }
+        else
+        {
+            success = ParseBlock(block);
+        }
+    }
+
+    _blockQueue.Release(block);
+    _pDecoder->ReleaseOldest();
+
+    if (success)
+    {
+        LOG_VERBOSE("------------------------------------------------\n");
+        LOG_VERBOSE("\n________________________________________________\n");
+    }
+
+    return success;
+}
+
 
 bool EventPipeSession::Stop()
 {
     _stopRequested = true;
 
+    return SendStopCommand();
+}
+
+bool EventPipeSession::SendStopCommand()
+{
     if (_pid == -1)
         return true;
 
+    // the runtime has closed the connection (or exited): there is no session to stop anymore
+    if (_isDisconnected)
+        return false;
+
     // it is neeeded to use a different ipc connection to stop the Session
+    // Note: the runtime could have exited since the stream was corrupted
     DiagnosticsClient* pStopClient = DiagnosticsClient::Create(_pid, nullptr);
-    pStopClient->StopEventPipeSession(SessionId);
+    if (pStopClient == nullptr)
+    {
+        LOG_ERROR("Impossible to connect to process #" << _pid << " to stop the session\n");
+        return false;
+    }
+
+    bool success = pStopClient->StopEventPipeSession(SessionId);
     delete pStopClient;
 
-    return true;
+    return success;
 }
 
 
-void DumpObjectHeader(ObjectHeader& header)
+bool EventPipeSession::ReadNextObject()
 {
-    std::cout << "\nObjectHeader: \n";
-    std::cout << "   TagTraceObject         = " << (uint8_t)header.TagTraceObject << "\n";
-    std::cout << "   TagTypeObjectForTrace  = " << (uint8_t)header.TagTypeObjectForTrace << "\n";
-    std::cout << "   TagType                = " << (uint8_t)header.TagType << "\n";
-    std::cout << "   Version                = " << header.Version << "\n";
-    std::cout << "   MinReaderVersion       = " << header.MinReaderVersion << "\n";
-    std::cout << "   NameLength             = " << header.NameLength << "\n";
+    FramedBlock block;
+    if (!ExtractNextBlock(block))
+        return false;
+
+    _statistics.OnBlock(block.Type, block.BlockSize);
+    if (!ParseBlock(block))
+    {
+        _hasFailed = true;
+        return false;
+    }
+
+    return true;
 }
 
 // look at FastSerialization implementation with a decompiler:
 //  .ReadObject()
 //  .ReadObjectDefinition()
-bool EventPipeSession::ReadNextObject()
+bool EventPipeSession::ExtractNextBlock(FramedBlock& block)
 {
     // get the type of object from the header
     ObjectHeader header;
     if (!Read(&header, sizeof(ObjectHeader)))
     {
         Error = ::GetLastError();
-        if (Error == ERROR_PIPE_NOT_CONNECTED)
+        if (IsDisconnection(Error))
         {
-            std::cout << "EventPipe has been deconnected...\n";
+            _isDisconnected = true;
+            LOG_INFO("EventPipe has been deconnected...\n");
         }
         else
         {
-            std::cout << "Error while reading Object header: 0x" << std::hex << Error << std::dec << "\n";
+            LOG_ERROR("Error while reading Object header: 0x" << std::hex << Error << std::dec << "\n");
         }
 
         return false;
@@ -192,8 +938,9 @@ bool EventPipeSession::ReadNextObject()
     ObjectType ot = GetObjectType(header);
     if (ot == ObjectType::Unknown)
     {
-        std::cout << "Invalid object header type:\n";
+        LOG_ERROR("Invalid object header type:\n");
         DumpObjectHeader(header);
+        _hasFailed = true;
         return false;
     }
 
@@ -201,83 +948,81 @@ bool EventPipeSession::ReadNextObject()
     uint8_t tag;
     if (!ReadByte(tag) || (tag != NettraceTag::EndObject))
     {
-        std::cout << "Missing end of object tag: " << (uint8_t)tag << "\n";
+        LOG_ERROR("Missing end of object tag: " << (uint8_t)tag << "\n");
+        _hasFailed = true;
+        return false;
+    }
+
+    // all blocks share the same layout
+    if (header.MinReaderVersion != 2)
+    {
+        LOG_ERROR("Unsupported block reader version: " << header.MinReaderVersion << "\n");
+        _hasFailed = true;
         return false;
     }
 
-    switch (ot)
+    block.Type = ot;
+    if (!ExtractBlock(GetBlockName(ot), block))
+        return false;
+
+    TRACE_STEP(TraceId::BlockExtracted, ot, block.BlockSize);
+    return true;
+}
+
+bool EventPipeSession::ParseBlock(FramedBlock& block)
+{
+    LOG_VERBOSE("\n" << GetBlockName(block.Type) << " block (" << block.BlockSize << " bytes)\n");
+    //DumpBuffer(block.pBlock, block.BlockSize);
+
+    bool success = false;
+    switch (block.Type)
     {
+        // look at:
+        //  EventpipeEventBlock.ReadBlockContent()
         case ObjectType::EventBlock:
-            return ParseEventBlock(header);
+            success = _pEventParser->Parse(block.pBlock, block.BlockSize, block.OriginInFile) &&
+                      FlushOrderedEventsIfFull();
+            break;
+
+        // look at implementation:
+        //  TraceEventNativeMethods.EVENT_RECORD* ReadEvent() implementation
+        //  EventPipeBlock.FromStream(Deserializer)
         case ObjectType::MetadataBlock:
-            return ParseMetadataBlock(header);
+            success = _metadataParser.Parse(block.pBlock, block.BlockSize, block.OriginInFile);
+            break;
+
         case ObjectType::StackBlock:
-            return ParseStackBlock(header);
+            success = _stackParser.Parse(block.pBlock, block.BlockSize, block.OriginInFile);
+            break;
+
+        // all the events before a sequence point have been received
         case ObjectType::SequencePointBlock:
-            return ParseSequencePointBlock(header);
+            success = _pEventParser->FlushOrderedEvents(false) &&
+                      _sequencePointParser.Parse(block.pBlock, block.BlockSize, block.OriginInFile);
+            break;
 
         default:
-            return false;
+            break;
     }
-}
 
-const char* EventBlockName = "EventBlock";
-const char* MetadataBlockName = "MetadataBlock";
-const char* StackBlockName = "StackBlock";
-const char* SequencePointBlockName = "SPBlock";
+    TRACE_STEP(TraceId::BlockParsed, block.Type, success);
+    return success;
+}
 
 ObjectType EventPipeSession::GetObjectType(ObjectHeader& header)
 {
     // check validity
-    if (header.TagTraceObject != NettraceTag::BeginPrivateObject) return ObjectType::Unknown;
-    if (header.TagTypeObjectForTrace != NettraceTag::BeginPrivateObject) return ObjectType::Unknown;
-    if (header.TagType != NettraceTag::NullReference) return ObjectType::Unknown;
-
-    // figure out which type it is based on the name:
-    //   EventBlock -> "EventBlock"  (size = 10)
-    //   MetadataBlock -> "MetadataBlock" (size = 13)
-    //   StackBlock -> "StackBlock" (size = 10)
-    //   SequencePointBlock -> "SPBlock" (size = 7)
-    if (header.NameLength == 13)
-    {
-        uint8_t buffer[13];
-        if (!Read(buffer, 13))
-            return ObjectType::Unknown;
-
-        if (IsSameAsString(buffer, 13, MetadataBlockName))
-            return ObjectType::MetadataBlock;
-
+    if (!IsValidObjectHeader(header))
         return ObjectType::Unknown;
-    }
-    else
-    if (header.NameLength == 10)
-    {
-        uint8_t buffer[10];
-        if (!Read(buffer, 10))
-            return ObjectType::Unknown;
-
-        if (IsSameAsString(buffer, 10, EventBlockName))
-            return ObjectType::EventBlock;
-        else
-        if (IsSameAsString(buffer, 10, StackBlockName))
-            return ObjectType::StackBlock;
 
+    if (header.NameLength > MaxObjectNameLength)
         return ObjectType::Unknown;
-    }
-    else
-    if (header.NameLength == 7)
-    {
-        uint8_t buffer[7];
-        if (!Read(buffer, 7))
-            return ObjectType::Unknown;
-
-        if (IsSameAsString(buffer, 7, SequencePointBlockName))
-            return ObjectType::SequencePointBlock;
 
+    uint8_t buffer[MaxObjectNameLength];
+    if (!Read(buffer, header.NameLength))
         return ObjectType::Unknown;
-    }
 
-    return ObjectType::Unknown;
+    return GetObjectTypeFromName(buffer, header.NameLength);
 }
 
 bool EventPipeSession::ReadBlockSize(const char* blockName, uint32_t& blockSize)
@@ -285,11 +1030,18 @@ bool EventPipeSession::ReadBlockSize(const char* blockName, uint32_t& blockSize)
     if (!ReadDWord(blockSize))
     {
         Error = ::GetLastError();
-        std::cout << "Error while reading " << blockName << " block size: 0x" << std::hex << Error << std::dec << "\n";
+        LOG_ERROR("Error while reading " << blockName << " block size: 0x" << std::hex << Error << std::dec << "\n");
         return false;
     }
     // Note: blockSizeInBytes does not include padding bytes to ensure alignment.
 
+    if (blockSize == InvalidBlockSize)
+    {
+        LOG_ERROR("Invalid " << blockName << " block size: " << blockSize << " bytes\n");
+        _hasFailed = true;
+        return false;
+    }
+
     // the rest of the block must be 4 bytes aligned with the beginning of the file
     if (!SkipPadding())
         return false;
@@ -298,115 +1050,88 @@ bool EventPipeSession::ReadBlockSize(const char* blockName, uint32_t& blockSize)
 }
 
 
-// look at:
-//  EventpipeEventBlock.ReadBlockContent()
-bool EventPipeSession::ParseEventBlock(ObjectHeader& header)
-{
-    if (header.MinReaderVersion != 2) return false;
-
-    //// TODO: uncomment to dump the event block instead of parsing it
-    //return SkipBlock("Event");
-
-    uint32_t blockSize = 0;
-
-    // read the block and send it to the corresponding parser
-    uint64_t blockOriginInFile = 0;
-    if (!ExtractBlock("Event", blockSize, blockOriginInFile))
-        return false;
-
-    return _eventParser.Parse(_pBlock, blockSize, blockOriginInFile);
-}
-
-
-// look at implementation:
-//  TraceEventNativeMethods.EVENT_RECORD* ReadEvent() implementation
-//  EventPipeBlock.FromStream(Deserializer)
-bool EventPipeSession::ParseMetadataBlock(ObjectHeader& header)
-{
-    if (header.MinReaderVersion != 2) return false;
-
-    // TODO: uncomment to dump metadata block
-    //return SkipBlock("Metadata");
-
-    uint32_t blockSize = 0;
-
-    // read the block and send it to the corresponding parser
-    uint64_t blockOriginInFile = 0;
-    if (!ExtractBlock("Metadata", blockSize, blockOriginInFile))
-        return false;
-
-    return _metadataParser.Parse(_pBlock, blockSize, blockOriginInFile);
-}
-
 const std::wstring DotnetRuntimeProvider = L"Microsoft-Windows-DotNETRuntime";
 const std::wstring EventPipeProvider = L"Microsoft-DotNETCore-EventPipe";
 
 
-bool EventPipeSession::ParseStackBlock(ObjectHeader& header)
-{
-    if (header.MinReaderVersion != 2) return false;
-
-    uint32_t blockSize = 0;
-
-    // read the block and send it to the corresponding parser
-    uint64_t blockOriginInFile = 0;
-    if (!ExtractBlock("Stack", blockSize, blockOriginInFile))
-        return false;
-
-    return _stackParser.Parse(_pBlock, blockSize, blockOriginInFile);
-}
-
-bool EventPipeSession::ParseSequencePointBlock(ObjectHeader& header)
+const char* EventPipeSession::GetBlockName(ObjectType type)
 {
-    if (header.MinReaderVersion != 2) return false;
-
-    //// uncomment to skip sequence point block parsing
-    //return SkipBlock("SequencePoint");
-
-    uint32_t blockSize = 0;
-
-    // read the block and send it to the corresponding parser
-    uint64_t blockOriginInFile = 0;
-    if (!ExtractBlock("SequencePoint", blockSize, blockOriginInFile))
-        return false;
-
-    return _sequencePointParser.Parse(_pBlock, blockSize, blockOriginInFile);
+    switch (type)
+    {
+        case ObjectType::EventBlock:
+            return "Event";
+        case ObjectType::MetadataBlock:
+            return "Metadata";
+        case ObjectType::StackBlock:
+            return "Stack";
+        case ObjectType::SequencePointBlock:
+            return "SequencePoint";
 
+        default:
+            return "Unknown";
+    }
 }
 
-
-bool EventPipeSession::ExtractBlock(const char* blockName, uint32_t& blockSize, uint64_t& blockOriginInFile)
+bool EventPipeSession::ExtractBlock(const char* blockName, FramedBlock& block)
 {
     // get the block size
+    uint32_t blockSize = 0;
     if (!ReadBlockSize(blockName, blockSize))
         return false;
 
     // skip the block + final EndOfObject tag
     blockSize++;
+    block.BlockSize = blockSize;
 
-    // check if it is needed to resize the block buffer
-    if (_blockSize < blockSize)
+    // keep track of the current position in file for padding
+    block.OriginInFile = _position;
+
+    // no need to copy the block if it is already in memory (i.e. memory mapped recording)
+    if (_pEndpoint->CanReadInPlace())
     {
-        // don't expect blocks larger than 100KB
-        if (blockSize > MAX_BLOCK_SIZE)
+        block.pBuffer = nullptr;
+        block.BufferSize = 0;
+        if (!_pEndpoint->ReadInPlace(blockSize, block.pBlock))
+        {
+            Error = ::GetLastError();
+            LOG_ERROR("Error while extracting " << blockName << " block: 0x" << std::hex << Error << std::dec << "\n");
             return false;
+        }
+        _position += blockSize;
 
-        delete [] _pBlock;
-        _pBlock = new uint8_t[blockSize];
-        ::ZeroMemory(_pBlock, blockSize);
-        _blockSize = blockSize;
+        // the worker threads need the bytes to stay valid after the next read
+        if (_decodingThreadsCount > 0)
+        {
+            block.pBuffer = _bufferPool.Acquire(blockSize, block.BufferSize);
+            if (block.pBuffer == nullptr)
+            {
+                LOG_ERROR("Impossible to allocate " << blockSize << " bytes for " << blockName << " block\n");
+                _hasFailed = true;
+                return false;
+            }
+            memcpy(block.pBuffer, block.pBlock, blockSize);
+            block.pBlock = block.pBuffer;
+        }
+
+        return true;
     }
 
-    // keep track of the current position in file for padding
-    blockOriginInFile = _position;
-    if (!Read(_pBlock, blockSize))
+    // reuse a buffer already parsed by the parser thread if possible
+    block.pBuffer = _bufferPool.Acquire(blockSize, block.BufferSize);
+    if (block.pBuffer == nullptr)
+    {
+        LOG_ERROR("Impossible to allocate " << blockSize << " bytes for " << blockName << " block\n");
+        _hasFailed = true;
+        return false;
+    }
+    block.pBlock = block.pBuffer;
+    if (!Read(block.pBuffer, blockSize))
     {
         Error = ::GetLastError();
-        std::cout << "Error while extracting " << blockName << " block: 0x" << std::hex << Error << std::dec << "\n";
+        LOG_ERROR("Error while extracting " << blockName << " block: 0x" << std::hex << Error << std::dec << "\n");
+        _bufferPool.Release(block.pBuffer, block.BufferSize);
         return false;
     }
-    std::cout << "\n" << blockName << " block (" << blockSize << " bytes)\n";
-    //DumpBuffer(_pBlock, blockSize);
 
     return true;
 }
@@ -420,16 +1145,24 @@ bool EventPipeSession::SkipBlock(const char* blockName)
 
     // skip the block + final EndOfObject tag
     blockSize++;
-    uint8_t* pBuffer = new uint8_t[blockSize];
+    uint32_t bufferSize = 0;
+    uint8_t* pBuffer = _bufferPool.Acquire(blockSize, bufferSize);
+    if (pBuffer == nullptr)
+    {
+        LOG_ERROR("Impossible to allocate " << blockSize << " bytes for " << blockName << " block\n");
+        _hasFailed = true;
+        return false;
+    }
     if (!Read(pBuffer, blockSize))
     {
         Error = ::GetLastError();
-        std::cout << "Error while reading " << blockName << " block: 0x" << std::hex << Error << std::dec << "\n";
+        LOG_ERROR("Error while reading " << blockName << " block: 0x" << std::hex << Error << std::dec << "\n");
+        _bufferPool.Release(pBuffer, bufferSize);
         return false;
     }
-    std::cout << "\n" << blockName << " block (" << blockSize << " bytes)\n";
+    LOG_VERBOSE("\n" << blockName << " block (" << blockSize << " bytes)\n");
     //DumpBuffer(pBuffer, blockSize);
-    delete[] pBuffer;
+    _bufferPool.Release(pBuffer, bufferSize);
 
     return true;
 }
@@ -441,8 +1174,8 @@ bool EventPipeSession::SkipBytes(DWORD byteCount)
     auto success = Read(pBuffer, byteCount);
     if (success)
     {
-        std::cout << "skip " << byteCount << " bytes\n";
-        DumpBuffer(pBuffer, byteCount);
+        LOG_VERBOSE("skip " << byteCount << " bytes\n");
+        LOG_VERBOSE_DUMP(DumpBuffer(pBuffer, byteCount));
     }
 
     return success;
@@ -476,7 +1209,7 @@ bool EventPipeSession::ReadHeader()
     if (!Read(&header, sizeof(header)))
     {
         Error = ::GetLastError();
-        std::cout << "Error while reading Nettrace header: 0x" << std::hex << Error << std::dec << "\n";
+        LOG_ERROR("Error while reading Nettrace header: 0x" << std::hex << Error << std::dec << "\n");
         return false;
     }
 
@@ -489,7 +1222,7 @@ bool EventPipeSession::ReadTraceObjectHeader()
     if (!Read(&header, sizeof(header)))
     {
         Error = ::GetLastError();
-        std::cout << "Error while reading Trace Object header: 0x" << std::hex << Error << std::dec << "\n";
+        LOG_ERROR("Error while reading Trace Object header: 0x" << std::hex << Error << std::dec << "\n");
         return false;
     }
 
@@ -501,7 +1234,7 @@ bool EventPipeSession::ReadObjectFields(ObjectFields& objectFields)
     if (!Read(&objectFields, sizeof(objectFields)))
     {
         Error = ::GetLastError();
-        std::cout << "Error while reading Object fields: 0x" << std::hex << Error << std::dec << "\n";
+        LOG_ERROR("Error while reading Object fields: 0x" << std::hex << Error << std::dec << "\n");
         return false;
     }
 
@@ -518,7 +1251,7 @@ bool EventPipeSession::SkipPadding()
         if (!Read(padding, paddingLength))
         {
             Error = ::GetLastError();
-            std::cout << "Error while skipping padding (" << paddingLength << " bytes): 0x" << std::hex << Error << std::dec << "\n";
+            LOG_ERROR("Error while skipping padding (" << paddingLength << " bytes): 0x" << std::hex << Error << std::dec << "\n");
             return false;
         }
     }
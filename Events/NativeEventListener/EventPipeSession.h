@@ -1,20 +1,30 @@
 #pragma once
 
+#include <atomic>
 #include <unordered_map>
 #include <vector>
 #include <string>
 
+#include "BlockQueue.h"
 #include "IIpcEndpoint.h"
 #include "NettraceFormat.h"
 
 #include "BlockParser.h"
+#include "ParallelEventDecoder.h"
 
 
-class EventCacheThread
+// successive parts of the nettrace stream
+enum class FramingState : uint8_t
 {
-public:
-    uint32_t SequenceNumber;
-    uint64_t LastCachedEventTimestamp;
+    StartResponse,      // only if the start command was sent without waiting for its response
+    StartResponsePayload,
+    NettraceHeader,
+    TraceObjectHeader,
+    TraceObjectFields,  // + EndObject tag
+    ObjectHeader,
+    ObjectName,         // + EndObject tag + block size
+    Padding,
+    Block,              // + EndObject tag
 };
 
 
@@ -29,6 +39,70 @@ public:
     bool Listen();
     bool Stop();
 
+    // listening driven by an event loop (see EventPipeSessionHost) instead of Listen():
+    // OnReadAvailable() is called each time the endpoint read event/descriptor is signaled
+    // and returns false when the session is over; EndListening() then returns what Listen() would
+    bool CanListenAsync();
+    IIpcEndpoint* GetEndpoint() { return _pEndpoint; }
+    bool OnReadAvailable();
+    bool EndListening();
+
+    // the stream could not be framed or parsed: unlike Listen() returning false,
+    // this is not set when the EventPipe is simply disconnected
+    bool HasFailed() { return _hasFailed; }
+
+    // the EventPipe start command has been sent without waiting for its response (see ReversedDiagnosticsServer):
+    // the response is received by OnReadAvailable() before the nettrace stream and gives the SessionId
+    // Note: must be called before the session is listened to
+    void ExpectStartResponse();
+
+    // decode the EventBlocks with that many worker threads (0 = in the listening thread)
+    // Note: must be called before Listen()
+    void SetDecodingThreadsCount(uint32_t count);
+
+    // deliver the events in timestamp order instead of stream order: they are buffered
+    // until the next sequence point (or until maxBufferedBytes are buffered)
+    // Note: must be called before Listen()
+    void EnableEventOrdering(uint32_t maxBufferedBytes = DefaultMaxOrderedBytes);
+
+    // skip the payload of these events while the parser lags behind the reader thread
+    // (i.e. too many blocks are waiting) or behind the pipe when hosted (i.e. the reads keep
+    // completing immediately) instead of letting the runtime drop any event
+    // Note: must be called before listening; the GC and contention events are never skipped
+    bool EnableDegradedMode(const std::vector<ProviderEventId>& lowPriorityEvents = { { L"Microsoft-Windows-DotNETRuntime", EventIDs::AllocationTick } });
+
+    // decode the events without a dedicated handler from their metadata fields description
+    // Note: must be called before Listen()
+    void SetGenericEventHandler(IGenericEventHandler* pHandler);
+
+    // decode the compressed headers of all the parsers this way (see HeaderDecodingSettings)
+    // Note: must be called before Listen()
+    void SetHeaderDecoding(const HeaderDecodingSettings& settings);
+
+    // receive the decoded CLR events (see EventListener.h for the virtual and static dispatch)
+    // Note: must be called before Listen()
+    template <class TListener>
+    void SetEventListener(TListener* pListener)
+    {
+        SetEventParser(new ListenedEventParser<TListener>(_metadata, _lossTracker, _statistics, pListener));
+    }
+
+    // can be called from any thread while listening
+    void GetBlockQueueStatistics(BlockQueueStatistics& stats);
+    void GetBufferPoolStatistics(BlockBufferPoolStatistics& stats);
+    void GetDecoderStatistics(DecoderStatistics& stats);
+    void GetOrderingStatistics(OrderingStatistics& stats);
+    void GetDegradedModeStatistics(DegradedModeStatistics& stats);
+    void GetStatistics(SessionStatisticsSnapshot& snapshot);
+    uint64_t GetSkippedEventsCount(const std::wstring& providerName, uint32_t eventId);
+
+    // Note: only meaningful once Listen() has returned
+    uint64_t GetHeaderMismatchesCount();
+
+    // events dropped by the runtime, updated at each sequence point
+    void GetEventLossStatistics(EventLossStatistics& stats);
+    void GetThreadsEventLoss(std::vector<ThreadEventLoss>& threads);
+
 public:
     DWORD Error;
     int _pid;
@@ -37,6 +111,9 @@ public:
 private:
     EventPipeSession();
 
+    // keep the orderer, the backpressure policy, the generic handler and the header decoding already set
+    void SetEventParser(EventParser* pParser);
+
     // helper functions that keep track of the current position
     // since the beginning of the "file"
     bool Read(LPVOID buffer, DWORD bufferSize);
@@ -49,13 +126,26 @@ private:
     bool ReadObjectFields(ObjectFields& objectFields);
     bool ReadNextObject();
     ObjectType GetObjectType(ObjectHeader& header);
-
-    bool ParseStackBlock(ObjectHeader& header);
-    bool ParseMetadataBlock(ObjectHeader& header);
-    bool ParseEventBlock(ObjectHeader& header);
-    bool ParseSequencePointBlock(ObjectHeader& header);
-
-    bool ExtractBlock(const char* blockName, uint32_t& blockSize, uint64_t& blockOriginInFile);
+    bool OnTraceObjectFields(ObjectFields& ofTrace);
+    void FlushDecoder(bool& success);
+    bool FlushOrderedEventsIfFull();
+
+    // rebuild the objects from the bytes received by OnReadAvailable()
+    bool Feed(const uint8_t* pBytes, DWORD size);
+    bool OnFrameReceived();
+    void ExpectFrame(FramingState state, uint8_t* pFrame, uint32_t frameSize);
+
+    // the reader thread extracts the blocks that are parsed by the listening thread
+    static DWORD WINAPI ReaderThreadProc(void* pParam);
+    void ReaderLoop();
+    bool ExtractNextBlock(FramedBlock& block);
+    bool ParseBlock(FramedBlock& block);
+    bool ProcessBlock(FramedBlock& block);
+    bool DeliverOldestBlock();
+    bool SendStopCommand();
+
+    const char* GetBlockName(ObjectType type);
+    bool ExtractBlock(const char* blockName, FramedBlock& block);
     bool ReadBlockSize(const char* blockName, uint32_t& blockSize);
 
     bool SkipBytes(DWORD byteCount);
@@ -66,30 +156,66 @@ private:
     bool Is64Bit;
     IIpcEndpoint* _pEndpoint;
     bool _stopRequested;
+    bool _hasFailed;    // set by the reader thread or the parser before Listen() returns
+    std::atomic<bool> _isDisconnected;  // the runtime has closed the EventPipe (set by the reader thread)
 
     // parsers
     MetadataParser _metadataParser;
-    EventParser _eventParser;
+    EventParser* _pEventParser;     // replaced by a ListenedEventParser when a listener is set
     StackParser _stackParser;
     SequencePointParser _sequencePointParser;
+    HeaderDecodingSettings _headerDecoding;
 
     // Keep track of the position since the beginning of the "file"
     // i.e. starting at 0 from the first character of the NettraceHeader
     //      Nettrace
     uint64_t _position;
 
-    // buffer used to read each block that will be then parsed
-    uint8_t* _pBlock;
-    uint32_t _blockSize;
+    // blocks read from the endpoint but not parsed yet
+    // (not used if the endpoint supports zero copy reads)
+    // Note: the pool must be declared first to be deleted after the queue
+    BlockBufferPool _bufferPool;
+    BlockQueue _blockQueue;
+
+    // EventBlocks decoding in parallel (if any)
+    uint32_t _decodingThreadsCount;
+    ParallelEventDecoder* _pDecoder;
+
+    // events delivered in timestamp order (if any)
+    EventOrderer* _pOrderer;
+
+    // low priority events skipped when the parser lags behind (if any)
+    BackpressurePolicy* _pBackpressurePolicy;
+
+    // events without a dedicated handler decoded from their metadata (if any)
+    IGenericEventHandler* _pGenericHandler;
+
+    // nettrace stream framing when listening asynchronously:
+    // the current frame is received into _pFrame (_frame or a block buffer)
+    FramingState _framingState;
+    uint8_t _frame[64];
+    uint8_t* _pFrame;
+    uint32_t _frameSize;
+    uint32_t _frameReceived;
+    FramedBlock _pendingBlock;
+    bool _isStartPending;
+
+    // reads that completed before the bytes of the previous one were parsed (kept across
+    // the OnReadAvailable calls when the reads are interrupted to serve the other sessions)
+    uint32_t _backToBackReadsCount;
 
     // per block header
     EventBlobHeader _blobHeader;
 
     // per thread event info
     std::unordered_map<uint64_t, EventCacheThread> _threads;
+    EventLossTracker _lossTracker;
+
+    // throughput and timings, readable from any thread
+    SessionStatistics _statistics;
 
     // per metadataID event metadata description
-    std::unordered_map<uint32_t, EventCacheMetadata> _metadata;
+    MetadataTable _metadata;
 
     // per stackID stack
     // only one will be used depending on the bitness of the monitored application
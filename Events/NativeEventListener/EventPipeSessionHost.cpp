@@ -0,0 +1,288 @@
+#include <iostream>
+
+#include "EventPipeSessionHost.h"
+#include "Log.h"
+
+
+// the first event of each loop is used to wake it up
+const uint32_t MaxSessionsPerLoop = MAXIMUM_WAIT_OBJECTS - 1;
+
+
+EventPipeSessionHost::EventPipeSessionHost(uint32_t threadsCount)
+    :
+    _threadsCount((threadsCount == 0) ? 1 : threadsCount)
+{
+    Error = 0;
+    _sessionsCount = 0;
+    _stopRequested = false;
+}
+
+EventPipeSessionHost::~EventPipeSessionHost()
+{
+    Stop();
+
+    for (auto pLoop : _loops)
+    {
+        ::CloseHandle(pLoop->hWakeEvent);
+        delete pLoop;
+    }
+    _loops.clear();
+}
+
+bool EventPipeSessionHost::Start()
+{
+    for (uint32_t i = 0; i < _threadsCount; i++)
+    {
+        EventLoop* pLoop = new EventLoop();
+        pLoop->pHost = this;
+        pLoop->hThread = nullptr;
+        pLoop->SessionsCount = 0;
+        ::InitializeSRWLock(&pLoop->Lock);
+        _loops.push_back(pLoop);
+
+        pLoop->hWakeEvent = ::CreateEvent(nullptr, FALSE, FALSE, nullptr);
+        if (pLoop->hWakeEvent == nullptr)
+        {
+            Error = ::GetLastError();
+            LOG_ERROR("Impossible to create the event loop wake event: 0x" << std::hex << Error << std::dec << "\n");
+            return false;
+        }
+
+        DWORD tid = 0;
+        pLoop->hThread = ::CreateThread(nullptr, 0, EventLoopThreadProc, pLoop, 0, &tid);
+        if (pLoop->hThread == nullptr)
+        {
+            Error = ::GetLastError();
+            LOG_ERROR("Impossible to start the event loop thread: 0x" << std::hex << Error << std::dec << "\n");
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool EventPipeSessionHost::Add(EventPipeSession* pSession, ISessionHostHandler* pHandler)
+{
+    if (!pSession->CanListenAsync())
+        return false;
+
+    return Post({ pSession, pHandler, nullptr });
+}
+
+bool EventPipeSessionHost::AddCommand(IIpcEndpoint* pEndpoint, uint64_t pid, ICommandResponseHandler* pHandler)
+{
+    if (!pEndpoint->CanReadAsync())
+        return false;
+
+    HostedCommand* pCommand = new HostedCommand();
+    pCommand->pEndpoint = pEndpoint;
+    pCommand->Pid = pid;
+    pCommand->pHandler = pHandler;
+    pCommand->Response = {};
+    pCommand->ReceivedBytes = 0;
+
+    if (!Post({ nullptr, nullptr, pCommand }))
+    {
+        delete pCommand;
+        return false;
+    }
+
+    return true;
+}
+
+bool EventPipeSessionHost::Post(const HostedSession& added)
+{
+    // the least busy loop gets the new session
+    EventLoop* pTarget = nullptr;
+    uint32_t minCount = MaxSessionsPerLoop;
+    for (auto pLoop : _loops)
+    {
+        if (pLoop->hThread == nullptr)
+            continue;
+
+        ::AcquireSRWLockExclusive(&pLoop->Lock);
+        uint32_t count = pLoop->SessionsCount;
+        ::ReleaseSRWLockExclusive(&pLoop->Lock);
+
+        if (count < minCount)
+        {
+            minCount = count;
+            pTarget = pLoop;
+        }
+    }
+
+    if (pTarget == nullptr)
+    {
+        LOG_ERROR("Too many sessions to listen to (" << _sessionsCount << ")\n");
+        return false;
+    }
+
+    ::AcquireSRWLockExclusive(&pTarget->Lock);
+    pTarget->AddedSessions.push_back(added);
+    pTarget->SessionsCount++;
+    ::ReleaseSRWLockExclusive(&pTarget->Lock);
+    _sessionsCount++;
+
+    Wake(*pTarget);
+    return true;
+}
+
+void EventPipeSessionHost::Stop()
+{
+    if (_stopRequested)
+        return;
+
+    _stopRequested = true;
+    for (auto pLoop : _loops)
+    {
+        if (pLoop->hThread == nullptr)
+            continue;
+
+        Wake(*pLoop);
+        ::WaitForSingleObject(pLoop->hThread, INFINITE);
+        ::CloseHandle(pLoop->hThread);
+        pLoop->hThread = nullptr;
+    }
+}
+
+DWORD WINAPI EventPipeSessionHost::EventLoopThreadProc(void* pParam)
+{
+    EventLoop* pLoop = static_cast<EventLoop*>(pParam);
+    pLoop->pHost->RunEventLoop(*pLoop);
+
+    return 0;
+}
+
+void EventPipeSessionHost::Wake(EventLoop& loop)
+{
+    ::SetEvent(loop.hWakeEvent);
+}
+
+// start to listen to the sessions added since the last wake up
+// Note: returns false if the host is stopping
+bool EventPipeSessionHost::TakeAddedSessions(EventLoop& loop)
+{
+    std::vector<HostedSession> sessions;
+    ::AcquireSRWLockExclusive(&loop.Lock);
+    sessions.swap(loop.AddedSessions);
+    ::ReleaseSRWLockExclusive(&loop.Lock);
+
+    for (auto& added : sessions)
+    {
+        loop.Sessions.push_back(added);
+
+        IIpcEndpoint* pEndpoint = (added.pSession != nullptr) ? added.pSession->GetEndpoint() : added.pCommand->pEndpoint;
+        loop.Events.push_back(pEndpoint->GetReadEvent());
+
+        // the bytes already received (i.e. the response to the start command) would not signal the loop
+        OnSessionSignaled(loop, loop.Sessions.size() - 1);
+    }
+
+    return !_stopRequested;
+}
+
+void EventPipeSessionHost::OnSessionSignaled(EventLoop& loop, size_t index)
+{
+    HostedSession& hosted = loop.Sessions[index];
+    bool isListening = (hosted.pSession != nullptr)
+        ? hosted.pSession->OnReadAvailable()
+        : OnCommandSignaled(*hosted.pCommand);
+
+    if (!isListening)
+    {
+        EndSession(loop, index);
+    }
+}
+
+// returns false when the response has been received (or the connection has been closed)
+bool EventPipeSessionHost::OnCommandSignaled(HostedCommand& command)
+{
+    while (command.pEndpoint->IsReadAvailable())
+    {
+        const uint8_t* pBytes = nullptr;
+        DWORD readBytes = 0;
+        if (!command.pEndpoint->ReadAvailable(pBytes, readBytes))
+            return false;
+
+        uint32_t count = sizeof(command.Response) - command.ReceivedBytes;
+        if (count > readBytes)
+            count = readBytes;
+
+        memcpy(reinterpret_cast<uint8_t*>(&command.Response) + command.ReceivedBytes, pBytes, count);
+        command.ReceivedBytes += count;
+        if (command.ReceivedBytes == sizeof(command.Response))
+            return false;
+    }
+
+    return true;
+}
+
+void EventPipeSessionHost::EndSession(EventLoop& loop, size_t index)
+{
+    HostedSession ended = loop.Sessions[index];
+    loop.Sessions.erase(loop.Sessions.begin() + index);
+    loop.Events.erase(loop.Events.begin() + index + 1);
+
+    ::AcquireSRWLockExclusive(&loop.Lock);
+    loop.SessionsCount--;
+    ::ReleaseSRWLockExclusive(&loop.Lock);
+    _sessionsCount--;
+
+    if (ended.pCommand != nullptr)
+    {
+        HostedCommand* pCommand = ended.pCommand;
+        bool isReceived = (pCommand->ReceivedBytes == sizeof(pCommand->Response));
+        pCommand->pHandler->OnCommandResponse(pCommand->pEndpoint, pCommand->Pid, isReceived ? &pCommand->Response : nullptr);
+        delete pCommand;
+        return;
+    }
+
+    bool isStopped = ended.pSession->EndListening();
+    ended.pHandler->OnSessionEnded(ended.pSession, isStopped);
+}
+
+void EventPipeSessionHost::RunEventLoop(EventLoop& loop)
+{
+    loop.Events.push_back(loop.hWakeEvent);
+
+    while (TakeAddedSessions(loop))
+    {
+        DWORD result = ::WaitForMultipleObjects((DWORD)loop.Events.size(), loop.Events.data(), FALSE, INFINITE);
+        if (result == WAIT_FAILED)
+        {
+            Error = ::GetLastError();
+            LOG_ERROR("Error while waiting for the sessions: 0x" << std::hex << Error << std::dec << "\n");
+            break;
+        }
+
+        size_t index = result - WAIT_OBJECT_0;
+        if ((index == 0) || (index >= loop.Events.size()))
+            continue;
+
+        // the lowest signaled index is returned so check all the next ones to avoid starving them
+        // Note: the sessions could end and be removed while iterating: the next session then
+        //       takes the same index and its event must be checked like the others
+        bool isSignaled = true;
+        for (size_t i = index; i < loop.Events.size(); )
+        {
+            if (isSignaled || (::WaitForSingleObject(loop.Events[i], 0) == WAIT_OBJECT_0))
+            {
+                isSignaled = false;
+
+                size_t count = loop.Sessions.size();
+                OnSessionSignaled(loop, i - 1);
+                if (loop.Sessions.size() < count)
+                    continue;
+            }
+
+            i++;
+        }
+    }
+
+    // end the sessions still being listened to
+    TakeAddedSessions(loop);
+    while (!loop.Sessions.empty())
+    {
+        EndSession(loop, loop.Sessions.size() - 1);
+    }
+}
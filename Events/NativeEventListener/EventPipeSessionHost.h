@@ -0,0 +1,116 @@
+#pragma once
+
+#include <atomic>
+#include <vector>
+
+#include "DiagnosticsProtocol.h"
+#include "EventPipeSession.h"
+
+
+// Notified when the EventPipe of a hosted session has been disconnected
+class ISessionHostHandler
+{
+public:
+    // called from an event loop thread: it is up to the handler to delete the session
+    // Note: isStopped is what Listen() would have returned
+    virtual void OnSessionEnded(EventPipeSession* pSession, bool isStopped) = 0;
+
+    virtual ~ISessionHostHandler() = default;
+};
+
+
+// Notified when the response to a command sent without waiting has been received
+class ICommandResponseHandler
+{
+public:
+    // called from an event loop thread: it is up to the handler to close and delete the endpoint
+    // Note: pResponse is null if the connection was closed before the response was received
+    virtual void OnCommandResponse(IIpcEndpoint* pEndpoint, uint64_t pid, const IpcHeader* pResponse) = 0;
+
+    virtual ~ICommandResponseHandler() = default;
+};
+
+
+// Listen to many sessions (one per monitored process) from a small fixed set of threads instead of
+// one thread blocked in Listen() per session. Each thread runs an event loop waiting for the endpoints
+// read to complete (WaitForMultipleObjects on their overlapped read event) and feeds the received
+// bytes to the sessions that rebuild the nettrace objects without blocking.
+class EventPipeSessionHost
+{
+public:
+    EventPipeSessionHost(uint32_t threadsCount = DefaultHostThreadsCount);
+    ~EventPipeSessionHost();
+
+    bool Start();
+
+    // the session is listened to until its EventPipe is disconnected and the handler is then notified
+    // Note: returns false if the endpoint does not support asynchronous reads or if all loops are full
+    bool Add(EventPipeSession* pSession, ISessionHostHandler* pHandler);
+
+    // the response to the command already sent on the endpoint is received by an event loop
+    // instead of blocking the caller and the handler is then notified
+    // Note: the response payload (if any) is ignored; without any command sent, the handler is only
+    //       notified when the connection is closed (i.e. the spare connections of the runtimes)
+    bool AddCommand(IIpcEndpoint* pEndpoint, uint64_t pid, ICommandResponseHandler* pHandler);
+
+    // the sessions still listened to are ended without waiting for their EventPipe to be disconnected
+    void Stop();
+
+    uint32_t GetSessionsCount() const { return _sessionsCount; }
+
+public:
+    DWORD Error;
+
+    static const uint32_t DefaultHostThreadsCount = 4;
+
+private:
+    // command waiting for its response
+    struct HostedCommand
+    {
+        IIpcEndpoint* pEndpoint;
+        uint64_t Pid;
+        ICommandResponseHandler* pHandler;
+        IpcHeader Response;
+        uint32_t ReceivedBytes;
+    };
+
+    // either a session or a command (pSession is null)
+    struct HostedSession
+    {
+        EventPipeSession* pSession;
+        ISessionHostHandler* pHandler;
+        HostedCommand* pCommand;
+    };
+
+    struct EventLoop
+    {
+        EventPipeSessionHost* pHost;
+        HANDLE hThread;
+
+        // sessions added by other threads but not yet listened to by the loop
+        SRWLOCK Lock;
+        std::vector<HostedSession> AddedSessions;
+        uint32_t SessionsCount;
+
+        // only accessed by the loop thread
+        std::vector<HostedSession> Sessions;
+
+        HANDLE hWakeEvent;
+        std::vector<HANDLE> Events;  // wake event + one read event per session
+    };
+
+    static DWORD WINAPI EventLoopThreadProc(void* pParam);
+    void RunEventLoop(EventLoop& loop);
+    void Wake(EventLoop& loop);
+    bool Post(const HostedSession& added);
+    bool TakeAddedSessions(EventLoop& loop);
+    void OnSessionSignaled(EventLoop& loop, size_t index);
+    bool OnCommandSignaled(HostedCommand& command);
+    void EndSession(EventLoop& loop, size_t index);
+
+private:
+    uint32_t _threadsCount;
+    std::vector<EventLoop*> _loops;
+    std::atomic<uint32_t> _sessionsCount;
+    std::atomic<bool> _stopRequested;
+};
@@ -2,36 +2,332 @@
 #include <exception>
 #include <Windows.h>
 #include "FileRecorder.h"
+#include "Log.h"
 
-FileRecorder::FileRecorder(const wchar_t* filename)
+FileRecorder::FileRecorder(const wchar_t* filename, DWORD bufferSize)
 {
     _hFile = ::CreateFile(filename, GENERIC_WRITE, FILE_SHARE_READ, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
     if (_hFile == INVALID_HANDLE_VALUE)
     {
         throw std::exception("Impossible to create file...");
     }
+
+    // round the size up to a power of 2 to wrap positions with a mask
+    _bufferSize = RecorderBatchSize;
+    while (_bufferSize < bufferSize)
+    {
+        _bufferSize <<= 1;
+    }
+    _pBuffer = new uint8_t[(size_t)_bufferSize];
+
+    _writePos = 0;
+    _readPos = 0;
+    _stopRequested = false;
+    _hasFailed = false;
+
+    ::InitializeSRWLock(&_overflowLock);
+    _overflowSize = 0;
+    _isTruncated = false;
+
+    _maxBytesPending = 0;
+    _batchCount = 0;
+    _syncCount = 0;
+    _lastFlushLatencyUs = 0;
+    _maxFlushLatencyUs = 0;
+    _spillCount = 0;
+    _maxBytesSpilled = 0;
+    _bytesDropped = 0;
+
+    _hDataEvent = ::CreateEvent(nullptr, FALSE, FALSE, nullptr);
+    DWORD tid = 0;
+    _hWriterThread = (_hDataEvent != nullptr) ? ::CreateThread(nullptr, 0, WriterThreadProc, this, 0, &tid) : nullptr;
+    if (_hWriterThread == nullptr)
+    {
+        // nothing would ever be written from the circular buffer
+        auto error = ::GetLastError();
+        LOG_ERROR("Impossible to start the recording thread (0x" << std::hex << error << std::dec << "): the stream is written synchronously\n");
+    }
 }
 
 FileRecorder::~FileRecorder()
 {
-    auto success = Close();
-    assert(success);
+    // could have been closed by the owner to get the final statistics
+    if (_hFile != INVALID_HANDLE_VALUE)
+    {
+        auto success = Close();
+        assert(success);
+    }
+
+    delete [] _pBuffer;
+    if (_hDataEvent != nullptr)
+        ::CloseHandle(_hDataEvent);
 }
 
+// Called by the listener thread (the single producer)
 bool FileRecorder::Write(LPCVOID buffer, DWORD bufferSize)
+{
+    if (_hasFailed)
+        return false;
+
+    if (_hWriterThread == nullptr)
+        return WriteDirect(static_cast<const uint8_t*>(buffer), bufferSize);
+
+    // the stream is not recorded anymore but the session can continue
+    if (_isTruncated)
+    {
+        _bytesDropped += bufferSize;
+        return true;
+    }
+
+    const uint8_t* pSource = static_cast<const uint8_t*>(buffer);
+    uint64_t writePos = _writePos.load(std::memory_order_relaxed);
+
+    // never wait for the writer thread: what does not fit is kept aside
+    uint64_t freeSize = _bufferSize - (writePos - _readPos.load(std::memory_order_acquire));
+    if (bufferSize > freeSize)
+    {
+        Spill(pSource, bufferSize, writePos);
+        ::SetEvent(_hDataEvent);
+        return true;
+    }
+
+    while (bufferSize > 0)
+    {
+        // copy what fits before the end of the circular buffer
+        uint64_t offset = writePos & (_bufferSize - 1);
+        uint64_t size = bufferSize;
+        if (size > _bufferSize - offset)
+            size = _bufferSize - offset;
+
+        memcpy(&_pBuffer[offset], pSource, (size_t)size);
+        pSource += size;
+        bufferSize -= (DWORD)size;
+        writePos += size;
+
+        // publish the bytes to the writer thread
+        _writePos.store(writePos, std::memory_order_release);
+    }
+
+    uint64_t pending = writePos - _readPos.load(std::memory_order_relaxed);
+    if (pending > _maxBytesPending.load(std::memory_order_relaxed))
+        _maxBytesPending.store(pending, std::memory_order_relaxed);
+
+    // don't pay for a system call per Write: the writer thread also wakes up periodically
+    if (pending >= RecorderBatchSize)
+        ::SetEvent(_hDataEvent);
+
+    return true;
+}
+
+// Called by the listener thread when the circular buffer is full
+void FileRecorder::Spill(const uint8_t* pSource, DWORD size, uint64_t ringPosition)
+{
+    uint64_t overflowSize = _overflowSize.load(std::memory_order_relaxed) + size;
+    if (overflowSize > MaxRecorderOverflowSize)
+    {
+        _isTruncated = true;
+        _bytesDropped += size;
+        LOG_ERROR("The recording is truncated: the disk is too slow to keep up with the events\n");
+        return;
+    }
+
+    OverflowChunk chunk;
+    chunk.RingPosition = ringPosition;
+    chunk.Bytes.assign(pSource, pSource + size);
+
+    ::AcquireSRWLockExclusive(&_overflowLock);
+    _overflow.push_back(std::move(chunk));
+    _overflowSize += size;
+    ::ReleaseSRWLockExclusive(&_overflowLock);
+
+    _spillCount++;
+    if (overflowSize > _maxBytesSpilled.load(std::memory_order_relaxed))
+        _maxBytesSpilled.store(overflowSize, std::memory_order_relaxed);
+}
+
+// Called by the listener thread when there is no writer thread
+bool FileRecorder::WriteDirect(const uint8_t* pSource, DWORD size)
 {
     DWORD writtenBytes = 0;
-    auto success = ::WriteFile(_hFile, buffer, bufferSize, &writtenBytes, nullptr);
-    return (success && (writtenBytes == bufferSize));
+    if (!::WriteFile(_hFile, pSource, size, &writtenBytes, nullptr) || (writtenBytes != size))
+    {
+        _hasFailed = true;
+        return false;
+    }
+    _batchCount++;
+
+    // nothing is ever pending
+    _writePos += size;
+    _readPos += size;
+
+    return true;
+}
+
+DWORD WINAPI FileRecorder::WriterThreadProc(void* pParam)
+{
+    FileRecorder* pRecorder = static_cast<FileRecorder*>(pParam);
+    pRecorder->WriterLoop();
+
+    return 0;
+}
+
+void FileRecorder::WriterLoop()
+{
+    ULONGLONG lastSyncTime = ::GetTickCount64();
+    bool needSync = false;
+
+    while (true)
+    {
+        ::WaitForSingleObject(_hDataEvent, RecorderFlushIntervalMs);
+        bool isStopping = _stopRequested.load(std::memory_order_acquire);
+
+        LARGE_INTEGER frequency;
+        LARGE_INTEGER start;
+        LARGE_INTEGER end;
+        ::QueryPerformanceFrequency(&frequency);
+        ::QueryPerformanceCounter(&start);
+
+        // write all pending bytes
+        // Note: the position must be read before the overflow list so that the chunks spilled
+        //       after it are written after these bytes
+        uint64_t writePos = _writePos.load(std::memory_order_acquire);
+        bool hasWritten = false;
+        if (_overflowSize.load(std::memory_order_acquire) != 0)
+        {
+            if (!WriteOverflow())
+            {
+                _hasFailed = true;
+                return;
+            }
+
+            hasWritten = true;
+            needSync = true;
+        }
+
+        if (writePos > _readPos.load(std::memory_order_relaxed))
+        {
+            if (!WriteBatch(writePos))
+            {
+                _hasFailed = true;
+                return;
+            }
+
+            hasWritten = true;
+            needSync = true;
+        }
+
+        // group commit: sync all the batches written since the last sync at once
+        ULONGLONG now = ::GetTickCount64();
+        if (needSync && (isStopping || (now - lastSyncTime >= RecorderSyncIntervalMs)))
+        {
+            ::FlushFileBuffers(_hFile);
+            _syncCount++;
+            lastSyncTime = now;
+            needSync = false;
+            hasWritten = true;
+        }
+
+        if (hasWritten)
+        {
+            ::QueryPerformanceCounter(&end);
+            uint64_t latency = (uint64_t)((end.QuadPart - start.QuadPart) * 1000000 / frequency.QuadPart);
+            _lastFlushLatencyUs = latency;
+            if (latency > _maxFlushLatencyUs)
+                _maxFlushLatencyUs = latency;
+        }
+
+        // the listener does not write anymore: everything has been written
+        if (isStopping && (_readPos.load() == _writePos.load()) && (_overflowSize.load() == 0))
+            return;
+    }
+}
+
+// write [_readPos, end) into the file; at most 2 WriteFile calls due to the wrap around
+bool FileRecorder::WriteBatch(uint64_t end)
+{
+    uint64_t readPos = _readPos.load(std::memory_order_relaxed);
+    while (readPos < end)
+    {
+        uint64_t offset = readPos & (_bufferSize - 1);
+        uint64_t size = end - readPos;
+        if (size > _bufferSize - offset)
+            size = _bufferSize - offset;
+
+        DWORD writtenBytes = 0;
+        if (!::WriteFile(_hFile, &_pBuffer[offset], (DWORD)size, &writtenBytes, nullptr) || (writtenBytes != size))
+            return false;
+        _batchCount++;
+
+        readPos += size;
+
+        // give the space back to the listener
+        _readPos.store(readPos, std::memory_order_release);
+    }
+
+    return true;
+}
+
+// write the spilled chunks, each one after the bytes of the circular buffer that precede it
+bool FileRecorder::WriteOverflow()
+{
+    std::vector<OverflowChunk> chunks;
+    ::AcquireSRWLockExclusive(&_overflowLock);
+    chunks.swap(_overflow);
+    ::ReleaseSRWLockExclusive(&_overflowLock);
+
+    for (auto& chunk : chunks)
+    {
+        if (!WriteBatch(chunk.RingPosition))
+            return false;
+
+        DWORD writtenBytes = 0;
+        if (!::WriteFile(_hFile, chunk.Bytes.data(), (DWORD)chunk.Bytes.size(), &writtenBytes, nullptr) || (writtenBytes != chunk.Bytes.size()))
+            return false;
+        _batchCount++;
+
+        _overflowSize -= chunk.Bytes.size();
+    }
+
+    return true;
+}
+
+void FileRecorder::GetStatistics(RecorderStatistics& stats)
+{
+    uint64_t readPos = _readPos.load();
+    stats.BytesPending = _writePos.load() - readPos;
+    stats.MaxBytesPending = _maxBytesPending;
+    stats.BytesWritten = readPos;
+    stats.BatchCount = _batchCount;
+    stats.SyncCount = _syncCount;
+    stats.LastFlushLatencyUs = _lastFlushLatencyUs;
+    stats.MaxFlushLatencyUs = _maxFlushLatencyUs;
+    stats.SpillCount = _spillCount;
+    stats.MaxBytesSpilled = _maxBytesSpilled;
+    stats.BytesDropped = _bytesDropped;
 }
 
 bool FileRecorder::Close()
 {
     if (_hFile != INVALID_HANDLE_VALUE)
     {
+        // let the writer thread flush the pending bytes
+        _stopRequested = true;
+        if (_hWriterThread != nullptr)
+        {
+            ::SetEvent(_hDataEvent);
+            ::WaitForSingleObject(_hWriterThread, INFINITE);
+            ::CloseHandle(_hWriterThread);
+            _hWriterThread = nullptr;
+        }
+        else if (!_hasFailed)
+        {
+            ::FlushFileBuffers(_hFile);
+            _syncCount++;
+        }
+
         ::CloseHandle(_hFile);
         _hFile = INVALID_HANDLE_VALUE;
-        return true;
+        return !_hasFailed;
     }
 
     return false;
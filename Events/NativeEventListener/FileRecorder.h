@@ -1,17 +1,95 @@
 #pragma once
+#include <atomic>
+#include <vector>
 #include "IIpcRecorder.h"
+
+
+// Sizes used to batch the writes to the recording file
+const DWORD DefaultRecorderBufferSize = 16 * 1024 * 1024;   // same as the CLR circular buffer
+const DWORD RecorderBatchSize = 1024 * 1024;                // wake up the writer thread after 1 MB
+const DWORD RecorderFlushIntervalMs = 10;                   // ...or after 10 ms
+const DWORD RecorderSyncIntervalMs = 1000;                  // group commit: FlushFileBuffers at most once per second
+const uint64_t MaxRecorderOverflowSize = 256 * 1024 * 1024; // spilled bytes kept in memory while the disk is too slow
+
+// can be read from any thread while the recording is running
+struct RecorderStatistics
+{
+    uint64_t BytesPending;          // written by the listener but not yet by the writer thread
+    uint64_t MaxBytesPending;
+    uint64_t BytesWritten;          // written to the file
+    uint64_t BatchCount;            // number of WriteFile calls
+    uint64_t SyncCount;             // number of FlushFileBuffers calls
+    uint64_t LastFlushLatencyUs;    // duration of the last batch write (+ sync if any)
+    uint64_t MaxFlushLatencyUs;
+    uint64_t SpillCount;            // number of Write calls that did not fit in the circular buffer
+    uint64_t MaxBytesSpilled;       // peak size of the overflow list
+    uint64_t BytesDropped;          // not recorded because the overflow list was full
+};
+
+
+// The listener thread only copies the bytes into a lock-free single producer/single consumer
+// circular buffer; a dedicated thread writes them into the file by large batches so that
+// a slow disk does not prevent reading the diagnostics pipe.
+// The listener never waits for the writer thread: when the circular buffer is full, the bytes are
+// spilled into an overflow list that is written in stream order. If the overflow list also reaches
+// MaxRecorderOverflowSize, the recording is truncated (a hole would make it impossible to replay)
+// and the rest of the stream is dropped.
+// If the writer thread can't be started, the bytes are written by the listener thread instead.
 class FileRecorder :
     public IIpcRecorder
 {
 public:
-    FileRecorder(const wchar_t* filename);
+    FileRecorder(const wchar_t* filename, DWORD bufferSize = DefaultRecorderBufferSize);
     ~FileRecorder();
 
     virtual bool Write(LPCVOID buffer, DWORD bufferSize) override;
     virtual bool Close() override;
 
+    void GetStatistics(RecorderStatistics& stats);
+
+private:
+    static DWORD WINAPI WriterThreadProc(void* pParam);
+    void WriterLoop();
+    bool WriteBatch(uint64_t end);
+    bool WriteOverflow();
+    void Spill(const uint8_t* pSource, DWORD size, uint64_t ringPosition);
+    bool WriteDirect(const uint8_t* pSource, DWORD size);
 
 private:
     HANDLE _hFile;
+
+    // circular buffer (size is a power of 2)
+    uint8_t* _pBuffer;
+    uint64_t _bufferSize;
+
+    // monotonic positions: [_readPos, _writePos) are pending
+    std::atomic<uint64_t> _writePos;    // updated by the listener thread
+    std::atomic<uint64_t> _readPos;     // updated by the writer thread
+
+    HANDLE _hWriterThread;  // nullptr if the bytes are written by the listener thread
+    HANDLE _hDataEvent;
+    std::atomic<bool> _stopRequested;
+    std::atomic<bool> _hasFailed;
+
+    // bytes that did not fit in the circular buffer: written after the first RingPosition bytes of the buffer
+    struct OverflowChunk
+    {
+        uint64_t RingPosition;
+        std::vector<uint8_t> Bytes;
+    };
+    SRWLOCK _overflowLock;
+    std::vector<OverflowChunk> _overflow;
+    std::atomic<uint64_t> _overflowSize;
+    std::atomic<bool> _isTruncated;
+
+    // statistics
+    std::atomic<uint64_t> _maxBytesPending;
+    std::atomic<uint64_t> _batchCount;
+    std::atomic<uint64_t> _syncCount;
+    std::atomic<uint64_t> _lastFlushLatencyUs;
+    std::atomic<uint64_t> _maxFlushLatencyUs;
+    std::atomic<uint64_t> _spillCount;
+    std::atomic<uint64_t> _maxBytesSpilled;
+    std::atomic<uint64_t> _bytesDropped;
 };
 
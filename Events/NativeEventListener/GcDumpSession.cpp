@@ -1,10 +1,25 @@
 #include "GcDumpSession.h"
 
-GcDumpSession::GcDumpSession(int pid)
+GcDumpSession::GcDumpSession(int pid, EventPipeSessionHost* pHost)
 {
     _pid = pid;
     _pClient = nullptr;
+    _pSession = nullptr;
+    _pHost = pHost;
     _hListenerThread = nullptr;
+    _hEndedEvent = ::CreateEvent(nullptr, TRUE, FALSE, nullptr);
+}
+
+GcDumpSession::~GcDumpSession()
+{
+    StopDump();
+    ::CloseHandle(_hEndedEvent);
+}
+
+// called by the host event loop when the EventPipe is disconnected
+void GcDumpSession::OnSessionEnded(EventPipeSession* pSession, bool isStopped)
+{
+    ::SetEvent(_hEndedEvent);
 }
 
 DWORD WINAPI ListenToGCDumpEvents(void* pParam)
@@ -25,12 +40,21 @@ void GcDumpSession::StopDump()
 
     _pSession->Stop();
 
+    // the session can't be deleted while its events are still being listened to
+    if (_hListenerThread != nullptr)
+    {
+        ::WaitForSingleObject(_hListenerThread, INFINITE);
+        ::CloseHandle(_hListenerThread);
+        _hListenerThread = nullptr;
+    }
+    else
+    {
+        ::WaitForSingleObject(_hEndedEvent, INFINITE);
+    }
+
     delete _pSession;
     _pSession = nullptr;
 
-    ::CloseHandle(_hListenerThread);
-    _hListenerThread = nullptr;
-
     delete _pClient;
     _pClient = nullptr;
 }
@@ -55,9 +79,15 @@ bool GcDumpSession::TriggerDump()
     if (_pSession == nullptr)
     {
         delete _pClient;
+        _pClient = nullptr;
         return false;
     }
 
+    // no need for another thread if the events can be listened to by the host
+    ::ResetEvent(_hEndedEvent);
+    if ((_pHost != nullptr) && _pHost->Add(_pSession, this))
+        return true;
+
     DWORD tid = 0;
     _hListenerThread = ::CreateThread(nullptr, 0, ListenToGCDumpEvents, _pSession, 0, &tid);
 
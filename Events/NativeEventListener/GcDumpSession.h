@@ -1,19 +1,25 @@
 #pragma once
 
 #include "DiagnosticsClient.h"
+#include "EventPipeSessionHost.h"
 
-class GcDumpSession
+class GcDumpSession : public ISessionHostHandler
 {
 public:
-    GcDumpSession(int pid);
+    // the events are listened to by the given host if any or by a dedicated thread otherwise
+    GcDumpSession(int pid, EventPipeSessionHost* pHost = nullptr);
+    ~GcDumpSession();
 
     bool TriggerDump();
     void StopDump();  // TODO: should be automatic but how to notify the caller that the "gcdump" is over?
 
+    void OnSessionEnded(EventPipeSession* pSession, bool isStopped) override;
+
 private:
     int _pid;
     DiagnosticsClient* _pClient;
     EventPipeSession* _pSession;
+    EventPipeSessionHost* _pHost;
     HANDLE _hListenerThread;
+    HANDLE _hEndedEvent;
 };
-
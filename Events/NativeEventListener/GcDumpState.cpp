@@ -6,7 +6,7 @@
 
 GcDumpState::GcDumpState()
     :
-    _types(1024)
+    _typeIndexes(1024)
 {
     _isStarted = false;
     _hasEnded = false;
@@ -16,6 +16,7 @@ GcDumpState::GcDumpState()
 GcDumpState::~GcDumpState()
 {
     _types.clear();
+    _typeIndexes.clear();
 }
 
 void GcDumpState::DumpHeap()
@@ -24,19 +25,14 @@ void GcDumpState::DumpHeap()
     std::cout << std::endl << "Live heap dump" << std::endl;
     std::cout << "---------------------------------------------------------" << std::endl;
     std::cout << "    Count        Size  Type" << std::endl;
-    for (auto& type : _types)
+    for (auto& typeInfo : _types)
     {
-        auto typeInfo = type.second;
-        auto name = typeInfo._name;
-
-        uint64_t instancesCount = typeInfo._instances.size();
-        uint64_t instancesSize = 0;
-        for (size_t i = 0; i < instancesCount; i++)
-        {
-            instancesSize += typeInfo._instances[i]._size;
-        }
-        std::cout << std::setfill(' ') << std::setw(9) << instancesCount << std::setw(12) << instancesSize << "  " << typeInfo._name << std::endl;
+        std::cout << std::setfill(' ') << std::setw(9) << typeInfo._instancesCount << std::setw(12) << typeInfo._instancesSize << "  " << typeInfo._name << std::endl;
     }
+    std::cout << _objects.GetCount() << " objects stored in " << _objects.GetMemorySize() / 1024 << " KB" << std::endl;
+    std::cout << _graph.GetEdgesCount() << " references (" << _graph.GetUnresolvedEdgesCount() << " unresolved) stored in "
+        << _graph.GetMemorySize() / 1024 << " KB" << (_graph.IsTruncated() ? " (truncated)" : "")
+        << (_graph.AreEdgesDropped() ? " (dropped after a malformed BulkEdge event)" : "") << std::endl;
 }
 
 void GcDumpState::OnGcStart(uint32_t index, uint32_t generation, GCReason reason, GCType type)
@@ -44,7 +40,14 @@ void GcDumpState::OnGcStart(uint32_t index, uint32_t generation, GCReason reason
     if ((generation == 2) && (reason == GCReason::Induced) && (type == GCType::NonConcurrentGC))
     {
         _isStarted = true;
+        _hasEnded = false;
         _collectionIndex = index;
+
+        // nothing is kept from the previous dump (if any): the types are sent again
+        _types.clear();
+        _typeIndexes.clear();
+        _objects.Clear();
+        _graph.Clear();
     }
 }
 
@@ -60,6 +63,10 @@ void GcDumpState::OnGcEnd(uint32_t index, uint32_t generation)
         _isStarted = false;
         _hasEnded = true;
 
+        // all the nodes and edges have been received
+        _objects.ShrinkToFit();
+        _graph.Build(_objects);
+
         DumpHeap();
     }
 }
@@ -71,27 +78,92 @@ void GcDumpState::OnTypeMapping(uint64_t id, uint32_t nameId, std::string name)
         return;
     }
 
+    // a type could be received again: keep its index (and instances)
+    auto entry = _typeIndexes.find(id);
+    if (entry != _typeIndexes.end())
+    {
+        _types[entry->second].SetName(name);
+        return;
+    }
+
     TypeInfo info;
     info.SetId(id);
     info.SetName(name);
-    _types[id] = info;
+    _typeIndexes[id] = (uint32_t)_types.size();
+    _types.push_back(info);
 }
 
-bool GcDumpState::AddLiveObject(uint64_t address, uint64_t typeId, uint64_t size)
+TypeInfo* GcDumpState::FindType(uint64_t typeId, uint32_t& typeIndex)
+{
+    auto entry = _typeIndexes.find(typeId);
+    if (entry == _typeIndexes.end())
+    {
+        return nullptr;
+    }
+
+    typeIndex = entry->second;
+    return &_types[typeIndex];
+}
+
+bool GcDumpState::AddLiveObject(uint64_t address, uint64_t typeId, uint64_t size, uint64_t edgeCount)
 {
     if (!_isStarted)
     {
         return false;
     }
 
-    auto entry = _types.find(typeId);
-    if (entry == _types.end())
+    // the object is kept even if its type is unknown so that the nodes of the graph
+    // stay aligned with the objects
+    _graph.AddNode(edgeCount);
+
+    uint32_t typeIndex;
+    TypeInfo* pType = FindType(typeId, typeIndex);
+    if (pType == nullptr)
     {
         // this should never happen
+        _objects.Add(address, LiveObjectStore::UnknownType, size);
         return false;
     }
 
-    entry->second.AddInstance(address, size);
+    pType->AddInstance(size);
+    _objects.Add(address, typeIndex, size);
+    return true;
+}
+
+bool GcDumpState::AddLiveObjects(const BulkNodeBatch& batch)
+{
+    if (!_isStarted)
+    {
+        return false;
+    }
+
+    _graph.AddNodes(batch.EdgeCounts.data(), batch.GetCount());
+
+    // the nodes of the same type are often consecutive in a BulkNode event
+    // so the type is looked up only when it changes
+    uint64_t lastTypeId = 0;
+    uint32_t typeIndex = 0;
+    TypeInfo* pType = nullptr;
+    for (uint32_t i = 0; i < batch.GetCount(); i++)
+    {
+        uint64_t typeId = batch.TypeIds[i];
+        if ((i == 0) || (typeId != lastTypeId))
+        {
+            lastTypeId = typeId;
+            pType = FindType(typeId, typeIndex);
+        }
+
+        if (pType == nullptr)
+        {
+            // this should never happen
+            _objects.Add(batch.Addresses[i], LiveObjectStore::UnknownType, batch.Sizes[i]);
+            continue;
+        }
+
+        pType->AddInstance(batch.Sizes[i]);
+        _objects.Add(batch.Addresses[i], typeIndex, batch.Sizes[i]);
+    }
+
     return true;
 }
 
@@ -4,7 +4,9 @@
 #include <unordered_map>
 #include <vector>
 
-#include "LiveObject.h"
+#include "BulkNodeBatch.h"
+#include "HeapGraph.h"
+#include "LiveObjectStore.h"
 #include "TypeInfo.h"
 
 
@@ -46,14 +48,51 @@ public:
     void OnGcStart(uint32_t index, uint32_t generation, GCReason reason, GCType type);
     void OnGcEnd(uint32_t index, uint32_t generation);
     void OnTypeMapping(uint64_t id, uint32_t nameId, std::string name);
-    bool AddLiveObject(uint64_t address, uint64_t typeId, uint64_t size);
+    bool AddLiveObject(uint64_t address, uint64_t typeId, uint64_t size, uint64_t edgeCount);
+    bool AddLiveObjects(const BulkNodeBatch& batch);
+
+    // the edges of the nodes in the same order as the nodes (see HeapGraph)
+    template <class TPointer>
+    void AddEdges(const uint8_t* pEdges, uint32_t count)
+    {
+        if (!_isStarted)
+        {
+            return;
+        }
+
+        _graph.AddEdges<TPointer>(pEdges, count);
+    }
+
+    // a malformed BulkEdge event: the next edges cannot be matched to their node anymore
+    void OnInvalidEdges()
+    {
+        if (!_isStarted)
+        {
+            return;
+        }
+
+        _graph.DropEdges();
+    }
+
+    const LiveObjectStore& GetLiveObjects() const { return _objects; }
+    const HeapGraph& GetGraph() const { return _graph; }
+
+private:
+    // nullptr if the type is unknown
+    TypeInfo* FindType(uint64_t typeId, uint32_t& typeIndex);
 
 private:
     bool _isStarted;
     bool _hasEnded;
     uint32_t _collectionIndex;
 
-    //                 typeId    Name + list of instances
-    std::unordered_map<uint64_t, TypeInfo> _types;
+    // the objects refer to their type by its index in _types
+    std::vector<TypeInfo> _types;
+
+    //                 typeId    index in _types
+    std::unordered_map<uint64_t, uint32_t> _typeIndexes;
+
+    LiveObjectStore _objects;
+    HeapGraph _graph;
 };
 
@@ -0,0 +1,167 @@
+#include <algorithm>
+#include <string.h>
+
+#include "HeapGraph.h"
+
+
+HeapGraph::HeapGraph()
+{
+    _edgeStarts.push_back(0);
+    _unresolvedEdgesCount = 0;
+    _isTruncated = false;
+    _areEdgesDropped = false;
+    _isBuilt = false;
+}
+
+void HeapGraph::Clear()
+{
+    _edgeStarts.clear();
+    _edgeStarts.push_back(0);
+    _targetAddresses.clear();
+    _targets.clear();
+    _unresolvedEdgesCount = 0;
+    _isTruncated = false;
+    _areEdgesDropped = false;
+    _isBuilt = false;
+}
+
+void HeapGraph::DropEdges()
+{
+    _areEdgesDropped = true;
+    std::vector<uint64_t>().swap(_targetAddresses);
+}
+
+void HeapGraph::AddNode(uint64_t edgeCount)
+{
+    // once a node does not fit, the edges of the next ones would be matched to the wrong
+    // positions in the BulkEdge stream so none of them gets any edge
+    uint64_t end = _edgeStarts.back() + edgeCount;
+    if (_isTruncated || (end > MaxEdgesCount))
+    {
+        _isTruncated = true;
+        end = _edgeStarts.back();
+    }
+
+    _edgeStarts.push_back((uint32_t)end);
+}
+
+void HeapGraph::AddNodes(const uint64_t* pEdgeCounts, uint32_t count)
+{
+    _edgeStarts.reserve(_edgeStarts.size() + count);
+    for (uint32_t i = 0; i < count; i++)
+    {
+        AddNode(pEdgeCounts[i]);
+    }
+}
+
+template <class TPointer>
+void HeapGraph::AddEdges(const uint8_t* pEdges, uint32_t count)
+{
+    if (_areEdgesDropped)
+        return;
+
+    // the referencing field ID is not needed to know what retains an object
+    size_t first = _targetAddresses.size();
+    if (first + count > MaxEdgesCount)
+    {
+        _isTruncated = true;
+        count = (uint32_t)(MaxEdgesCount - first);
+    }
+
+    _targetAddresses.resize(first + count);
+    uint64_t* pTarget = _targetAddresses.data() + first;
+    for (uint32_t i = 0; i < count; i++)
+    {
+        TPointer address;
+        memcpy(&address, pEdges + (size_t)i * GetEdgeSize<TPointer>(), sizeof(address));
+        pTarget[i] = address;
+    }
+}
+
+template void HeapGraph::AddEdges<uint32_t>(const uint8_t* pEdges, uint32_t count);
+template void HeapGraph::AddEdges<uint64_t>(const uint8_t* pEdges, uint32_t count);
+
+void HeapGraph::Build(const LiveObjectStore& objects)
+{
+    if (_isBuilt)
+        return;
+
+    // (address, node) pairs sorted by address: the objects are listed by address order within
+    // each heap segment so the pairs are often already sorted
+    std::vector<uint64_t> addresses;
+    objects.GetAddresses(addresses);
+    uint32_t nodesCount = std::min((uint32_t)addresses.size(), GetNodesCount());
+
+    struct NodeAddress
+    {
+        uint64_t Address;
+        uint32_t Node;
+    };
+    std::vector<NodeAddress> sortedNodes(nodesCount);
+    for (uint32_t i = 0; i < nodesCount; i++)
+    {
+        sortedNodes[i] = { addresses[i], i };
+    }
+    auto isLower = [](const NodeAddress& left, const NodeAddress& right) { return left.Address < right.Address; };
+    if (!std::is_sorted(sortedNodes.begin(), sortedNodes.end(), isLower))
+    {
+        std::sort(sortedNodes.begin(), sortedNodes.end(), isLower);
+    }
+
+    // the searched keys are kept contiguous (8 bytes per node) for the binary searches
+    std::vector<uint32_t> nodes(nodesCount);
+    addresses.resize(nodesCount);
+    for (uint32_t i = 0; i < nodesCount; i++)
+    {
+        addresses[i] = sortedNodes[i].Address;
+        nodes[i] = sortedNodes[i].Node;
+    }
+    std::vector<NodeAddress>().swap(sortedNodes);
+
+    // the unresolved edges are removed so the node ranges are rebuilt while resolving
+    // Note: the edges that were not received are considered unresolved
+    uint32_t receivedCount = (uint32_t)std::min<size_t>(_targetAddresses.size(), MaxEdgesCount);
+    _targets.reserve(std::min(receivedCount, _edgeStarts[nodesCount]));
+    _unresolvedEdgesCount = 0;
+    for (uint32_t node = 0; node < nodesCount; node++)
+    {
+        uint32_t start = _edgeStarts[node];
+        uint32_t end = _edgeStarts[node + 1];
+        _edgeStarts[node] = (uint32_t)_targets.size();
+
+        for (uint32_t edge = start; edge < end; edge++)
+        {
+            if (edge >= receivedCount)
+            {
+                _unresolvedEdgesCount++;
+                continue;
+            }
+
+            uint64_t address = _targetAddresses[edge];
+            auto position = std::lower_bound(addresses.begin(), addresses.end(), address);
+            if ((position == addresses.end()) || (*position != address))
+            {
+                _unresolvedEdgesCount++;
+                continue;
+            }
+
+            _targets.push_back(nodes[position - addresses.begin()]);
+        }
+    }
+    _edgeStarts.resize(nodesCount + 1);
+    _edgeStarts[nodesCount] = (uint32_t)_targets.size();
+    _edgeStarts.shrink_to_fit();
+
+    // the target addresses are not needed anymore
+    std::vector<uint64_t>().swap(_targetAddresses);
+    _targets.shrink_to_fit();
+    _isBuilt = true;
+}
+
+uint64_t HeapGraph::GetMemorySize() const
+{
+    return
+        _edgeStarts.capacity() * sizeof(uint32_t) +
+        _targetAddresses.capacity() * sizeof(uint64_t) +
+        _targets.capacity() * sizeof(uint32_t);
+}
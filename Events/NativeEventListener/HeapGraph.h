@@ -0,0 +1,72 @@
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+
+#include "LiveObjectStore.h"
+
+
+// References between the live objects of a gcdump in compressed sparse row form: the edges of node n
+// (i.e. the n-th object of the LiveObjectStore) are the targets stored in [EdgeStarts[n], EdgeStarts[n+1]).
+// The CLR sends the EdgeCount of each node in the BulkNode events and then the target address of
+// all the edges, in the same node order, in the BulkEdge events (split at any point):
+//  - the node ranges are the running sum of the EdgeCount
+//  - the target addresses are kept until the end of the dump and then resolved to node indexes
+//    through a sorted address index (the edges to objects that were not listed are dropped)
+// Since the edges are only matched to their node by position, the nodes after the first one
+// whose edges do not fit anymore get no edge and a malformed BulkEdge event drops all the edges.
+// Each node costs 4 bytes and each edge 4 bytes once resolved (8 bytes before).
+class HeapGraph
+{
+public:
+    HeapGraph();
+
+    void Clear();
+
+    void AddNode(uint64_t edgeCount);
+    void AddNodes(const uint64_t* pEdgeCounts, uint32_t count);
+
+    // TPointer is uint32_t or uint64_t depending on the bitness of the monitored process
+    // Note: each edge is the target address (TPointer) followed by the referencing field ID (UInt32)
+    template <class TPointer>
+    void AddEdges(const uint8_t* pEdges, uint32_t count);
+
+    template <class TPointer>
+    static constexpr uint32_t GetEdgeSize() { return sizeof(TPointer) + sizeof(uint32_t); }
+
+    // the edges received so far cannot be matched to their node anymore
+    void DropEdges();
+
+    // resolve the target addresses into node indexes when all the nodes and edges have been received
+    void Build(const LiveObjectStore& objects);
+
+    bool IsBuilt() const { return _isBuilt; }
+    bool IsTruncated() const { return _isTruncated; }
+    bool AreEdgesDropped() const { return _areEdgesDropped; }
+    uint32_t GetNodesCount() const { return (uint32_t)_edgeStarts.size() - 1; }
+    uint32_t GetEdgesCount() const { return _isBuilt ? (uint32_t)_targets.size() : _edgeStarts.back(); }
+    uint32_t GetUnresolvedEdgesCount() const { return _unresolvedEdgesCount; }
+
+    // only valid after Build()
+    const uint32_t* GetEdges(uint32_t node, uint32_t& count) const
+    {
+        count = _edgeStarts[node + 1] - _edgeStarts[node];
+        return _targets.data() + _edgeStarts[node];
+    }
+
+    // bytes allocated for the nodes and edges (including the unused capacity of the vectors)
+    uint64_t GetMemorySize() const;
+
+public:
+    // the offsets are stored on 32 bit: the edges after 4 billions are ignored
+    static const uint32_t MaxEdgesCount = 0xFFFFFFFF;
+
+private:
+    std::vector<uint32_t> _edgeStarts;      // one more than the nodes count
+    std::vector<uint64_t> _targetAddresses; // freed by Build()
+    std::vector<uint32_t> _targets;         // node indexes
+    uint32_t _unresolvedEdgesCount;
+    bool _isTruncated;
+    bool _areEdgesDropped;
+    bool _isBuilt;
+};
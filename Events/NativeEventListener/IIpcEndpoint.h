@@ -13,6 +13,21 @@ public:
     virtual bool ReadDWord(uint32_t& dword) = 0;
     virtual bool ReadLong(uint64_t& ulong) = 0;
 
+    // Zero copy read: return a pointer to the next bufferSize bytes instead of copying them.
+    // Only supported by endpoints that already have the bytes in memory (i.e. memory mapped recording)
+    // Note: the bytes are only valid until the next read
+    virtual bool CanReadInPlace() { return false; }
+    virtual bool ReadInPlace(DWORD bufferSize, const uint8_t*& pBuffer) { return false; }
+
+    // Non blocking reads driven by an event loop (see EventPipeSessionHost) instead of Read:
+    // wait for the read event and then call ReadAvailable()
+    // as long as IsReadAvailable() returns true.
+    // Note: ReadAvailable() returns false at the end of the stream or in case of error
+    virtual bool CanReadAsync() { return false; }
+    virtual HANDLE GetReadEvent() { return nullptr; }
+    virtual bool IsReadAvailable() { return false; }
+    virtual bool ReadAvailable(const uint8_t*& pBytes, DWORD& readBytes) { return false; }
+
     virtual bool Close() = 0;
     virtual ~IIpcEndpoint() = default;
 };
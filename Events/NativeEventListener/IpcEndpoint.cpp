@@ -3,25 +3,56 @@
 #include "IpcEndpoint.h"
 
 
-// 2 buffers are allocated
-const uint16_t BufferSize = 2 * 1024;  // 2 KB
-
-IpcEndpoint::IpcEndpoint(IIpcRecorder* pRecorder)
+IpcEndpoint::IpcEndpoint(IIpcRecorder* pRecorder, DWORD bufferSize)
 {
+    // keep the buffer size in the supported range (0 = no buffering)
+    if (bufferSize != 0)
+    {
+        if (bufferSize < MinReadBufferSize)
+            bufferSize = MinReadBufferSize;
+        else
+        if (bufferSize > MaxReadBufferSize)
+            bufferSize = MaxReadBufferSize;
+    }
+
     _handle = 0;
-    _pCurrentBuffer = new uint8_t[BufferSize];
-    _pNextBuffer = new uint8_t[BufferSize];
+    _bufferSize = bufferSize;
+    _pCurrentBuffer = nullptr;
+    _pNextBuffer = nullptr;
+    if (_bufferSize != 0)
+    {
+        _pCurrentBuffer = new uint8_t[_bufferSize];
+        _pNextBuffer = new uint8_t[_bufferSize];
+    }
     _readBytes = 0;
     _pos = 0;
     _pRecorder = pRecorder;
+
+    _overlapped = {};
+    _hReadEvent = ::CreateEvent(nullptr, TRUE, FALSE, nullptr);
+    _hWriteEvent = ::CreateEvent(nullptr, TRUE, FALSE, nullptr);
+    _isReadPending = false;
+    _offset = 0;
+
+    _readCallsCount = 0;
+    _readBytesCount = 0;
 }
 
 IpcEndpoint::~IpcEndpoint()
 {
+    // the kernel must not write into the buffers after they are deleted
+    // Note: the derived classes are already destroyed so the base implementation is called
+    IpcEndpoint::CancelRawRead();
+
     if (_pCurrentBuffer != nullptr)
         delete [] _pCurrentBuffer;
     if (_pNextBuffer != nullptr)
         delete [] _pNextBuffer;
+
+    if (_hReadEvent != nullptr)
+        ::CloseHandle(_hReadEvent);
+    if (_hWriteEvent != nullptr)
+        ::CloseHandle(_hWriteEvent);
 }
 
 // from CLR diagnosticsprotocol.h
@@ -46,26 +77,160 @@ bool Parse(IpcEndpoint* pEndpoint, T& result)
 
 bool IpcEndpoint::Write(LPCVOID buffer, DWORD bufferSize, DWORD* writtenBytes)
 {
-    DWORD bytesWrittenCount = 0;
-
     // TODO: do we need to record what is sent?
-    return ::WriteFile(_handle, buffer, bufferSize, writtenBytes, nullptr);
+
+    // the handle is opened for overlapped I/O so wait for the write to complete
+    OVERLAPPED overlapped = {};
+    overlapped.hEvent = _hWriteEvent;
+    if (!::WriteFile(_handle, buffer, bufferSize, nullptr, &overlapped))
+    {
+        if (::GetLastError() != ERROR_IO_PENDING)
+            return false;
+    }
+
+    return ::GetOverlappedResult(_handle, &overlapped, writtenBytes, TRUE);
 }
 
-// TODO: add buffer management if performance it not good enough
-//       read from the file/pipe by 2 KB buffer and then read from the memory buffer when needed
+// The bytes are read from the pipe/file by large chunks into the current buffer and the Read helpers
+// are served from memory. When the current buffer is consumed, the next one (already being filled
+// by an asynchronous read) becomes the current one and a new read is started into the other buffer.
+// Note: only the bytes returned to the caller are recorded so the recording is the same as without buffering
 bool IpcEndpoint::Read(LPVOID buffer, DWORD bufferSize, DWORD* readBytes)
 {
     uint8_t* pBuffer = static_cast<uint8_t*>(buffer);
+    if (_bufferSize == 0)
+    {
+        return ReadDirect(pBuffer, bufferSize, readBytes);
+    }
+
     DWORD totalReadBytes = 0;
     while (totalReadBytes < bufferSize)
     {
-        DWORD readBytes = 0;
-        if (!::ReadFile(_handle, &(pBuffer[totalReadBytes]), bufferSize - totalReadBytes, &readBytes, nullptr))
+        DWORD available = _readBytes - _pos;
+        if (available == 0)
         {
+            if (!Refill())
+            {
+                *readBytes = totalReadBytes;
+                return false;
+            }
+
+            continue;
+        }
+
+        DWORD count = bufferSize - totalReadBytes;
+        if (count > available)
+            count = available;
+
+        memcpy(&pBuffer[totalReadBytes], &_pCurrentBuffer[_pos], count);
+        _pos += count;
+        totalReadBytes += count;
+    }
+
+    *readBytes = totalReadBytes;
+    Record(pBuffer, totalReadBytes);
+
+    return true;
+}
+
+bool IpcEndpoint::Refill()
+{
+    // the next buffer is already being filled since the previous refill
+    // unless the read could not be started at that time
+    if (!_isReadPending)
+    {
+        _readCallsCount++;
+        if (!BeginRawRead(_pNextBuffer, _bufferSize))
+            return false;
+    }
+
+    DWORD readBytes = 0;
+    _isReadPending = false;
+    if (!EndRawRead(readBytes))
+        return false;
+    _readBytesCount += readBytes;
+
+    // end of file
+    if (readBytes == 0)
+    {
+        ::SetLastError(ERROR_HANDLE_EOF);
+        return false;
+    }
+
+    // the filled buffer becomes the current one...
+    uint8_t* pFilled = _pNextBuffer;
+    _pNextBuffer = _pCurrentBuffer;
+    _pCurrentBuffer = pFilled;
+    _readBytes = readBytes;
+    _pos = 0;
+
+    // ...and the other one starts to be filled while the current one is consumed
+    _readCallsCount++;
+    _isReadPending = BeginRawRead(_pNextBuffer, _bufferSize);
+
+    return true;
+}
+
+// Called by an event loop when the read event/descriptor is signaled:
+// the bytes already buffered by previous Read calls are returned first
+bool IpcEndpoint::IsReadAvailable()
+{
+    if (_pos < _readBytes)
+        return true;
+
+    // the next read is usually started by the previous refill
+    if (!_isReadPending)
+    {
+        _readCallsCount++;
+        _isReadPending = BeginRawRead(_pNextBuffer, _bufferSize);
+        if (!_isReadPending)
+            return true;  // ReadAvailable will report the error
+    }
+
+    return IsRawReadCompleted();
+}
+
+// Return all buffered bytes without copying them: they are valid until the next read
+bool IpcEndpoint::ReadAvailable(const uint8_t*& pBytes, DWORD& readBytes)
+{
+    readBytes = 0;
+    if (_pos == _readBytes)
+    {
+        // the read has already completed so the refill does not wait
+        if (!_isReadPending || !Refill())
+            return false;
+    }
+
+    pBytes = &_pCurrentBuffer[_pos];
+    readBytes = _readBytes - _pos;
+    _pos = _readBytes;
+
+    return Record(pBytes, readBytes);
+}
+
+// one system call per Read as it used to be before buffering was added: only used as a baseline
+bool IpcEndpoint::ReadDirect(uint8_t* pBuffer, DWORD bufferSize, DWORD* readBytes)
+{
+    DWORD totalReadBytes = 0;
+    while (totalReadBytes < bufferSize)
+    {
+        DWORD count = 0;
+        _readCallsCount++;
+        if (!BeginRawRead(&(pBuffer[totalReadBytes]), bufferSize - totalReadBytes) || !EndRawRead(count))
+        {
+            *readBytes = totalReadBytes;
+            return false;
+        }
+        _readBytesCount += count;
+
+        if (count == 0)
+        {
+            *readBytes = totalReadBytes;
+            ::SetLastError(ERROR_HANDLE_EOF);
             return false;
         }
-        totalReadBytes += readBytes;
+
+        totalReadBytes += count;
     }
 
     *readBytes = totalReadBytes;
@@ -74,6 +239,59 @@ bool IpcEndpoint::Read(LPVOID buffer, DWORD bufferSize, DWORD* readBytes)
     return true;
 }
 
+bool IpcEndpoint::BeginRawRead(uint8_t* pBuffer, DWORD size)
+{
+    _overlapped = {};
+    _overlapped.hEvent = _hReadEvent;
+    _overlapped.Offset = (DWORD)_offset;
+    _overlapped.OffsetHigh = (DWORD)(_offset >> 32);
+
+    if (::ReadFile(_handle, pBuffer, size, nullptr, &_overlapped))
+    {
+        // completed synchronously: the result is available via GetOverlappedResult
+        return true;
+    }
+
+    return (::GetLastError() == ERROR_IO_PENDING);
+}
+
+bool IpcEndpoint::EndRawRead(DWORD& readBytes)
+{
+    readBytes = 0;
+    if (!::GetOverlappedResult(_handle, &_overlapped, &readBytes, TRUE))
+    {
+        // the end of a file is reported as an error
+        if (::GetLastError() == ERROR_HANDLE_EOF)
+        {
+            readBytes = 0;
+            return true;
+        }
+
+        return false;
+    }
+
+    _offset += readBytes;
+    return true;
+}
+
+bool IpcEndpoint::IsRawReadCompleted()
+{
+    return HasOverlappedIoCompleted(&_overlapped);
+}
+
+void IpcEndpoint::CancelRawRead()
+{
+    if (!_isReadPending)
+        return;
+
+    // wait for the cancellation to be processed before the buffer could be deleted
+    // Note: CancelIo would only cancel the reads started by the calling thread
+    DWORD readBytes = 0;
+    ::CancelIoEx(_handle, &_overlapped);
+    ::GetOverlappedResult(_handle, &_overlapped, &readBytes, TRUE);
+    _isReadPending = false;
+}
+
 bool IpcEndpoint::ReadByte(uint8_t& byte)
 {
     return Parse(this, byte);
@@ -4,10 +4,18 @@
 #include "IIpcRecorder.h"
 
 
+// Each endpoint allocates 2 read buffers of that size: one is consumed by the Read helpers
+// while the other one is being filled by the next (asynchronous) read from the pipe/file.
+// Note: 0 means no buffering at all (i.e. one system call per Read)
+const DWORD MinReadBufferSize = 64 * 1024;          //  64 KB
+const DWORD DefaultReadBufferSize = 256 * 1024;     // 256 KB
+const DWORD MaxReadBufferSize = 1024 * 1024;        //   1 MB
+
+
 class IpcEndpoint : public IIpcEndpoint
 {
 public:
-    IpcEndpoint(IIpcRecorder* pRecorder);
+    IpcEndpoint(IIpcRecorder* pRecorder, DWORD bufferSize = DefaultReadBufferSize);
 
     // Implements IIpcEndpoint interface
     virtual bool Write(LPCVOID buffer, DWORD bufferSize, DWORD* writtenBytes) override;
@@ -19,22 +27,63 @@ public:
 
     virtual bool Close() = 0;
 
+    // the bytes are returned from the read buffers (i.e. not available without buffering)
+    virtual bool CanReadAsync() override { return _bufferSize != 0; }
+    virtual HANDLE GetReadEvent() override { return _hReadEvent; }
+    virtual bool IsReadAvailable() override;
+    virtual bool ReadAvailable(const uint8_t*& pBytes, DWORD& readBytes) override;
+
+    // statistics
+    uint64_t GetReadCallsCount() const { return _readCallsCount; }
+    uint64_t GetReadBytesCount() const { return _readBytesCount; }
+    DWORD GetReadBufferSize() const { return _bufferSize; }
+
 protected:
     ~IpcEndpoint();
 
+    // Low level read of up to size bytes from the handle: one system call per BeginRawRead
+    // Note: the handle must be opened with FILE_FLAG_OVERLAPPED so that the next buffer
+    //       can be filled while the current one is consumed
+    virtual bool BeginRawRead(uint8_t* pBuffer, DWORD size);
+    virtual bool EndRawRead(DWORD& readBytes);
+    virtual void CancelRawRead();
+
+    // check without waiting if the pending read has completed
+    virtual bool IsRawReadCompleted();
+
 protected:
     HANDLE _handle;
     uint8_t* _pCurrentBuffer;
     uint8_t* _pNextBuffer;
+    DWORD _bufferSize;
+
+    // number of valid bytes in _pCurrentBuffer
     DWORD _readBytes;
 
     // used to record read bytes
     IIpcRecorder* _pRecorder;
 
     // point to the first buffered byte to return
-    uint16_t _pos;
+    DWORD _pos;
 
 private:
     bool Record(LPCVOID pBuffer, DWORD size);
+    bool Refill();
+    bool ReadDirect(uint8_t* pBuffer, DWORD bufferSize, DWORD* readBytes);
+
+protected:
+    bool _isReadPending;
+
+private:
+    // asynchronous read into _pNextBuffer
+    OVERLAPPED _overlapped;
+    HANDLE _hReadEvent;
+    HANDLE _hWriteEvent;
+
+    // position in the stream (needed by overlapped read for files; ignored by pipes)
+    uint64_t _offset;
+
+    uint64_t _readCallsCount;
+    uint64_t _readBytesCount;
 };
 
@@ -0,0 +1,147 @@
+#include "LiveObjectStore.h"
+
+
+LiveObjectStore::LiveObjectStore()
+{
+    _lastAddress = 0;
+}
+
+void LiveObjectStore::Clear()
+{
+    _typeIndexes.clear();
+    _sizes.clear();
+    _deltas.clear();
+    _checkpoints.clear();
+    _largeSizes.clear();
+    _lastAddress = 0;
+}
+
+void LiveObjectStore::ShrinkToFit()
+{
+    _typeIndexes.shrink_to_fit();
+    _sizes.shrink_to_fit();
+    _deltas.shrink_to_fit();
+    _checkpoints.shrink_to_fit();
+}
+
+void LiveObjectStore::Add(uint64_t address, uint32_t typeIndex, uint64_t size)
+{
+    uint32_t index = GetCount();
+    bool isNewRun =
+        _checkpoints.empty() ||
+        (address <= _lastAddress) ||
+        (index - _checkpoints.back().FirstObject >= RunLength);
+
+    if (isNewRun)
+    {
+        _checkpoints.push_back({ address, index, (uint32_t)_deltas.size() });
+    }
+    else
+    {
+        uint64_t delta = address - _lastAddress;
+        do
+        {
+            uint8_t b = delta & 0x7F;
+            delta >>= 7;
+            if (delta != 0)
+            {
+                b |= 0x80;
+            }
+            _deltas.push_back(b);
+        } while (delta != 0);
+    }
+    _lastAddress = address;
+
+    _typeIndexes.push_back(typeIndex);
+    if (size >= LargeSize)
+    {
+        _sizes.push_back(LargeSize);
+        _largeSizes[index] = size;
+    }
+    else
+    {
+        _sizes.push_back((uint32_t)size);
+    }
+}
+
+uint64_t LiveObjectStore::GetSize(uint32_t index) const
+{
+    uint32_t size = _sizes[index];
+    if (size != LargeSize)
+        return size;
+
+    return _largeSizes.at(index);
+}
+
+static inline uint64_t DecodeDelta(const uint8_t*& p)
+{
+    uint64_t delta = 0;
+    int shift = 0;
+    uint8_t b;
+    do
+    {
+        b = *p++;
+        delta |= (uint64_t)(b & 0x7F) << shift;
+        shift += 7;
+    } while ((b & 0x80) != 0);
+
+    return delta;
+}
+
+uint64_t LiveObjectStore::GetAddress(uint32_t index) const
+{
+    // find the run of the object (the last checkpoint starting at or before it)
+    size_t first = 0;
+    size_t last = _checkpoints.size();
+    while (last - first > 1)
+    {
+        size_t middle = (first + last) / 2;
+        if (_checkpoints[middle].FirstObject <= index)
+            first = middle;
+        else
+            last = middle;
+    }
+
+    const Checkpoint& checkpoint = _checkpoints[first];
+    uint64_t address = checkpoint.Address;
+    const uint8_t* p = _deltas.data() + checkpoint.DeltasOffset;
+    for (uint32_t i = checkpoint.FirstObject; i < index; i++)
+    {
+        address += DecodeDelta(p);
+    }
+
+    return address;
+}
+
+void LiveObjectStore::GetAddresses(std::vector<uint64_t>& addresses) const
+{
+    addresses.resize(GetCount());
+
+    const uint8_t* p = _deltas.data();
+    for (size_t run = 0; run < _checkpoints.size(); run++)
+    {
+        uint32_t first = _checkpoints[run].FirstObject;
+        uint32_t end = (run + 1 < _checkpoints.size()) ? _checkpoints[run + 1].FirstObject : GetCount();
+
+        // the deltas of the runs are consecutive in the arena
+        uint64_t address = _checkpoints[run].Address;
+        addresses[first] = address;
+        for (uint32_t i = first + 1; i < end; i++)
+        {
+            address += DecodeDelta(p);
+            addresses[i] = address;
+        }
+    }
+}
+
+uint64_t LiveObjectStore::GetMemorySize() const
+{
+    // each entry of the map is allocated in a node linked to the next one
+    return
+        _typeIndexes.capacity() * sizeof(uint32_t) +
+        _sizes.capacity() * sizeof(uint32_t) +
+        _deltas.capacity() +
+        _checkpoints.capacity() * sizeof(Checkpoint) +
+        _largeSizes.bucket_count() * sizeof(void*) +
+        _largeSizes.size() * (sizeof(std::pair<const uint32_t, uint64_t>) + sizeof(void*));
+}
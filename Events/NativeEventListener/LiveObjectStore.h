@@ -0,0 +1,66 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <unordered_map>
+#include <vector>
+
+
+// Compact storage of the live objects of a gcdump shared by all types (~9 bytes per object):
+//  - the type of each object is the dense index of its TypeInfo (32 bit) instead of its 64 bit type ID
+//  - the sizes are stored on 32 bit: the few larger objects are kept in a side table
+//  - the addresses are delta encoded (LEB128) in one byte arena: the nodes of a BulkNode event are
+//    listed by address order within a heap segment so the delta is the size of the previous object
+//    (often less than 128 bytes) and fits in 1 byte.
+// A checkpoint with the full address starts a new run every RunLength objects or when the address
+// is not increasing (i.e. new segment or heap) so that an address can be found without decoding
+// all the previous ones.
+class LiveObjectStore
+{
+public:
+    LiveObjectStore();
+
+    void Add(uint64_t address, uint32_t typeIndex, uint64_t size);
+    void Clear();
+
+    // give back the capacity reserved by the vectors growth once all the objects have been added
+    void ShrinkToFit();
+
+    uint32_t GetCount() const { return (uint32_t)_typeIndexes.size(); }
+    uint32_t GetTypeIndex(uint32_t index) const { return _typeIndexes[index]; }
+    uint64_t GetSize(uint32_t index) const;
+    uint64_t GetAddress(uint32_t index) const;
+
+    // decode the addresses of all the objects (faster than calling GetAddress for each one)
+    void GetAddresses(std::vector<uint64_t>& addresses) const;
+
+    // bytes allocated for the objects (including the unused capacity of the vectors)
+    uint64_t GetMemorySize() const;
+
+public:
+    static constexpr uint32_t RunLength = 128;
+
+    // type index of the objects listed with a type that was not received
+    static constexpr uint32_t UnknownType = 0xFFFFFFFF;
+
+private:
+    struct Checkpoint
+    {
+        uint64_t Address;       // of the first object of the run
+        uint32_t FirstObject;
+        uint32_t DeltasOffset;  // in the arena of the delta of the second object of the run
+    };
+
+    static constexpr uint32_t LargeSize = 0xFFFFFFFF;
+
+private:
+    std::vector<uint32_t> _typeIndexes;
+    std::vector<uint32_t> _sizes;
+    std::vector<uint8_t> _deltas;
+    std::vector<Checkpoint> _checkpoints;
+
+    //                 object    size >= 4 GB
+    std::unordered_map<uint32_t, uint64_t> _largeSizes;
+
+    uint64_t _lastAddress;
+};
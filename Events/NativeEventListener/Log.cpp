@@ -0,0 +1,139 @@
+#include <iomanip>
+#include <vector>
+
+#include "Log.h"
+
+
+const char* GetTraceName(TraceId id)
+{
+    switch (id)
+    {
+        case TraceId::BlockExtracted:   return "BlockExtracted";
+        case TraceId::BlockParsed:      return "BlockParsed";
+        case TraceId::MetadataDefined:  return "MetadataDefined";
+        case TraceId::EventDispatched:  return "EventDispatched";
+        case TraceId::SequencePoint:    return "SequencePoint";
+        case TraceId::ParseError:       return "ParseError";
+
+        default:
+            return "?";
+    }
+}
+
+
+// copy of an entry while dumping
+struct TraceEntryValue
+{
+    uint64_t Context;
+    uint64_t Timestamp;
+    uint32_t ThreadId;
+    TraceId Id;
+    uint64_t Arg1;
+    uint64_t Arg2;
+};
+
+
+// a thread can serve several sessions (i.e. event loop) so the context is changed by the caller
+thread_local uint64_t t_traceContext = 0;
+
+void SetTraceContext(uint64_t context)
+{
+    t_traceContext = context;
+}
+
+
+TraceRing::TraceRing()
+{
+    for (auto& entry : _entries)
+    {
+        entry.Sequence = 0;
+        entry.Context = 0;
+        entry.Timestamp = 0;
+        entry.ThreadId = 0;
+        entry.Id = TraceId::BlockExtracted;
+        entry.Arg1 = 0;
+        entry.Arg2 = 0;
+    }
+    _nextEntry = 0;
+}
+
+void TraceRing::Add(TraceId id, uint64_t arg1, uint64_t arg2)
+{
+    LARGE_INTEGER now;
+    ::QueryPerformanceCounter(&now);
+
+    // each thread gets its own slot: an entry could only be overwritten by a thread
+    // that is TraceRingSize entries ahead
+    uint64_t index = _nextEntry.fetch_add(1, std::memory_order_relaxed);
+    auto& entry = _entries[index & (TraceRingSize - 1)];
+
+    // readers skip the entry until its sequence is published
+    entry.Sequence.store(0, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    entry.Context = t_traceContext;
+    entry.Timestamp = now.QuadPart;
+    entry.ThreadId = ::GetCurrentThreadId();
+    entry.Id = id;
+    entry.Arg1 = arg1;
+    entry.Arg2 = arg2;
+    entry.Sequence.store(index + 1, std::memory_order_release);
+}
+
+void TraceRing::Dump(std::ostream& out, uint64_t context)
+{
+    uint64_t end = _nextEntry.load(std::memory_order_acquire);
+    uint64_t start = (end > TraceRingSize) ? end - TraceRingSize : 0;
+
+    LARGE_INTEGER frequency;
+    ::QueryPerformanceFrequency(&frequency);
+
+    // copy the entries first: a torn entry (still being written or already overwritten by a thread
+    // that is TraceRingSize entries ahead) does not have the expected sequence before and after the copy
+    std::vector<TraceEntryValue> entries;
+    entries.reserve((size_t)(end - start));
+    uint64_t tornCount = 0;
+    for (uint64_t current = start; current < end; current++)
+    {
+        auto& entry = _entries[current & (TraceRingSize - 1)];
+        if (entry.Sequence.load(std::memory_order_acquire) != current + 1)
+        {
+            tornCount++;
+            continue;
+        }
+
+        TraceEntryValue value = { entry.Context, entry.Timestamp, entry.ThreadId, entry.Id, entry.Arg1, entry.Arg2 };
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (entry.Sequence.load(std::memory_order_relaxed) != current + 1)
+        {
+            tornCount++;
+            continue;
+        }
+
+        if (value.Context == context)
+        {
+            entries.push_back(value);
+        }
+    }
+
+    out << "\nTrace ring of #" << (int64_t)context << " (" << entries.size() << " entries, " << tornCount << " skipped)\n";
+    out << "---------------------------------------------------------------------\n";
+    out << "       Time (us)    Thread  Trace                 Arg1            Arg2\n";
+
+    uint64_t origin = entries.empty() ? 0 : entries.front().Timestamp;
+    for (auto& entry : entries)
+    {
+        out << std::setfill(' ')
+            << std::setw(16) << (int64_t)(entry.Timestamp - origin) * 1000000 / frequency.QuadPart
+            << std::setw(10) << entry.ThreadId
+            << "  " << std::left << std::setw(16) << GetTraceName(entry.Id) << std::right
+            << std::setw(10) << entry.Arg1
+            << std::setw(16) << entry.Arg2
+            << "\n";
+    }
+}
+
+TraceRing& GetTraceRing()
+{
+    static TraceRing ring;
+    return ring;
+}
@@ -0,0 +1,114 @@
+#pragma once
+#include <atomic>
+#include <iostream>
+#include <windows.h>
+#include <stdint.h>
+
+
+// Messages above LOG_LEVEL are removed at compile time: their arguments are not even formatted.
+// Define LOG_LEVEL in the project settings to override the default level.
+#define LOG_LEVEL_NONE      0
+#define LOG_LEVEL_ERROR     1   // parsing/communication errors
+#define LOG_LEVEL_INFO      2   // one message per interesting event (exception, allocation tick, GC...)
+#define LOG_LEVEL_VERBOSE   3   // blocks, headers and metadata definitions
+
+#ifndef LOG_LEVEL
+#ifdef _DEBUG
+#define LOG_LEVEL LOG_LEVEL_INFO
+#else
+#define LOG_LEVEL LOG_LEVEL_ERROR
+#endif
+#endif
+
+#define LOG_WRITE(level, stream, message)       \
+    do                                          \
+    {                                           \
+        if constexpr (LOG_LEVEL >= level)       \
+        {                                       \
+            stream << message;                  \
+        }                                       \
+    } while (0)
+
+#define LOG_ERROR(message)      LOG_WRITE(LOG_LEVEL_ERROR, std::cout, message)
+#define LOG_INFO(message)       LOG_WRITE(LOG_LEVEL_INFO, std::cout, message)
+#define LOG_VERBOSE(message)    LOG_WRITE(LOG_LEVEL_VERBOSE, std::cout, message)
+
+// for wide strings
+#define LOG_ERROR_W(message)    LOG_WRITE(LOG_LEVEL_ERROR, std::wcout, message)
+#define LOG_INFO_W(message)     LOG_WRITE(LOG_LEVEL_INFO, std::wcout, message)
+#define LOG_VERBOSE_W(message)  LOG_WRITE(LOG_LEVEL_VERBOSE, std::wcout, message)
+
+// for the Dump...() helpers
+#define LOG_VERBOSE_DUMP(call)                  \
+    do                                          \
+    {                                           \
+        if constexpr (LOG_LEVEL >= LOG_LEVEL_VERBOSE) \
+        {                                       \
+            call;                               \
+        }                                       \
+    } while (0)
+
+
+// The trace ring keeps the last parsing steps in memory as binary entries (no formatting)
+// so that they can be dumped when a session fails, even with console logging disabled.
+// Define TRACE_RING_ENABLED to 1 to compile the tracing in (each step costs an interlocked increment).
+// The ring is shared by all sessions: each entry is tagged with the context (i.e. the pid of the
+// monitored process) set by the thread that added it so that the steps of a session can be dumped.
+#ifndef TRACE_RING_ENABLED
+#define TRACE_RING_ENABLED 0
+#endif
+
+const uint32_t TraceRingSize = 4096;    // must be a power of 2
+
+enum class TraceId : uint16_t
+{
+    BlockExtracted,     // block type, block size
+    BlockParsed,        // block type, success
+    MetadataDefined,    // metadata ID, event ID
+    EventDispatched,    // event ID, payload size
+    SequencePoint,      // timestamp, thread count
+    ParseError,         // position in block, bytes to read
+};
+
+struct TraceEntry
+{
+    std::atomic<uint64_t> Sequence;  // index of the entry + 1 once written, 0 while being written
+    uint64_t Context;       // see SetTraceContext()
+    uint64_t Timestamp;     // QueryPerformanceCounter
+    uint32_t ThreadId;
+    TraceId Id;
+    uint64_t Arg1;
+    uint64_t Arg2;
+};
+
+class TraceRing
+{
+public:
+    TraceRing();
+
+    // can be called from any thread: only the last TraceRingSize entries are kept
+    void Add(TraceId id, uint64_t arg1, uint64_t arg2);
+
+    // oldest entry first, only the ones added with the given context
+    // Note: the entries being overwritten while dumping are skipped
+    void Dump(std::ostream& out, uint64_t context);
+
+private:
+    TraceEntry _entries[TraceRingSize];
+    std::atomic<uint64_t> _nextEntry;
+};
+
+TraceRing& GetTraceRing();
+
+// the next entries added by the calling thread belong to this context
+void SetTraceContext(uint64_t context);
+
+#if TRACE_RING_ENABLED
+#define TRACE_STEP(id, arg1, arg2) GetTraceRing().Add(id, (uint64_t)(arg1), (uint64_t)(arg2))
+#define TRACE_SET_CONTEXT(context) SetTraceContext((uint64_t)(context))
+#define TRACE_DUMP(out, context) GetTraceRing().Dump(out, (uint64_t)(context))
+#else
+#define TRACE_STEP(id, arg1, arg2) do {} while (0)
+#define TRACE_SET_CONTEXT(context) do {} while (0)
+#define TRACE_DUMP(out, context) do {} while (0)
+#endif
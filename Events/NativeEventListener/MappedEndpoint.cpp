@@ -0,0 +1,221 @@
+#include "MappedEndpoint.h"
+
+
+#ifdef _WIN64
+// the whole file is mapped at once: the address space is large enough
+const uint64_t ViewWindowSize = UINT64_MAX;
+#else
+// only a window of the file is mapped and moved forward while the file is read
+const uint64_t ViewWindowSize = 64 * 1024 * 1024;
+#endif
+
+// ask the memory manager to read ahead the next pages
+// (the Windows equivalent of madvise(MADV_WILLNEED) on the part of the file that will be parsed next)
+const uint64_t PrefetchSize = 16 * 1024 * 1024;
+
+
+MappedEndpoint::MappedEndpoint()
+{
+    _hFile = INVALID_HANDLE_VALUE;
+    _hMapping = nullptr;
+    _fileSize = 0;
+    _position = 0;
+    _pView = nullptr;
+    _viewOffset = 0;
+    _viewSize = 0;
+    _prefetchedEnd = 0;
+    _prefetchCallsCount = 0;
+}
+
+MappedEndpoint::~MappedEndpoint()
+{
+    Close();
+}
+
+MappedEndpoint* MappedEndpoint::Create(const wchar_t* recordFilename)
+{
+    auto pEndpoint = new MappedEndpoint();
+
+    // the file is read sequentially
+    pEndpoint->_hFile = ::CreateFile(recordFilename, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (pEndpoint->_hFile == INVALID_HANDLE_VALUE)
+    {
+        delete pEndpoint;
+        return nullptr;
+    }
+
+    LARGE_INTEGER size;
+    if (!::GetFileSizeEx(pEndpoint->_hFile, &size) || (size.QuadPart == 0))
+    {
+        delete pEndpoint;
+        return nullptr;
+    }
+    pEndpoint->_fileSize = size.QuadPart;
+
+    pEndpoint->_hMapping = ::CreateFileMapping(pEndpoint->_hFile, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (pEndpoint->_hMapping == nullptr)
+    {
+        delete pEndpoint;
+        return nullptr;
+    }
+
+    if (!pEndpoint->MapView(0, 0))
+    {
+        delete pEndpoint;
+        return nullptr;
+    }
+
+    return pEndpoint;
+}
+
+
+bool MappedEndpoint::Write(LPCVOID buffer, DWORD bufferSize, DWORD* writtenBytes)
+{
+    // NOP operation
+    *writtenBytes = bufferSize;
+    return true;
+}
+
+bool MappedEndpoint::ReadInPlace(DWORD bufferSize, const uint8_t*& pBuffer)
+{
+    if (bufferSize > _fileSize - _position)
+    {
+        ::SetLastError(ERROR_HANDLE_EOF);
+        return false;
+    }
+
+    // move the view forward if the bytes are not already mapped
+    if ((_position < _viewOffset) || (_position + bufferSize > _viewOffset + _viewSize))
+    {
+        if (!MapView(_position, bufferSize))
+            return false;
+    }
+
+    pBuffer = &_pView[_position - _viewOffset];
+    _position += bufferSize;
+
+    Prefetch();
+
+    return true;
+}
+
+bool MappedEndpoint::Read(LPVOID buffer, DWORD bufferSize, DWORD* readBytes)
+{
+    const uint8_t* pBuffer = nullptr;
+    if (!ReadInPlace(bufferSize, pBuffer))
+    {
+        *readBytes = 0;
+        return false;
+    }
+
+    memcpy(buffer, pBuffer, bufferSize);
+    *readBytes = bufferSize;
+
+    return true;
+}
+
+bool MappedEndpoint::ReadByte(uint8_t& byte)
+{
+    DWORD readBytes = 0;
+    return Read(&byte, sizeof(byte), &readBytes);
+}
+
+bool MappedEndpoint::ReadWord(uint16_t& word)
+{
+    DWORD readBytes = 0;
+    return Read(&word, sizeof(word), &readBytes);
+}
+
+bool MappedEndpoint::ReadDWord(uint32_t& dword)
+{
+    DWORD readBytes = 0;
+    return Read(&dword, sizeof(dword), &readBytes);
+}
+
+bool MappedEndpoint::ReadLong(uint64_t& ulong)
+{
+    DWORD readBytes = 0;
+    return Read(&ulong, sizeof(ulong), &readBytes);
+}
+
+// map a view that starts before offset (views must start on the allocation granularity)
+// and that contains at least size bytes
+bool MappedEndpoint::MapView(uint64_t offset, DWORD size)
+{
+    if (_pView != nullptr)
+    {
+        ::UnmapViewOfFile(_pView);
+        _pView = nullptr;
+    }
+
+    SYSTEM_INFO info;
+    ::GetSystemInfo(&info);
+    uint64_t viewOffset = offset - (offset % info.dwAllocationGranularity);
+
+    uint64_t viewSize = _fileSize - viewOffset;
+    if (viewSize > ViewWindowSize)
+    {
+        viewSize = ViewWindowSize;
+
+        // a block could cross the end of the window
+        if (viewSize < (offset - viewOffset) + size)
+            viewSize = (offset - viewOffset) + size;
+    }
+
+    _pView = static_cast<const uint8_t*>(::MapViewOfFile(_hMapping, FILE_MAP_READ, (DWORD)(viewOffset >> 32), (DWORD)viewOffset, (SIZE_T)viewSize));
+    if (_pView == nullptr)
+        return false;
+
+    _viewOffset = viewOffset;
+    _viewSize = viewSize;
+    _prefetchedEnd = offset;
+
+    return true;
+}
+
+// keep at least half of PrefetchSize bytes ahead of the current position being read by the memory manager
+void MappedEndpoint::Prefetch()
+{
+    uint64_t viewEnd = _viewOffset + _viewSize;
+    if (_prefetchedEnd >= viewEnd)
+        return;
+
+    if ((_prefetchedEnd > _position) && (_prefetchedEnd - _position > PrefetchSize / 2))
+        return;
+
+    uint64_t start = (_prefetchedEnd > _position) ? _prefetchedEnd : _position;
+    uint64_t size = PrefetchSize;
+    if (start + size > viewEnd)
+        size = viewEnd - start;
+
+    WIN32_MEMORY_RANGE_ENTRY range;
+    range.VirtualAddress = (PVOID)&_pView[start - _viewOffset];
+    range.NumberOfBytes = (SIZE_T)size;
+    ::PrefetchVirtualMemory(::GetCurrentProcess(), 1, &range, 0);
+    _prefetchCallsCount++;
+
+    _prefetchedEnd = start + size;
+}
+
+bool MappedEndpoint::Close()
+{
+    if (_pView != nullptr)
+    {
+        ::UnmapViewOfFile(_pView);
+        _pView = nullptr;
+    }
+
+    if (_hMapping != nullptr)
+    {
+        ::CloseHandle(_hMapping);
+        _hMapping = nullptr;
+    }
+
+    if (_hFile == INVALID_HANDLE_VALUE)
+        return false;
+
+    ::CloseHandle(_hFile);
+    _hFile = INVALID_HANDLE_VALUE;
+
+    return true;
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+#include "IIpcEndpoint.h"
+
+// Replay a recorded session from a memory mapped file: blocks are not copied but
+// parsed directly from the mapping thanks to ReadInPlace()
+class MappedEndpoint : public IIpcEndpoint
+{
+public:
+    static MappedEndpoint* Create(const wchar_t* recordFilename);
+
+    // Inherited via IIpcEndpoint
+    // NOP operation
+    virtual bool Write(LPCVOID buffer, DWORD bufferSize, DWORD* writtenBytes) override;
+
+    // read from the mapping
+    virtual bool Read(LPVOID buffer, DWORD bufferSize, DWORD* readBytes) override;
+    virtual bool ReadByte(uint8_t& byte) override;
+    virtual bool ReadWord(uint16_t& word) override;
+    virtual bool ReadDWord(uint32_t& dword) override;
+    virtual bool ReadLong(uint64_t& ulong) override;
+    virtual bool CanReadInPlace() override { return true; }
+    virtual bool ReadInPlace(DWORD bufferSize, const uint8_t*& pBuffer) override;
+
+    // cleanup
+    virtual bool Close() override;
+
+    uint64_t GetFileSize() const { return _fileSize; }
+    uint64_t GetPrefetchCallsCount() const { return _prefetchCallsCount; }
+
+protected:
+    ~MappedEndpoint();
+
+private:
+    MappedEndpoint();
+    bool MapView(uint64_t offset, DWORD size);
+    void Prefetch();
+
+private:
+    HANDLE _hFile;
+    HANDLE _hMapping;
+    uint64_t _fileSize;
+
+    // position of the next byte to read in the file
+    uint64_t _position;
+
+    // currently mapped part of the file
+    const uint8_t* _pView;
+    uint64_t _viewOffset;
+    uint64_t _viewSize;
+
+    // end of the part of the view for which a prefetch has been requested
+    uint64_t _prefetchedEnd;
+    uint64_t _prefetchCallsCount;
+};
+
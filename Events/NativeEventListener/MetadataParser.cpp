@@ -4,6 +4,7 @@
 #include "DiagnosticsProtocol.h"
 #include "NettraceFormat.h"
 #include "BlockParser.h"
+#include "Log.h"
 
 
 void DumpMetadataDefinition(EventCacheMetadata metadataDef)
@@ -19,9 +20,11 @@ void DumpMetadataDefinition(EventCacheMetadata metadataDef)
     std::cout << "   Version : " << metadataDef.Version << "\n";
     std::cout << "   Keywords: 0x" << std::hex << metadataDef.Keywords << std::dec << "\n";
     std::cout << "   Level   : " << metadataDef.Level << "\n";
+    if (metadataDef.Plan.IsValid())
+        metadataDef.Plan.Dump();
 }
 
-MetadataParser::MetadataParser(std::unordered_map<uint32_t, EventCacheMetadata>& metadata)
+MetadataParser::MetadataParser(MetadataTable& metadata)
     :
     EventParserBase(metadata)
 {
@@ -45,7 +48,7 @@ bool MetadataParser::OnParseBlob(EventBlobHeader& header, bool isCompressed, DWO
     }
 
     // TODO: uncomment to show blob header
-    DumpBlobHeader(header);
+    LOG_VERBOSE_DUMP(DumpBlobHeader(header));
 
     // keep track of the only read bytes in the payload
     DWORD readBytesCount = 0;
@@ -66,26 +69,31 @@ bool MetadataParser::OnParseBlob(EventBlobHeader& header, bool isCompressed, DWO
     uint32_t metadataId;
     if (!ReadDWord(metadataId))
     {
-        std::cout << "Error while reading metadata provider name\n";
+        LOG_ERROR("Error while reading metadata provider name\n");
         return false;
     }
     readBytesCount += sizeof(metadataId);
 
-    auto& metadataDef = _metadata[metadataId];
-    metadataDef.MetadataId = metadataId;
+    EventCacheMetadata* pMetadataDef = _metadata.Define(metadataId);
+    if (pMetadataDef == nullptr)
+    {
+        LOG_ERROR("Invalid metadata ID " << metadataId << "\n");
+        return false;
+    }
+    auto& metadataDef = *pMetadataDef;
 
     // look for the provider name
     metadataDef.ProviderName.reserve(48);  // no provider name longer than 32+ characters
     if (!ReadWString(metadataDef.ProviderName, size))
     {
-        std::cout << "Error while reading metadata provider name\n";
+        LOG_ERROR("Error while reading metadata provider name\n");
         return false;
     }
     readBytesCount += size;
 
     if (!ReadDWord(metadataDef.EventId))
     {
-        std::cout << "Error while reading metadata event ID\n";
+        LOG_ERROR("Error while reading metadata event ID\n");
         return false;
     }
     readBytesCount += sizeof(metadataDef.EventId);
@@ -93,36 +101,51 @@ bool MetadataParser::OnParseBlob(EventBlobHeader& header, bool isCompressed, DWO
     // could be empty
     if (!ReadWString(metadataDef.EventName, size))
     {
-        std::cout << "Error while reading metadata event name\n";
+        LOG_ERROR("Error while reading metadata event name\n");
         return false;
     }
     readBytesCount += size;
 
     if (!ReadLong(metadataDef.Keywords))
     {
-        std::cout << "Error while reading metadata keywords\n";
+        LOG_ERROR("Error while reading metadata keywords\n");
         return false;
     }
     readBytesCount += sizeof(metadataDef.Keywords);
 
     if (!ReadDWord(metadataDef.Version))
     {
-        std::cout << "Error while reading metadata version\n";
+        LOG_ERROR("Error while reading metadata version\n");
         return false;
     }
     readBytesCount += sizeof(metadataDef.Version);
 
     if (!ReadDWord(metadataDef.Level))
     {
-        std::cout << "Error while reading metadata level\n";
+        LOG_ERROR("Error while reading metadata level\n");
         return false;
     }
     readBytesCount += sizeof(metadataDef.Level);
 
-    DumpMetadataDefinition(metadataDef);
+    // the field descriptors follow (+ optional tags such as the V2 parameters)
+    const uint8_t* pDescriptors;
+    uint32_t descriptorsSize = header.PayloadSize - readBytesCount;
+    if (TryGetRange(descriptorsSize, pDescriptors))
+    {
+        metadataDef.Plan.Build(pDescriptors, descriptorsSize);
+    }
+    else
+    {
+        // to get the error
+        SkipBytes(descriptorsSize);
+    }
+
+    // the handler is found once per definition instead of once per event
+    metadataDef.HandlerId = EventParser::GetHandlerId(metadataDef);
+    metadataDef.IsSkipped = (metadataDef.HandlerId == EventHandlerId::None);
 
-    // skip remaining payload
-    SkipBytes(header.PayloadSize - readBytesCount);
+    TRACE_STEP(TraceId::MetadataDefined, metadataId, metadataDef.EventId);
+    LOG_VERBOSE_DUMP(DumpMetadataDefinition(metadataDef));
 
     blobSize += header.PayloadSize;
     return true;
@@ -0,0 +1,48 @@
+#include "MetadataTable.h"
+
+
+MetadataTable::MetadataTable()
+{
+    _definitionsCount = 0;
+}
+
+MetadataTable::~MetadataTable()
+{
+    for (auto pSegment : _segments)
+    {
+        delete[] pSegment;
+    }
+    _segments.clear();
+}
+
+EventCacheMetadata* MetadataTable::Define(uint32_t metadataId)
+{
+    if (metadataId >= MaxMetadataId)
+        return nullptr;
+
+    uint32_t segment = metadataId / SegmentSize;
+    if (segment >= _segments.size())
+    {
+        _segments.resize(segment + 1, nullptr);
+    }
+
+    if (_segments[segment] == nullptr)
+    {
+        _segments[segment] = new EventCacheMetadata[SegmentSize]();
+    }
+
+    EventCacheMetadata* pMetadata = &_segments[segment][metadataId % SegmentSize];
+    if (!pMetadata->IsDefined)
+    {
+        _definitionsCount++;
+    }
+
+    // a redefinition replaces the previous one
+    *pMetadata = EventCacheMetadata();
+    pMetadata->MetadataId = metadataId;
+    pMetadata->HandlerId = EventHandlerId::None;
+    pMetadata->IsSkipped = true;
+    pMetadata->IsDefined = true;
+
+    return pMetadata;
+}
@@ -0,0 +1,78 @@
+#pragma once
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "PayloadDecoder.h"
+#include "SessionStatistics.h"
+
+
+class EventCacheMetadata
+{
+public:
+    uint32_t     MetadataId;
+    std::wstring ProviderName;
+    uint32_t     EventId;
+    std::wstring EventName; // empty most of the time
+    uint64_t     Keywords;
+    uint32_t     Version;
+    uint32_t     Level;
+
+    // cached by SessionStatistics (0 = not known yet)
+    uint32_t     ProviderIndex;
+    uint32_t     EventIdIndex;
+
+    // cached by BackpressurePolicy (0 = not known yet)
+    uint32_t     PriorityIndex;
+
+    // built from the field descriptors (invalid if the metadata does not describe the payload)
+    DecodePlan   Plan;
+
+    // resolved from (provider, event ID, version) when the definition is received
+    // so that dispatching an event does not need to look at its provider name
+    EventHandlerId HandlerId;
+    bool         IsSkipped;     // no dedicated handler
+    bool         IsDefined;
+};
+
+
+// The MetadataIds are allocated sequentially by the runtime so the definitions are stored in a
+// dense table indexed by MetadataId instead of a hash map: finding the definition of an event is
+// one indexed load (+ one for the segment). The table is split into fixed size segments allocated
+// on demand so that the definitions never move: pointers to them can be kept by the decoders and
+// the orderer while new definitions are received.
+class MetadataTable
+{
+public:
+    MetadataTable();
+    ~MetadataTable();
+
+    // nullptr if no definition was received for this id
+    EventCacheMetadata* Find(uint32_t metadataId)
+    {
+        uint32_t segment = metadataId / SegmentSize;
+        if (segment >= _segments.size())
+            return nullptr;
+
+        EventCacheMetadata* pSegment = _segments[segment];
+        if (pSegment == nullptr)
+            return nullptr;
+
+        EventCacheMetadata* pMetadata = &pSegment[metadataId % SegmentSize];
+        return pMetadata->IsDefined ? pMetadata : nullptr;
+    }
+
+    // return the (reset) entry to fill with the definition of the given id
+    // Note: nullptr if the id is too large to be stored in the table
+    EventCacheMetadata* Define(uint32_t metadataId);
+
+    uint32_t GetDefinitionsCount() const { return _definitionsCount; }
+
+public:
+    static const uint32_t SegmentSize = 256;
+    static const uint32_t MaxMetadataId = 16 * 1024 * 1024;
+
+private:
+    std::vector<EventCacheMetadata*> _segments;
+    uint32_t _definitionsCount;
+};
@@ -5,11 +5,16 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string>
+#include <unordered_map>
 #include <windows.h>
 
 #include "DiagnosticsClient.h"
 #include "DiagnosticsProtocol.h"
+#include "EventPipeSessionHost.h"
 #include "GcDumpSession.h"
+#include "Log.h"
+#include "ReplayBenchmark.h"
+#include "ReversedDiagnosticsServer.h"
 
 
 void DumpNamedPipeInfo(HANDLE hPipe, LPCWSTR pszName)
@@ -163,17 +168,232 @@ DWORD WINAPI ListenToEvents(void* pParam)
 
     pSession->Listen();
 
+    // show the last parsing steps if the stream was corrupted
+    if (pSession->HasFailed())
+    {
+        TRACE_DUMP(std::cout, pSession->_pid);
+    }
+
     return 0;
 }
 
-// -pid : pid
-// -i   : input filename
-// -o   : output filename
-void ParseCommandLine(int argc, wchar_t* argv[], DWORD& pid, const wchar_t*& inputFilename, const wchar_t*& outputFilename)
+// summary of the events received from a runtime
+// Note: one listener per session so that it is only called from the event loop thread of its session
+class RuntimeEventListener : public EventListenerBase<RuntimeEventListener>, public IGenericEventHandler
+{
+public:
+    static constexpr uint32_t SubscribedEvents =
+        SubscribeTo(EventHandlerId::AllocationTick) |
+        SubscribeTo(EventHandlerId::ExceptionThrown) |
+        SubscribeTo(EventHandlerId::GcStart);
+
+    RuntimeEventListener()
+    {
+        _allocatedBytes = 0;
+        _exceptionsCount = 0;
+        _gcCount = 0;
+        _inducedGcCount = 0;
+    }
+
+    void OnAllocationTick(const EventContext& context, const AllocationTickEvent& event)
+    {
+        _allocatedBytes += event.Amount64;
+    }
+
+    void OnExceptionThrown(const EventContext& context, const ExceptionThrownEvent& event)
+    {
+        _exceptionsCount++;
+    }
+
+    void OnGcStart(const EventContext& context, const GcStartEvent& event)
+    {
+        _gcCount++;
+        if (event.Reason == GCReason::Induced)
+            _inducedGcCount++;
+    }
+
+    // the events of the other providers are only counted
+    void OnGenericEvent(uint32_t metadataId, uint32_t eventId, const std::wstring& providerName, const DecodedPayload& payload) override
+    {
+        auto& count = _genericEvents[metadataId];
+        if (count.Count == 0)
+        {
+            count.ProviderName = providerName;
+            count.EventId = eventId;
+        }
+        count.Count++;
+    }
+
+    void Dump()
+    {
+        std::cout << "   " << _gcCount << " GCs (" << _inducedGcCount << " induced) - "
+            << _exceptionsCount << " exceptions - " << _allocatedBytes / (1024 * 1024) << " MB allocated (sampled)\n";
+
+        for (auto& generic : _genericEvents)
+        {
+            std::cout << "   ";
+            std::wcout << generic.second.ProviderName;
+            std::cout << " #" << generic.second.EventId << " = " << generic.second.Count << "\n";
+        }
+    }
+
+private:
+    struct GenericEventCount
+    {
+        std::wstring ProviderName;
+        uint32_t EventId = 0;
+        uint64_t Count = 0;
+    };
+
+    uint64_t _allocatedBytes;
+    uint64_t _exceptionsCount;
+    uint32_t _gcCount;
+    uint32_t _inducedGcCount;
+
+    // per metadata ID (i.e. per event version)
+    std::unordered_map<uint32_t, GenericEventCount> _genericEvents;
+};
+
+// listen to the events of the runtimes connecting to the server from a few event loop threads
+// instead of one thread per runtime
+class ListeningSessionHandler : public IReversedSessionHandler, public ISessionHostHandler
+{
+public:
+    ListeningSessionHandler(bool isDegradedModeEnabled)
+        :
+        _isDegradedModeEnabled(isDegradedModeEnabled)
+    {
+        ::InitializeSRWLock(&_listenersLock);
+    }
+
+    bool Start()
+    {
+        return _host.Start();
+    }
+
+    void Stop()
+    {
+        _host.Stop();
+    }
+
+    // also receives the responses of the commands sent by the server
+    EventPipeSessionHost* GetHost()
+    {
+        return &_host;
+    }
+
+    void OnSessionStarted(uint64_t pid, const GUID& runtimeCookie, EventPipeSession* pSession) override
+    {
+        std::cout << "Runtime #" << pid << " connected\n";
+
+        // skip the AllocationTick payloads rather than letting the runtime drop events
+        if (_isDegradedModeEnabled)
+        {
+            pSession->EnableDegradedMode();
+        }
+
+        RuntimeEventListener* pListener = new RuntimeEventListener();
+        pSession->SetEventListener(pListener);
+        pSession->SetGenericEventHandler(pListener);
+
+        ::AcquireSRWLockExclusive(&_listenersLock);
+        _listeners[pSession] = pListener;
+        ::ReleaseSRWLockExclusive(&_listenersLock);
+
+        if (!_host.Add(pSession, this))
+        {
+            std::cout << "Impossible to listen to events from process #" << pid << "\n";
+            DeleteSession(pSession);
+        }
+    }
+
+    void OnSessionEnded(EventPipeSession* pSession, bool isStopped) override
+    {
+        // show the last parsing steps of this runtime if its stream was corrupted
+        // (not when the runtime simply exits)
+        if (pSession->HasFailed())
+        {
+            TRACE_DUMP(std::cout, pSession->_pid);
+        }
+
+        SessionStatisticsSnapshot snapshot;
+        pSession->GetStatistics(snapshot);
+        std::cout << "Runtime #" << pSession->_pid << " disconnected: "
+            << snapshot.EventsCount << " events in " << snapshot.BlocksCount << " blocks ("
+            << snapshot.ReceivedBytes / 1024 << " KB) - parsing took " << snapshot.ParserBusyUs / 1000 << " ms\n";
+
+        // too many events were enabled for the runtime buffers
+        EventLossStatistics lossStats;
+        pSession->GetEventLossStatistics(lossStats);
+        if (lossStats.DroppedEventsCount > 0)
+        {
+            std::cout << "   " << lossStats.DroppedEventsCount << " events dropped by the runtime (up to "
+                << lossStats.MaxIntervalDroppedEventsCount << " between two sequence points)\n";
+        }
+
+        DegradedModeStatistics degradedStats;
+        pSession->GetDegradedModeStatistics(degradedStats);
+        if (degradedStats.DegradedPeriodsCount > 0)
+        {
+            std::cout << "   degraded " << degradedStats.DegradedPeriodsCount << " times: "
+                << degradedStats.SkippedEventsCount << " events skipped (" << degradedStats.SkippedPayloadBytes / 1024 << " KB)\n";
+        }
+
+        DeleteSession(pSession, true);
+    }
+
+private:
+    // the endpoint of the runtime connection and the listener are not owned by the session
+    void DeleteSession(EventPipeSession* pSession, bool dumpListener = false)
+    {
+        ::AcquireSRWLockExclusive(&_listenersLock);
+        RuntimeEventListener* pListener = _listeners[pSession];
+        _listeners.erase(pSession);
+        ::ReleaseSRWLockExclusive(&_listenersLock);
+
+        if (dumpListener)
+        {
+            pListener->Dump();
+        }
+
+        IIpcEndpoint* pEndpoint = pSession->GetEndpoint();
+        delete pSession;
+        delete pEndpoint;
+        delete pListener;
+    }
+
+private:
+    EventPipeSessionHost _host;
+    bool _isDegradedModeEnabled;
+
+    // sessions are started by the server thread and ended by the event loop threads
+    SRWLOCK _listenersLock;
+    std::unordered_map<EventPipeSession*, RuntimeEventListener*> _listeners;
+};
+
+DWORD WINAPI RunServer(void* pParam)
+{
+    ReversedDiagnosticsServer* pServer = static_cast<ReversedDiagnosticsServer*>(pParam);
+
+    pServer->Run();
+
+    return 0;
+}
+
+// -pid   : pid
+// -in    : input filename
+// -out   : output filename
+// -bench : replay the input file with different read buffer sizes
+// -server: address (pipe name) set in DOTNET_DiagnosticPorts for the runtimes to connect to
+// -degraded: skip the low priority events while the parsing lags behind (-server only)
+void ParseCommandLine(int argc, wchar_t* argv[], DWORD& pid, const wchar_t*& inputFilename, const wchar_t*& outputFilename, bool& benchmark, const wchar_t*& serverAddress, bool& degradedMode)
 {
     pid = -1;
     inputFilename = nullptr;
     outputFilename = nullptr;
+    benchmark = false;
+    serverAddress = nullptr;
+    degradedMode = false;
 
     for (int i = 0; i < argc; i++)
     {
@@ -203,6 +423,25 @@ void ParseCommandLine(int argc, wchar_t* argv[], DWORD& pid, const wchar_t*& inp
 
             outputFilename = argv[i];
         }
+        else
+        if (lstrcmp(argv[i], L"-bench") == 0)
+        {
+            benchmark = true;
+        }
+        else
+        if (lstrcmp(argv[i], L"-server") == 0)
+        {
+            if (i + 1 == argc)
+                return;
+            i++;
+
+            serverAddress = argv[i];
+        }
+        else
+        if (lstrcmp(argv[i], L"-degraded") == 0)
+        {
+            degradedMode = true;
+        }
     }
 }
 
@@ -211,19 +450,69 @@ void ParseCommandLine(int argc, wchar_t* argv[], DWORD& pid, const wchar_t*& inp
 // 64 bit:  -pid 125152 -out d:\temp\diagnostics\recording.bin
 // -in d:\temp\diagnostics\record_5_exceptionsWithMissingMessage.bin
 // -in d:\temp\diagnostics\record_exceptions_wcoutBroken.bin
+// -bench -in d:\temp\diagnostics\recording_1GB.bin
+// -server NativeEventListener   (with DOTNET_DiagnosticPorts=NativeEventListener set for the monitored apps)
+// -server NativeEventListener -degraded
 int wmain(int argc, wchar_t* argv[])
 {
     // simulator pid
     DWORD pid = -1;
     const wchar_t* inputFilename;
     const wchar_t* outputFilename;
-    ParseCommandLine(argc, argv, pid, inputFilename, outputFilename);
-    if ((pid == -1) && (inputFilename == nullptr))
+    bool benchmark;
+    const wchar_t* serverAddress;
+    bool degradedMode;
+    ParseCommandLine(argc, argv, pid, inputFilename, outputFilename, benchmark, serverAddress, degradedMode);
+    if ((pid == -1) && (inputFilename == nullptr) && (serverAddress == nullptr))
     {
-        std::cout << "Missing -pid <pid> or -in <recording filename>...\n";
+        std::cout << "Missing -pid <pid>, -in <recording filename> or -server <address>...\n";
         return -1;
     }
 
+    // wait for runtimes to connect
+    if (serverAddress != nullptr)
+    {
+        ListeningSessionHandler handler(degradedMode);
+        if (!handler.Start())
+            return -1;
+
+        ReversedDiagnosticsServer server(
+            serverAddress,
+            EventKeyword::gc | EventKeyword::exception | EventKeyword::contention,
+            EventVerbosityLevel::Verbose,
+            handler.GetHost(),
+            &handler);
+        if (!server.Start())
+            return -1;
+
+        DWORD tid = 0;
+        auto hThread = ::CreateThread(nullptr, 0, RunServer, &server, 0, &tid);
+
+        std::cout << "Press ENTER to stop accepting runtimes...\n\n";
+        std::string line;
+        std::getline(std::cin, line);
+
+        server.Stop();
+        ::WaitForSingleObject(hThread, INFINITE);
+        ::CloseHandle(hThread);
+
+        handler.Stop();
+        return 0;
+    }
+
+    // replay a recording to measure the reading/parsing throughput
+    if (benchmark)
+    {
+        if (inputFilename == nullptr)
+        {
+            std::cout << "Missing -in <recording filename> for -bench...\n";
+            return -1;
+        }
+
+        RunReplayBenchmark(inputFilename);
+        return 0;
+    }
+
     //// direct connection and ProcessInfo command handling
     //BasicConnection(pid);
     //return 0;
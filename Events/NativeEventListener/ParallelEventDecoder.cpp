@@ -0,0 +1,201 @@
+#include "ParallelEventDecoder.h"
+#include "Log.h"
+
+
+ParallelEventDecoder::ParallelEventDecoder(
+    MetadataTable& metadata,
+    uint8_t pointerSize,
+    const HeaderDecodingSettings& headerDecoding,
+    uint32_t decodedEvents,
+    uint32_t workersCount,
+    uint64_t traceContext
+    )
+{
+    if (workersCount == 0)
+        workersCount = 1;
+
+    _maxPendingBlocks = workersCount * DecodingBlocksPerWorker;
+    _stopRequested = false;
+    _nextDecoder = 0;
+    _traceContext = traceContext;
+
+    _decodedBlocksCount = 0;
+    _decodedEventsCount = 0;
+    _decodedPayloadsCount = 0;
+    _deliveryStallCount = 0;
+
+    ::InitializeSRWLock(&_lock);
+    ::InitializeConditionVariable(&_workAvailable);
+    ::InitializeConditionVariable(&_blockDecoded);
+
+    // each worker needs its own parser state
+    for (uint32_t i = 0; i < workersCount; i++)
+    {
+        auto pDecoder = new EventBlockDecoder(metadata, decodedEvents);
+        pDecoder->SetPointerSize(pointerSize);
+        pDecoder->SetHeaderDecoding(headerDecoding);
+        _decoders.push_back(pDecoder);
+    }
+
+    for (uint32_t i = 0; i < workersCount; i++)
+    {
+        DWORD tid = 0;
+        HANDLE hThread = ::CreateThread(nullptr, 0, WorkerThreadProc, this, 0, &tid);
+        if (hThread != nullptr)
+            _workers.push_back(hThread);
+    }
+}
+
+ParallelEventDecoder::~ParallelEventDecoder()
+{
+    ::AcquireSRWLockExclusive(&_lock);
+    _stopRequested = true;
+    ::ReleaseSRWLockExclusive(&_lock);
+    ::WakeAllConditionVariable(&_workAvailable);
+
+    for (HANDLE hThread : _workers)
+    {
+        ::WaitForSingleObject(hThread, INFINITE);
+        ::CloseHandle(hThread);
+    }
+
+    for (auto pDecoder : _decoders)
+    {
+        delete pDecoder;
+    }
+
+    // the block buffers are owned by the caller
+    for (auto pBlock : _pendingBlocks)
+    {
+        delete pBlock;
+    }
+}
+
+DWORD WINAPI ParallelEventDecoder::WorkerThreadProc(void* pParam)
+{
+    ParallelEventDecoder* pDecoder = static_cast<ParallelEventDecoder*>(pParam);
+    pDecoder->WorkerLoop();
+
+    return 0;
+}
+
+void ParallelEventDecoder::WorkerLoop()
+{
+    EventBlockDecoder* pDecoder = _decoders[_nextDecoder++];
+    TRACE_SET_CONTEXT(_traceContext);
+
+    ::AcquireSRWLockExclusive(&_lock);
+    while (true)
+    {
+        while (_blocksToDecode.empty() && !_stopRequested)
+        {
+            ::SleepConditionVariableSRW(&_workAvailable, &_lock, INFINITE, 0);
+        }
+
+        if (_stopRequested)
+            break;
+
+        DecodedBlock* pBlock = _blocksToDecode.front();
+        _blocksToDecode.pop_front();
+        ::ReleaseSRWLockExclusive(&_lock);
+
+        // decode outside of the lock
+        pBlock->Success = pDecoder->Decode(pBlock->Block.pBlock, pBlock->Block.BlockSize, pBlock->Block.OriginInFile, pBlock->Records);
+        _decodedBlocksCount++;
+        _decodedEventsCount += pBlock->Records.size();
+
+        uint64_t decodedPayloadsCount = 0;
+        for (auto& record : pBlock->Records)
+        {
+            if (record.IsPayloadDecoded)
+                decodedPayloadsCount++;
+        }
+        _decodedPayloadsCount += decodedPayloadsCount;
+
+        ::AcquireSRWLockExclusive(&_lock);
+        pBlock->IsReady = true;
+        ::WakeAllConditionVariable(&_blockDecoded);
+    }
+    ::ReleaseSRWLockExclusive(&_lock);
+}
+
+void ParallelEventDecoder::Submit(const FramedBlock& block)
+{
+    DecodedBlock* pBlock = new DecodedBlock();
+    pBlock->Block = block;
+    pBlock->IsDecoded = (block.Type == ObjectType::EventBlock);
+    pBlock->Success = true;
+    _pendingBlocks.push_back(pBlock);
+
+    if (!pBlock->IsDecoded)
+    {
+        pBlock->IsReady = true;
+        return;
+    }
+
+    pBlock->IsReady = false;
+    ::AcquireSRWLockExclusive(&_lock);
+    _blocksToDecode.push_back(pBlock);
+    ::ReleaseSRWLockExclusive(&_lock);
+    ::WakeConditionVariable(&_workAvailable);
+}
+
+bool ParallelEventDecoder::IsFull()
+{
+    return _pendingBlocks.size() >= _maxPendingBlocks;
+}
+
+bool ParallelEventDecoder::IsEmpty()
+{
+    return _pendingBlocks.empty();
+}
+
+DecodedBlock* ParallelEventDecoder::WaitForOldest()
+{
+    if (_pendingBlocks.empty())
+        return nullptr;
+
+    DecodedBlock* pBlock = _pendingBlocks.front();
+
+    ::AcquireSRWLockExclusive(&_lock);
+    if (!pBlock->IsReady)
+    {
+        _deliveryStallCount++;
+        while (!pBlock->IsReady)
+        {
+            ::SleepConditionVariableSRW(&_blockDecoded, &_lock, INFINITE, 0);
+        }
+    }
+    ::ReleaseSRWLockExclusive(&_lock);
+
+    return pBlock;
+}
+
+void ParallelEventDecoder::ReleaseOldest()
+{
+    if (_pendingBlocks.empty())
+        return;
+
+    delete _pendingBlocks.front();
+    _pendingBlocks.pop_front();
+}
+
+void ParallelEventDecoder::GetStatistics(DecoderStatistics& stats)
+{
+    stats.DecodedBlocksCount = _decodedBlocksCount.load(std::memory_order_relaxed);
+    stats.DecodedEventsCount = _decodedEventsCount.load(std::memory_order_relaxed);
+    stats.DecodedPayloadsCount = _decodedPayloadsCount.load(std::memory_order_relaxed);
+    stats.DeliveryStallCount = _deliveryStallCount.load(std::memory_order_relaxed);
+}
+
+uint64_t ParallelEventDecoder::GetHeaderMismatchesCount()
+{
+    // the workers counts are published with the decoded blocks (under the lock)
+    uint64_t count = 0;
+    for (auto pDecoder : _decoders)
+    {
+        count += pDecoder->GetHeaderMismatchesCount();
+    }
+
+    return count;
+}
@@ -0,0 +1,95 @@
+#pragma once
+#include <atomic>
+#include <deque>
+#include <vector>
+#include <windows.h>
+
+#include "BlockParser.h"
+#include "BlockQueue.h"
+
+
+// number of blocks that could be decoded ahead of the delivery, per worker thread
+const uint32_t DecodingBlocksPerWorker = 4;
+
+
+// A block submitted to the decoder, delivered in stream order
+struct DecodedBlock
+{
+    FramedBlock Block;
+    bool IsDecoded;                     // only EventBlocks are decoded by the workers
+    bool IsReady;                       // set by the worker (guarded by the decoder lock)
+    bool Success;
+    std::vector<EventRecord> Records;
+};
+
+// can be read from any thread while the session is running
+struct DecoderStatistics
+{
+    uint64_t DecodedBlocksCount;
+    uint64_t DecodedEventsCount;
+    uint64_t DecodedPayloadsCount;      // events of the listener decoded by the workers
+    uint64_t DeliveryStallCount;        // number of times the oldest block was not decoded yet
+};
+
+
+// EventBlocks are decoded by a pool of worker threads (see EventBlockDecoder) and given back
+// in the order they were submitted so that the handlers still receive the events in stream order.
+// Other blocks are kept in the same delivery order without being decoded.
+// The metadata table must not be updated while blocks are pending (i.e. wait for IsEmpty() first).
+// Note: Submit() and the delivery functions must be called by the same thread
+class ParallelEventDecoder
+{
+public:
+    ParallelEventDecoder(
+        MetadataTable& metadata,
+        uint8_t pointerSize,
+        const HeaderDecodingSettings& headerDecoding,
+        uint32_t decodedEvents,         // see EventParser::GetPredecodedEvents()
+        uint32_t workersCount,
+        uint64_t traceContext           // the workers trace ring entries belong to the session
+        );
+    ~ParallelEventDecoder();
+
+    void Submit(const FramedBlock& block);
+
+    // too many blocks are waiting: time to deliver the oldest one
+    bool IsFull();
+    bool IsEmpty();
+
+    // wait for the oldest block to be decoded; it stays valid until ReleaseOldest()
+    DecodedBlock* WaitForOldest();
+    void ReleaseOldest();
+
+    void GetStatistics(DecoderStatistics& stats);
+
+    // sum of the workers count (see EventParserBase::SetHeaderDecoding)
+    // Note: must be called once the pending blocks have been delivered
+    uint64_t GetHeaderMismatchesCount();
+
+private:
+    static DWORD WINAPI WorkerThreadProc(void* pParam);
+    void WorkerLoop();
+
+private:
+    std::vector<HANDLE> _workers;
+    std::vector<EventBlockDecoder*> _decoders;  // one per worker
+    std::atomic<uint32_t> _nextDecoder;
+    uint32_t _maxPendingBlocks;
+    uint64_t _traceContext;
+
+    // blocks in delivery order (only accessed by the delivering thread)
+    std::deque<DecodedBlock*> _pendingBlocks;
+
+    // blocks waiting for a worker
+    SRWLOCK _lock;
+    CONDITION_VARIABLE _workAvailable;
+    CONDITION_VARIABLE _blockDecoded;
+    std::deque<DecodedBlock*> _blocksToDecode;
+    bool _stopRequested;
+
+    // statistics
+    std::atomic<uint64_t> _decodedBlocksCount;
+    std::atomic<uint64_t> _decodedEventsCount;
+    std::atomic<uint64_t> _decodedPayloadsCount;
+    std::atomic<uint64_t> _deliveryStallCount;
+};
@@ -0,0 +1,396 @@
+#include <iostream>
+
+#include "PayloadDecoder.h"
+#include "Log.h"
+
+
+static bool ReadInt32(const uint8_t*& p, const uint8_t* pEnd, uint32_t& value)
+{
+    if (pEnd - p < (ptrdiff_t)sizeof(value))
+        return false;
+
+    memcpy(&value, p, sizeof(value));
+    p += sizeof(value);
+    return true;
+}
+
+static bool ReadName(const uint8_t*& p, const uint8_t* pEnd, std::wstring& name)
+{
+    while (pEnd - p >= (ptrdiff_t)sizeof(uint16_t))
+    {
+        uint16_t character;
+        memcpy(&character, p, sizeof(character));
+        p += sizeof(character);
+
+        if (character == 0)
+            return true;
+
+        name.push_back(character);
+    }
+
+    return false;
+}
+
+
+DecodePlan::DecodePlan()
+{
+    _isValid = false;
+    _opcode = 0;
+    _fixedPrefixSize = 0;
+    _firstVariableField = 0;
+}
+
+uint32_t DecodePlan::GetFixedSize(PayloadTypeCode typeCode)
+{
+    switch (typeCode)
+    {
+        case PayloadTypeCode::SByte:
+        case PayloadTypeCode::Byte:
+            return 1;
+
+        case PayloadTypeCode::Char:
+        case PayloadTypeCode::Int16:
+        case PayloadTypeCode::UInt16:
+            return 2;
+
+        case PayloadTypeCode::Boolean:
+        case PayloadTypeCode::Int32:
+        case PayloadTypeCode::UInt32:
+        case PayloadTypeCode::Single:
+            return 4;
+
+        case PayloadTypeCode::Int64:
+        case PayloadTypeCode::UInt64:
+        case PayloadTypeCode::Double:
+        case PayloadTypeCode::DateTime:
+            return 8;
+
+        case PayloadTypeCode::Decimal:
+        case PayloadTypeCode::Guid:
+            return 16;
+
+        default:  // strings, arrays and unknown types
+            return 0;
+    }
+}
+
+bool DecodePlan::Build(const uint8_t* pDescriptors, uint32_t size)
+{
+    const uint8_t* p = pDescriptors;
+    const uint8_t* pEnd = pDescriptors + size;
+
+    // no descriptor at all for the events defined by a manifest in old runtimes
+    _isValid = false;
+    if (size == 0)
+        return false;
+
+    uint32_t count;
+    if (!ReadInt32(p, pEnd, count) || !ParseFields(p, pEnd, count, false))
+        return false;
+
+    // each tag is prefixed by the size of its payload
+    while (pEnd - p >= (ptrdiff_t)(sizeof(uint32_t) + sizeof(uint8_t)))
+    {
+        uint32_t tagSize;
+        ReadInt32(p, pEnd, tagSize);
+        MetadataTag tag = (MetadataTag)*p++;
+        if (tagSize > (uint32_t)(pEnd - p))
+            return false;
+
+        const uint8_t* pTagEnd = p + tagSize;
+        if (tag == MetadataTag::Opcode)
+        {
+            if (tagSize > 0)
+                _opcode = *p;
+        }
+        else
+        if (tag == MetadataTag::ParameterPayloadV2)
+        {
+            // replace the V1 fields (should be empty)
+            _fields.clear();
+            _fixedPrefixSize = 0;
+            _firstVariableField = 0;
+            if (!ReadInt32(p, pTagEnd, count) || !ParseFields(p, pTagEnd, count, true))
+                return false;
+        }
+
+        p = pTagEnd;
+    }
+
+    _isValid = true;
+    return true;
+}
+
+bool DecodePlan::ParseFields(const uint8_t*& p, const uint8_t* pEnd, uint32_t count, bool isV2)
+{
+    for (uint32_t i = 0; i < count; i++)
+    {
+        // the size of the V2 field descriptor is not needed
+        uint32_t value;
+        if (isV2 && !ReadInt32(p, pEnd, value))
+            return false;
+
+        PayloadField field = {};
+        if (!ReadInt32(p, pEnd, value))
+            return false;
+        field.TypeCode = (PayloadTypeCode)value;
+        field.ElementTypeCode = PayloadTypeCode::Empty;
+        field.Size = GetFixedSize(field.TypeCode);
+
+        size_t firstNestedField = _fields.size();
+        if (field.TypeCode == PayloadTypeCode::Array)
+        {
+            if (!isV2 || !ReadInt32(p, pEnd, value))
+                return false;
+            field.ElementTypeCode = (PayloadTypeCode)value;
+            field.Size = GetFixedSize(field.ElementTypeCode);
+
+            // an array of objects is supported only if their fields have a fixed size
+            if (field.ElementTypeCode == PayloadTypeCode::Object)
+            {
+                DecodePlan element;
+                if (!ReadInt32(p, pEnd, value) || !element.ParseFields(p, pEnd, value, isV2))
+                    return false;
+
+                if (element._firstVariableField != element._fields.size())
+                    return false;
+                field.Size = element._fixedPrefixSize;
+            }
+            else
+            if ((field.Size == 0) && (field.ElementTypeCode != PayloadTypeCode::String))
+            {
+                return false;
+            }
+        }
+        else
+        if (field.TypeCode == PayloadTypeCode::Object)
+        {
+            // the nested fields are stored inline in the payload
+            if (!ReadInt32(p, pEnd, value) || !ParseFields(p, pEnd, value, isV2))
+                return false;
+        }
+        else
+        if ((field.Size == 0) && (field.TypeCode != PayloadTypeCode::String))
+        {
+            LOG_VERBOSE("Unsupported payload field type " << (uint32_t)field.TypeCode << "\n");
+            return false;
+        }
+
+        // the name follows the nested fields
+        if (!ReadName(p, pEnd, field.Name))
+            return false;
+
+        if (field.TypeCode == PayloadTypeCode::Object)
+        {
+            for (size_t nested = firstNestedField; nested < _fields.size(); nested++)
+            {
+                _fields[nested].Name = field.Name + L"." + _fields[nested].Name;
+            }
+        }
+        else
+        {
+            AddField(field);
+        }
+    }
+
+    return true;
+}
+
+void DecodePlan::AddField(PayloadField& field)
+{
+    // the offset is known until the first variable size field (i.e. string or array)
+    bool isFixed = (field.Size != 0) && (field.TypeCode != PayloadTypeCode::Array);
+    if (isFixed && (_firstVariableField == _fields.size()))
+    {
+        field.IsFixedOffset = true;
+        field.Offset = _fixedPrefixSize;
+        _fixedPrefixSize += field.Size;
+        _firstVariableField++;
+    }
+    else
+    {
+        field.IsFixedOffset = false;
+        field.Offset = 0;
+    }
+
+    _fields.push_back(field);
+}
+
+int DecodePlan::FindField(const wchar_t* name) const
+{
+    for (size_t i = 0; i < _fields.size(); i++)
+    {
+        if (_fields[i].Name == name)
+            return (int)i;
+    }
+
+    return -1;
+}
+
+bool DecodePlan::Decode(const uint8_t* pPayload, uint32_t payloadSize, DecodedPayload& payload) const
+{
+    payload._pPlan = this;
+    payload._pPayload = pPayload;
+    payload._values.resize(_fields.size());
+
+    if (!_isValid || (payloadSize < _fixedPrefixSize))
+        return false;
+
+    // no need to look at the payload for the leading fixed size fields
+    size_t index = 0;
+    for (; index < _firstVariableField; index++)
+    {
+        payload._values[index] = { _fields[index].Offset, _fields[index].Size, 1 };
+    }
+
+    uint32_t pos = _fixedPrefixSize;
+    for (; index < _fields.size(); index++)
+    {
+        const PayloadField& field = _fields[index];
+        PayloadValue& value = payload._values[index];
+
+        if (field.TypeCode == PayloadTypeCode::String)
+        {
+            uint32_t charsCount = (payloadSize - pos) / sizeof(uint16_t);
+            uint32_t length = WStringView::ScanForEnd(pPayload + pos, charsCount, NoMaxCharacter);
+            if (length == charsCount)
+                return false;
+
+            value = { pos, length * (uint32_t)sizeof(uint16_t), length };
+            pos += (length + 1) * sizeof(uint16_t);
+        }
+        else
+        if (field.TypeCode == PayloadTypeCode::Array)
+        {
+            // the elements are prefixed by their count
+            uint16_t count;
+            if (payloadSize - pos < sizeof(count))
+                return false;
+            memcpy(&count, pPayload + pos, sizeof(count));
+            pos += sizeof(count);
+
+            uint32_t start = pos;
+            if (field.Size != 0)
+            {
+                uint64_t size = (uint64_t)count * field.Size;
+                if (size > payloadSize - pos)
+                    return false;
+                pos += (uint32_t)size;
+            }
+            else
+            {
+                // array of strings
+                for (uint16_t element = 0; element < count; element++)
+                {
+                    uint32_t charsCount = (payloadSize - pos) / sizeof(uint16_t);
+                    uint32_t length = WStringView::ScanForEnd(pPayload + pos, charsCount, NoMaxCharacter);
+                    if (length == charsCount)
+                        return false;
+                    pos += (length + 1) * sizeof(uint16_t);
+                }
+            }
+
+            value = { start, pos - start, count };
+        }
+        else
+        {
+            if (payloadSize - pos < field.Size)
+                return false;
+
+            value = { pos, field.Size, 1 };
+            pos += field.Size;
+        }
+    }
+
+    return true;
+}
+
+void DecodePlan::Dump() const
+{
+    std::cout << "   Fields  : " << _fields.size() << " (" << _fixedPrefixSize << " bytes at fixed offsets)\n";
+    for (auto& field : _fields)
+    {
+        std::wcout << L"      " << field.Name.c_str();
+        std::cout << " : type " << (uint32_t)field.TypeCode;
+        if (field.TypeCode == PayloadTypeCode::Array)
+            std::cout << "[" << (uint32_t)field.ElementTypeCode << "]";
+        if (field.IsFixedOffset)
+            std::cout << " @ " << field.Offset;
+        std::cout << "\n";
+    }
+}
+
+
+DecodedPayload::DecodedPayload()
+{
+    _pPlan = nullptr;
+    _pPayload = nullptr;
+}
+
+uint64_t DecodedPayload::GetUInt64(size_t index) const
+{
+    const PayloadValue& value = _values[index];
+    switch (value.Size)
+    {
+        case 1:
+            return *GetFieldData(index);
+
+        case 2:
+        {
+            uint16_t word;
+            memcpy(&word, GetFieldData(index), sizeof(word));
+            return word;
+        }
+
+        case 4:
+        {
+            uint32_t dword;
+            memcpy(&dword, GetFieldData(index), sizeof(dword));
+            return dword;
+        }
+
+        case 8:
+        {
+            uint64_t ulong;
+            memcpy(&ulong, GetFieldData(index), sizeof(ulong));
+            return ulong;
+        }
+
+        default:
+            return 0;
+    }
+}
+
+WStringView DecodedPayload::GetString(size_t index) const
+{
+    return WStringView(GetFieldData(index), _values[index].Count);
+}
+
+void DecodedPayload::Dump() const
+{
+    auto& fields = _pPlan->GetFields();
+    for (size_t i = 0; i < _values.size(); i++)
+    {
+        std::wcout << L"   " << fields[i].Name.c_str() << L" = ";
+        switch (fields[i].TypeCode)
+        {
+            case PayloadTypeCode::String:
+                std::wcout << GetString(i) << L"\n";
+                break;
+
+            case PayloadTypeCode::Array:
+                std::wcout << L"[" << _values[i].Count << L" elements]\n";
+                break;
+
+            case PayloadTypeCode::Single:
+            case PayloadTypeCode::Double:
+            case PayloadTypeCode::Decimal:
+            case PayloadTypeCode::Guid:
+                std::wcout << L"(" << _values[i].Size << L" bytes)\n";
+                break;
+
+            default:
+                std::wcout << GetUInt64(i) << L"\n";
+        }
+    }
+}
@@ -0,0 +1,138 @@
+#pragma once
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <windows.h>
+
+#include "WStringView.h"
+
+
+// look at:
+//  https://github.com/microsoft/perfview/blob/main/src/TraceEvent/EventPipe/EventPipeFormat.md
+//  Microsoft.Diagnostics.Tracing.EventPipeEventSource.ParseFields() in TraceEvent
+// Note: the runtime uses the System.TypeCode values (+ Guid and Array)
+enum class PayloadTypeCode : uint32_t
+{
+    Empty = 0,
+    Object = 1,
+    Boolean = 3,    // 4 bytes
+    Char = 4,
+    SByte = 5,
+    Byte = 6,
+    Int16 = 7,
+    UInt16 = 8,
+    Int32 = 9,
+    UInt32 = 10,
+    Int64 = 11,
+    UInt64 = 12,
+    Single = 13,
+    Double = 14,
+    Decimal = 15,
+    DateTime = 16,
+    Guid = 17,
+    String = 18,
+    Array = 19,     // only in V2 parameters
+};
+
+// metadata tags following the V1 fields list
+enum class MetadataTag : uint8_t
+{
+    Opcode = 1,
+    ParameterPayloadV2 = 2,
+};
+
+
+// Nested objects are flattened into their parent: their fields are named "<object>.<field>"
+struct PayloadField
+{
+    std::wstring Name;
+    PayloadTypeCode TypeCode;
+    PayloadTypeCode ElementTypeCode;    // for arrays
+    uint32_t Size;                      // fixed size of the field (of each element for arrays) or 0 if variable
+    uint32_t Offset;                    // from the beginning of the payload if IsFixedOffset
+    bool IsFixedOffset;                 // only preceded by fixed size fields
+};
+
+// where the value of a field is in a decoded payload
+struct PayloadValue
+{
+    uint32_t Offset;
+    uint32_t Size;
+    uint32_t Count;             // number of elements for arrays (1 otherwise)
+};
+
+
+class DecodedPayload;
+
+// Built once per MetadataId from the field descriptors of its metadata blob: the leading fixed size
+// fields get a precomputed offset so that only the fields after the first string or array need to be
+// walked for each event. Each MetadataId describes one version of an event so each version of its
+// layout gets its own plan.
+class DecodePlan
+{
+public:
+    DecodePlan();
+
+    // parse the V1 fields list and the optional metadata tags (Opcode, V2 parameters) that follow Level
+    // Note: the plan stays invalid if the descriptors are truncated or use an unsupported type
+    bool Build(const uint8_t* pDescriptors, uint32_t size);
+
+    bool IsValid() const { return _isValid; }
+    const std::vector<PayloadField>& GetFields() const { return _fields; }
+    int FindField(const wchar_t* name) const;
+    uint8_t GetOpcode() const { return _opcode; }
+
+    // compute where each field is in the payload (no copy)
+    bool Decode(const uint8_t* pPayload, uint32_t payloadSize, DecodedPayload& payload) const;
+
+    void Dump() const;
+
+private:
+    bool ParseFields(const uint8_t*& p, const uint8_t* pEnd, uint32_t count, bool isV2);
+    void AddField(PayloadField& field);
+    static uint32_t GetFixedSize(PayloadTypeCode typeCode);
+
+private:
+    bool _isValid;
+    uint8_t _opcode;
+    std::vector<PayloadField> _fields;
+    uint32_t _fixedPrefixSize;      // size of the fields with a fixed offset
+    size_t _firstVariableField;     // index of the first field without a fixed offset
+};
+
+
+// Typed access to the fields of a payload decoded with a plan
+// Note: like WStringView, it points to the block being parsed
+class DecodedPayload
+{
+public:
+    DecodedPayload();
+
+    const DecodePlan* GetPlan() const { return _pPlan; }
+    size_t GetFieldsCount() const { return _values.size(); }
+    const PayloadValue& GetValue(size_t index) const { return _values[index]; }
+    const uint8_t* GetFieldData(size_t index) const { return _pPayload + _values[index].Offset; }
+
+    // integers of 1, 2, 4 or 8 bytes (also Boolean)
+    uint64_t GetUInt64(size_t index) const;
+    WStringView GetString(size_t index) const;
+
+    void Dump() const;
+
+private:
+    friend class DecodePlan;
+
+    const DecodePlan* _pPlan;
+    const uint8_t* _pPayload;
+    std::vector<PayloadValue> _values;
+};
+
+
+// Called by the EventParser for the events without a dedicated handler
+class IGenericEventHandler
+{
+public:
+    virtual void OnGenericEvent(uint32_t metadataId, uint32_t eventId, const std::wstring& providerName, const DecodedPayload& payload) = 0;
+
+    virtual ~IGenericEventHandler() = default;
+};
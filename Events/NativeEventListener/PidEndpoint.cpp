@@ -2,28 +2,40 @@
 #include <stdio.h>
 
 #include "IIpcRecorder.h"
+#include "Log.h"
 #include "PidEndpoint.h"
 
 
-PidEndpoint::PidEndpoint(IIpcRecorder* pRecorder)
-    : IpcEndpoint(pRecorder)
+PidEndpoint::PidEndpoint(IIpcRecorder* pRecorder, DWORD readBufferSize)
+    : IpcEndpoint(pRecorder, readBufferSize)
 {
 }
 
-PidEndpoint* PidEndpoint::Create(int pid, IIpcRecorder* pRecorder)
+PidEndpoint::~PidEndpoint()
+{
+    Close();
+}
+
+PidEndpoint* PidEndpoint::Create(int pid, IIpcRecorder* pRecorder, DWORD readBufferSize)
 {
     if (pid <= 0)
         return nullptr;
 
-// TODO: implement the Linux version based on Domain Socket instead of named pipe
-
-    return CreateForWindows(pid, pRecorder);
+    // only the Windows named pipe transport is supported
+    return CreateForWindows(pid, pRecorder, readBufferSize);
+}
 
+PidEndpoint* PidEndpoint::CreateFromConnection(HANDLE hPipe, IIpcRecorder* pRecorder, DWORD readBufferSize)
+{
+    // the pipe instance must have been created with FILE_FLAG_OVERLAPPED
+    PidEndpoint* pEndpoint = new PidEndpoint(pRecorder, readBufferSize);
+    pEndpoint->_handle = hPipe;
+    return pEndpoint;
 }
 
-PidEndpoint* PidEndpoint::CreateForWindows(int pid, IIpcRecorder* pRecorder)
+PidEndpoint* PidEndpoint::CreateForWindows(int pid, IIpcRecorder* pRecorder, DWORD readBufferSize)
 {
-    PidEndpoint* pEndpoint = new PidEndpoint(pRecorder);
+    PidEndpoint* pEndpoint = new PidEndpoint(pRecorder, readBufferSize);
 
     // build the pipe name as described in the protocol
     wchar_t pszPipeName[256];
@@ -39,7 +51,7 @@ PidEndpoint* PidEndpoint::CreateForWindows(int pid, IIpcRecorder* pRecorder)
     if (!::WaitNamedPipe(pszPipeName, 200))
     {
         auto error = ::GetLastError();
-        std::cout << "Diagnostics named pipe is not available for process #" << pid << " (" << error << ")" << "\n";
+        LOG_ERROR("Diagnostics named pipe is not available for process #" << pid << " (" << error << ")" << "\n");
         return nullptr;
     }
 
@@ -52,12 +64,12 @@ PidEndpoint* PidEndpoint::CreateForWindows(int pid, IIpcRecorder* pRecorder)
         0,              // no sharing
         NULL,           // default security attributes
         OPEN_EXISTING,  // opens existing pipe
-        0,              // default attributes
+        FILE_FLAG_OVERLAPPED,  // read the next buffer while the current one is parsed
         NULL);          // no template file
 
     if (hPipe == INVALID_HANDLE_VALUE)
     {
-        std::cout << "Impossible to connect to " << pszPipeName << "\n";
+        LOG_ERROR_W(L"Impossible to connect to " << pszPipeName << L"\n");
         return nullptr;
     }
 
@@ -65,10 +77,18 @@ PidEndpoint* PidEndpoint::CreateForWindows(int pid, IIpcRecorder* pRecorder)
     return pEndpoint;
 }
 
+void PidEndpoint::CloseForWindows()
+{
+    ::CloseHandle(_handle);
+}
+
 bool PidEndpoint::Close()
 {
     if (_handle != 0)
     {
+        // don't leave a pending read on the buffer
+        CancelRawRead();
+
         // TODO: check for Linux
         CloseForWindows();
 
@@ -78,8 +98,3 @@ bool PidEndpoint::Close()
 
     return false;
 }
-
-void PidEndpoint::CloseForWindows()
-{
-    ::CloseHandle(_handle);
-}
@@ -6,15 +6,19 @@
 class PidEndpoint : public IpcEndpoint
 {
 public:
-    static PidEndpoint* Create(int pid, IIpcRecorder* pRecorder);
+    static PidEndpoint* Create(int pid, IIpcRecorder* pRecorder, DWORD readBufferSize = DefaultReadBufferSize);
+
+    // wrap a connection initiated by a runtime (see ReversedDiagnosticsServer)
+    static PidEndpoint* CreateFromConnection(HANDLE hPipe, IIpcRecorder* pRecorder, DWORD readBufferSize = DefaultReadBufferSize);
 
     virtual bool Close() override;
 
+protected:
+    ~PidEndpoint();
+
 private:
-    PidEndpoint(IIpcRecorder* pRecorder);
-    static PidEndpoint* CreateForWindows(int pid, IIpcRecorder* pRecorder);
-    //TODO: static PidEndpoint* CreateForLinux();
+    PidEndpoint(IIpcRecorder* pRecorder, DWORD readBufferSize);
+    static PidEndpoint* CreateForWindows(int pid, IIpcRecorder* pRecorder, DWORD readBufferSize);
 
     void CloseForWindows();
 };
-
@@ -1,23 +1,17 @@
 #pragma once
 
-#include "IIpcEndpoint.h"
+#include "IpcEndpoint.h"
 
-class RecordedEndpoint : public IIpcEndpoint
+// Replay a recorded session: the file is read by large chunks via IpcEndpoint buffering
+class RecordedEndpoint : public IpcEndpoint
 {
 public:
-    static RecordedEndpoint* Create(const wchar_t* recordFilename);
+    static RecordedEndpoint* Create(const wchar_t* recordFilename, DWORD readBufferSize = DefaultReadBufferSize);
 
     // Inherited via IIpcEndpoint
     // NOP operation
     virtual bool Write(LPCVOID buffer, DWORD bufferSize, DWORD* writtenBytes) override;
 
-    // read from the recorded file
-    virtual bool Read(LPVOID buffer, DWORD bufferSize, DWORD* readBytes) override;
-    virtual bool ReadByte(uint8_t& byte) override;
-    virtual bool ReadWord(uint16_t& word) override;
-    virtual bool ReadDWord(uint32_t& dword) override;
-    virtual bool ReadLong(uint64_t& ulong) override;
-
    // cleanup
     virtual bool Close() override;
 
@@ -25,9 +19,6 @@ protected:
     ~RecordedEndpoint();
 
 private:
-    RecordedEndpoint();
-
-private:
-    HANDLE _hFile;
+    RecordedEndpoint(DWORD readBufferSize);
 };
 
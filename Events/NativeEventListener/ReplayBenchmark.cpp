@@ -0,0 +1,452 @@
+#include <iostream>
+#include <iomanip>
+
+#include "ReplayBenchmark.h"
+#include "BlockParser.h"
+#include "DiagnosticsProtocol.h"
+#include "EventPipeSession.h"
+#include "RecordedEndpoint.h"
+#include "MappedEndpoint.h"
+
+
+// 0 means no buffering: one system call per Read like before read buffers were added
+const DWORD BenchmarkBufferSizes[] = { 0, MinReadBufferSize, DefaultReadBufferSize, MaxReadBufferSize };
+
+
+class ConsoleSilencer
+{
+public:
+    ConsoleSilencer()
+    {
+        _pOut = std::cout.rdbuf(nullptr);
+        _pWOut = std::wcout.rdbuf(nullptr);
+    }
+
+    ~ConsoleSilencer()
+    {
+        std::cout.rdbuf(_pOut);
+        std::wcout.rdbuf(_pWOut);
+        std::cout.clear();
+        std::wcout.clear();
+    }
+
+private:
+    std::streambuf* _pOut;
+    std::wstreambuf* _pWOut;
+};
+
+// return how many seconds the given action took
+template <class TAction>
+double MeasureSeconds(TAction action)
+{
+    LARGE_INTEGER frequency;
+    LARGE_INTEGER start;
+    LARGE_INTEGER end;
+    ::QueryPerformanceFrequency(&frequency);
+    ::QueryPerformanceCounter(&start);
+    action();
+    ::QueryPerformanceCounter(&end);
+
+    return (double)(end.QuadPart - start.QuadPart) / frequency.QuadPart;
+}
+
+// replay the recording from the given endpoint and return how long it took
+// Note: the events are delivered in timestamp order if pOrderingStats is not null
+//       and the compressed header decoding mismatches are counted if pHeaderMismatchesCount is not null
+double ReplayOnce(
+    IIpcEndpoint* pEndpoint,
+    uint32_t decodingThreadsCount = 0,
+    OrderingStatistics* pOrderingStats = nullptr,
+    const HeaderDecodingSettings& headerDecoding = DefaultHeaderDecoding,
+    uint64_t* pHeaderMismatchesCount = nullptr
+    )
+{
+    return MeasureSeconds([&]()
+    {
+        ConsoleSilencer silencer;
+
+        // the recording starts with the response to the EventPipe collect command
+        EventPipeStartRequest request;
+        if (request.Process(pEndpoint, 0, EventVerbosityLevel::Verbose))
+        {
+            EventPipeSession session(-1, pEndpoint, request.SessionId);
+            session.SetDecodingThreadsCount(decodingThreadsCount);
+            session.SetHeaderDecoding(headerDecoding);
+            if (pOrderingStats != nullptr)
+            {
+                session.EnableEventOrdering();
+            }
+            session.Listen();
+
+            if (pOrderingStats != nullptr)
+            {
+                session.GetOrderingStatistics(*pOrderingStats);
+            }
+            if (pHeaderMismatchesCount != nullptr)
+            {
+                *pHeaderMismatchesCount = session.GetHeaderMismatchesCount();
+            }
+        }
+    });
+}
+
+// statically dispatched listener subscribed to all the events so that their payload gets decoded
+class BenchmarkListener : public EventListenerBase<BenchmarkListener>
+{
+public:
+    static constexpr uint32_t SubscribedEvents = AllListenedEvents;
+
+    BenchmarkListener()
+    {
+        EventsCount = 0;
+        AllocatedBytes = 0;
+    }
+
+    void OnAllocationTick(const EventContext& context, const AllocationTickEvent& event) { EventsCount++; AllocatedBytes += event.Amount64; }
+    void OnExceptionThrown(const EventContext& context, const ExceptionThrownEvent& event) { EventsCount++; }
+    void OnContentionStop(const EventContext& context, const ContentionStopEvent& event) { EventsCount++; }
+    void OnGcStart(const EventContext& context, const GcStartEvent& event) { EventsCount++; }
+    void OnGcEnd(const EventContext& context, const GcEndEvent& event) { EventsCount++; }
+
+public:
+    uint64_t EventsCount;
+    uint64_t AllocatedBytes;
+};
+
+// replay the recording with the BenchmarkListener and return how long it took
+double ReplayWithListener(IIpcEndpoint* pEndpoint, uint32_t decodingThreadsCount, BenchmarkListener& listener, DecoderStatistics& decoderStats)
+{
+    return MeasureSeconds([&]()
+    {
+        ConsoleSilencer silencer;
+
+        EventPipeStartRequest request;
+        if (request.Process(pEndpoint, 0, EventVerbosityLevel::Verbose))
+        {
+            EventPipeSession session(-1, pEndpoint, request.SessionId);
+            session.SetDecodingThreadsCount(decodingThreadsCount);
+            session.SetEventListener(&listener);
+            session.Listen();
+
+            session.GetDecoderStatistics(decoderStats);
+        }
+    });
+}
+
+// the buffered endpoints make read calls while the mapped endpoint only asks the system to prefetch pages
+void DumpReplayResult(const char* mode, uint64_t readCalls, uint64_t prefetchCalls, uint64_t readBytes, double duration)
+{
+    double mb = (double)readBytes / (1024 * 1024);
+    std::cout << std::setfill(' ')
+        << std::setw(10) << mode
+        << std::setw(13) << readCalls
+        << std::setw(13) << prefetchCalls
+        << std::fixed << std::setprecision(1)
+        << std::setw(12) << mb
+        << std::setprecision(3)
+        << std::setw(12) << duration
+        << std::setprecision(1)
+        << std::setw(12) << ((duration > 0) ? mb / duration : 0)
+        << std::defaultfloat << "\n";
+}
+
+// synthetic BulkNode payloads like the ones sent by the CLR during a gcdump
+const uint32_t BenchmarkNodesPerEvent = 1000;
+const uint32_t BenchmarkBulkNodeEvents = 10000;
+
+double DecodeBulkNodes(EventParser& parser, std::vector<uint8_t>& payload, bool isCheckedPerField)
+{
+    return MeasureSeconds([&]()
+    {
+        ConsoleSilencer silencer;
+        for (uint32_t i = 0; i < BenchmarkBulkNodeEvents; i++)
+        {
+            parser.DecodeBulkNode(payload.data(), (uint32_t)payload.size(), isCheckedPerField);
+        }
+    });
+}
+
+// add the nodes to a started gcdump one after the other or decoded in columns and added at once
+double IngestBulkNodes(GcDumpState& gcDump, std::vector<uint8_t>& payload, bool isBatched)
+{
+    const uint8_t* pNodes = payload.data() + sizeof(uint32_t) * 2 + sizeof(uint16_t);
+    BulkNodeBatch batch;
+
+    return MeasureSeconds([&]()
+    {
+        for (uint32_t i = 0; i < BenchmarkBulkNodeEvents; i++)
+        {
+            if (isBatched)
+            {
+                batch.Decode<uint64_t>(pNodes, BenchmarkNodesPerEvent);
+                gcDump.AddLiveObjects(batch);
+                continue;
+            }
+
+            RangeReader reader(pNodes);
+            for (uint32_t node = 0; node < BenchmarkNodesPerEvent; node++)
+            {
+                uint64_t address = reader.Read<uint64_t>();
+                uint64_t size = reader.ReadLong();
+                uint64_t typeId = reader.ReadLong();
+                uint64_t edgeCount = reader.ReadLong();
+
+                gcDump.AddLiveObject(address, typeId, size, edgeCount);
+            }
+        }
+    });
+}
+
+// add the edges of each BulkNode event (same targets for all events) and resolve them at the end of the gcdump
+double BuildHeapGraph(GcDumpState& gcDump, std::vector<uint8_t>& edges)
+{
+    uint32_t edgesCount = (uint32_t)(edges.size() / HeapGraph::GetEdgeSize<uint64_t>());
+
+    return MeasureSeconds([&]()
+    {
+        for (uint32_t i = 0; i < BenchmarkBulkNodeEvents; i++)
+        {
+            gcDump.AddEdges<uint64_t>(edges.data(), edgesCount);
+        }
+
+        ConsoleSilencer silencer;
+        gcDump.OnGcEnd(1, 2);
+    });
+}
+
+// Index + Count + ClrInstanceID followed by Address/Size/TypeID/EdgeCount (64 bit) per node
+// with the type changing every typeRunLength nodes among 64 types
+void BuildBulkNodePayload(std::vector<uint8_t>& payload, uint64_t typeRunLength)
+{
+    payload.resize(sizeof(uint32_t) * 2 + sizeof(uint16_t) + BenchmarkNodesPerEvent * 4 * sizeof(uint64_t));
+    uint8_t* p = payload.data();
+    uint32_t index = 0;
+    memcpy(p, &index, sizeof(index));
+    memcpy(p + sizeof(uint32_t), &BenchmarkNodesPerEvent, sizeof(uint32_t));
+    uint64_t* pNode = reinterpret_cast<uint64_t*>(p + sizeof(uint32_t) * 2 + sizeof(uint16_t));
+    for (uint64_t i = 0; i < BenchmarkNodesPerEvent; i++)
+    {
+        uint64_t node[4] = { 0x7FF000000000 + i * 24, 24, 0x7FF800001000 + ((i / typeRunLength) % 64) * 8, i % 4 };
+        memcpy(pNode + i * 4, node, sizeof(node));
+    }
+}
+
+void RunBulkNodeBenchmark()
+{
+    // a different type for each node
+    std::vector<uint8_t> payload;
+    BuildBulkNodePayload(payload, 1);
+
+    // the objects of the same type are often allocated (and listed) together
+    std::vector<uint8_t> runsPayload;
+    BuildBulkNodePayload(runsPayload, 16);
+
+    MetadataTable metadata;
+    std::unordered_map<uint64_t, EventCacheThread> threads;
+    EventLossTracker lossTracker(threads);
+    SessionStatistics statistics;
+    EventParser parser(metadata, lossTracker, statistics);
+    parser.SetPointerSize(8);
+
+    std::cout << "\nBulkNode decoding (" << BenchmarkBulkNodeEvents << " events x " << BenchmarkNodesPerEvent << " nodes)\n";
+    std::cout << "---------------------------------------------------------------------\n";
+    std::cout << "    Checks         Seconds    M nodes/s\n";
+
+    double nodes = (double)BenchmarkBulkNodeEvents * BenchmarkNodesPerEvent / 1000000;
+    const char* modes[] = { "per field", "per array" };
+    for (int i = 0; i < 2; i++)
+    {
+        double duration = DecodeBulkNodes(parser, payload, i == 0);
+        std::cout << std::setfill(' ')
+            << std::setw(10) << modes[i]
+            << std::fixed << std::setprecision(3)
+            << std::setw(16) << duration
+            << std::setprecision(1)
+            << std::setw(13) << ((duration > 0) ? nodes / duration : 0)
+            << std::defaultfloat << "\n";
+    }
+
+    // the decoded nodes are kept only during an induced gen2 GC with the types received before
+    std::cout << "\n    Ingestion      Seconds    M nodes/s    Bytes/node\n";
+    const char* ingestionModes[] = { "per node", "batch", "batch runs" };
+    for (int i = 0; i < 3; i++)
+    {
+        GcDumpState gcDump;
+        gcDump.OnGcStart(1, 2, GCReason::Induced, GCType::NonConcurrentGC);
+        for (uint64_t type = 0; type < 64; type++)
+        {
+            gcDump.OnTypeMapping(0x7FF800001000 + type * 8, 0, "Type" + std::to_string(type));
+        }
+
+        double duration = IngestBulkNodes(gcDump, (i == 2) ? runsPayload : payload, i != 0);
+        const LiveObjectStore& objects = gcDump.GetLiveObjects();
+        std::cout << std::setfill(' ')
+            << std::setw(13) << ingestionModes[i]
+            << std::fixed << std::setprecision(3)
+            << std::setw(13) << duration
+            << std::setprecision(1)
+            << std::setw(13) << ((duration > 0) ? nodes / duration : 0)
+            << std::setw(14) << ((objects.GetCount() > 0) ? (double)objects.GetMemorySize() / objects.GetCount() : 0)
+            << std::defaultfloat << "\n";
+
+        if (i != 1)
+            continue;
+
+        // each node references the next EdgeCount nodes of the same event
+        std::vector<uint8_t> edges;
+        for (uint64_t node = 0; node < BenchmarkNodesPerEvent; node++)
+        {
+            for (uint64_t edge = 0; edge < node % 4; edge++)
+            {
+                uint64_t target = 0x7FF000000000 + ((node + edge + 1) % BenchmarkNodesPerEvent) * 24;
+                uint32_t fieldId = 0;
+                edges.insert(edges.end(), (uint8_t*)&target, (uint8_t*)&target + sizeof(target));
+                edges.insert(edges.end(), (uint8_t*)&fieldId, (uint8_t*)&fieldId + sizeof(fieldId));
+            }
+        }
+
+        duration = BuildHeapGraph(gcDump, edges);
+        const HeapGraph& graph = gcDump.GetGraph();
+        double edgesCount = (double)graph.GetEdgesCount() / 1000000;
+        std::cout << std::setfill(' ')
+            << std::setw(13) << "graph"
+            << std::fixed << std::setprecision(3)
+            << std::setw(13) << duration
+            << std::setprecision(1)
+            << std::setw(13) << ((duration > 0) ? edgesCount / duration : 0)
+            << std::setw(14) << ((objects.GetCount() > 0) ? (double)graph.GetMemorySize() / objects.GetCount() : 0)
+            << std::defaultfloat << "  (M edges/s, bytes/node)\n";
+    }
+}
+
+void RunReplayBenchmark(const wchar_t* recordFilename)
+{
+    RunBulkNodeBenchmark();
+
+    std::cout << "\nReplay benchmark\n";
+    std::cout << "---------------------------------------------------------------------\n";
+    std::cout << "    Buffer   Read calls   Prefetches          MB     Seconds        MB/s\n";
+
+    for (DWORD bufferSize : BenchmarkBufferSizes)
+    {
+        RecordedEndpoint* pEndpoint = RecordedEndpoint::Create(recordFilename, bufferSize);
+        if (pEndpoint == nullptr)
+        {
+            std::wcout << L"Impossible to open " << recordFilename << L"\n";
+            return;
+        }
+
+        double duration = ReplayOnce(pEndpoint);
+
+        char mode[16];
+        sprintf_s(mode, "%u KB", bufferSize / 1024);
+        DumpReplayResult(mode, pEndpoint->GetReadCallsCount(), 0, pEndpoint->GetReadBytesCount(), duration);
+
+        // the destructor is only accessible via the interface
+        pEndpoint->Close();
+        delete static_cast<IIpcEndpoint*>(pEndpoint);
+    }
+
+    // zero copy replay from a memory mapped file: no read call, only prefetch requests
+    MappedEndpoint* pMappedEndpoint = MappedEndpoint::Create(recordFilename);
+    if (pMappedEndpoint == nullptr)
+    {
+        std::wcout << L"Impossible to map " << recordFilename << L"\n";
+        return;
+    }
+
+    double duration = ReplayOnce(pMappedEndpoint);
+    DumpReplayResult("mapped", 0, pMappedEndpoint->GetPrefetchCallsCount(), pMappedEndpoint->GetFileSize(), duration);
+
+    pMappedEndpoint->Close();
+    delete static_cast<IIpcEndpoint*>(pMappedEndpoint);
+
+    // same replay with a branch per flag to decode the compressed headers instead of one decoder
+    // per flags value: the difference comes from the mispredicted branches when providers are mixed
+    pMappedEndpoint = MappedEndpoint::Create(recordFilename);
+    if (pMappedEndpoint == nullptr)
+        return;
+
+    HeaderDecodingSettings branchyDecoding = { false, false };
+    duration = ReplayOnce(pMappedEndpoint, 0, nullptr, branchyDecoding);
+    DumpReplayResult("branchy", 0, pMappedEndpoint->GetPrefetchCallsCount(), pMappedEndpoint->GetFileSize(), duration);
+
+    pMappedEndpoint->Close();
+    delete static_cast<IIpcEndpoint*>(pMappedEndpoint);
+
+    // events delivered in timestamp order: the cost of the k-way merge and the added latency
+    pMappedEndpoint = MappedEndpoint::Create(recordFilename);
+    if (pMappedEndpoint == nullptr)
+        return;
+
+    OrderingStatistics orderingStats = {};
+    duration = ReplayOnce(pMappedEndpoint, 0, &orderingStats);
+    DumpReplayResult("ordered", 0, pMappedEndpoint->GetPrefetchCallsCount(), pMappedEndpoint->GetFileSize(), duration);
+
+    pMappedEndpoint->Close();
+    delete static_cast<IIpcEndpoint*>(pMappedEndpoint);
+
+    uint64_t averageLatencyUs = (orderingStats.OrderedEventsCount > 0) ? orderingStats.TotalAddedLatencyUs / orderingStats.OrderedEventsCount : 0;
+    std::cout << "\n   " << orderingStats.OrderedEventsCount << " events ordered (" << orderingStats.UnsortedEventsCount << " unsorted) in "
+        << orderingStats.FlushCount << " flushes (" << orderingStats.ForcedFlushCount << " forced)\n";
+    std::cout << "   added latency: " << averageLatencyUs << " us on average, " << orderingStats.MaxAddedLatencyUs << " us max"
+        << " - peak buffered: " << orderingStats.PeakBufferedBytes / 1024 << " KB\n";
+
+    // EventBlocks decoded by worker threads, including the payload of the listened events:
+    // only the handlers are called serially so it should scale with the number of cores
+    // Note: 0 thread is the serial parsing used as the baseline for the speedup
+    std::cout << "\nParallel decoding (listener subscribed to all events)\n";
+    std::cout << "---------------------------------------------------------------------\n";
+    std::cout << "   Threads     Seconds     Speedup      Events    Payloads      Stalls\n";
+
+    SYSTEM_INFO info;
+    ::GetSystemInfo(&info);
+    double serialDuration = 0;
+    for (uint32_t threadsCount = 0; threadsCount <= info.dwNumberOfProcessors; threadsCount = (threadsCount == 0) ? 1 : threadsCount * 2)
+    {
+        pMappedEndpoint = MappedEndpoint::Create(recordFilename);
+        if (pMappedEndpoint == nullptr)
+            return;
+
+        BenchmarkListener listener;
+        DecoderStatistics decoderStats = {};
+        duration = ReplayWithListener(pMappedEndpoint, threadsCount, listener, decoderStats);
+        if (threadsCount == 0)
+            serialDuration = duration;
+
+        std::cout << std::setfill(' ')
+            << std::setw(10) << threadsCount
+            << std::fixed << std::setprecision(3)
+            << std::setw(12) << duration
+            << std::setprecision(2)
+            << std::setw(11) << ((duration > 0) ? serialDuration / duration : 0) << "x"
+            << std::defaultfloat
+            << std::setw(12) << listener.EventsCount
+            << std::setw(12) << decoderStats.DecodedPayloadsCount
+            << std::setw(12) << decoderStats.DeliveryStallCount
+            << "\n";
+
+        pMappedEndpoint->Close();
+        delete static_cast<IIpcEndpoint*>(pMappedEndpoint);
+    }
+
+    // the word-at-a-time compressed headers decoding (with and without the flag specialized decoders)
+    // must give the same headers as the byte per byte one
+    const char* decoders[] = { "flag specialized", "branchy" };
+    for (int i = 0; i < 2; i++)
+    {
+        pMappedEndpoint = MappedEndpoint::Create(recordFilename);
+        if (pMappedEndpoint == nullptr)
+            return;
+
+        HeaderDecodingSettings validatedDecoding = { i == 0, true };
+        uint64_t mismatchesCount = 0;
+        ReplayOnce(pMappedEndpoint, 0, nullptr, validatedDecoding, &mismatchesCount);
+
+        pMappedEndpoint->Close();
+        delete static_cast<IIpcEndpoint*>(pMappedEndpoint);
+
+        std::cout << (i == 0 ? "\n" : "") << "   " << mismatchesCount
+            << " compressed header decoding mismatches (" << decoders[i] << ")\n";
+    }
+}
@@ -0,0 +1,13 @@
+#pragma once
+
+#include <windows.h>
+
+// Replay a recorded session (see -out command line option) through the same parsing code
+// as a live session with different read buffer sizes and from a memory mapped file
+// to compare the number of read system calls and the throughput in MB/s.
+// The memory mapped replay is also run with 1, 2, 4... EventBlocks decoding threads (mapped/<threads>)
+// and with the events delivered in timestamp order (ordered) to measure the added latency.
+// The BulkNode decoding is also measured with one boundary check per field vs one per array.
+// The compressed event headers are decoded twice (word-at-a-time and byte per byte) to check that they match.
+// Note: the console output is disabled during the replay to only measure reading + parsing
+void RunReplayBenchmark(const wchar_t* recordFilename);
@@ -0,0 +1,332 @@
+#include <iostream>
+
+#include "ReversedDiagnosticsServer.h"
+#include "PidEndpoint.h"
+#include "Log.h"
+
+
+// number of connections that can be accepted at the same time
+const size_t PendingConnectionsCount = 16;
+
+// runtimes that did not reconnect since that long are forgotten
+const ULONGLONG RuntimeExpirationMs = 10 * 60 * 1000;
+const size_t MaxRuntimesCount = 64 * 1024;
+
+
+ReversedDiagnosticsServer::ReversedDiagnosticsServer(const wchar_t* address, uint64_t keywords, EventVerbosityLevel verbosity, EventPipeSessionHost* pHost, IReversedSessionHandler* pHandler)
+    :
+    _address(address),
+    _keywords(keywords),
+    _verbosity(verbosity),
+    _pHost(pHost),
+    _pHandler(pHandler)
+{
+    Error = 0;
+    _stopRequested = false;
+    _hStopEvent = ::CreateEvent(nullptr, TRUE, FALSE, nullptr);
+}
+
+ReversedDiagnosticsServer::~ReversedDiagnosticsServer()
+{
+    // the pending I/Os were started by the Run() thread so CancelIo would not cancel them from here
+    // Note: the kernel could still write into Message/Overlapped until the I/O has completed
+    for (auto& instance : _instances)
+    {
+        if (instance.hPipe != INVALID_HANDLE_VALUE)
+        {
+            if (instance.IsIoPending)
+            {
+                DWORD transferred = 0;
+                ::CancelIoEx(instance.hPipe, &instance.Overlapped);
+                ::GetOverlappedResult(instance.hPipe, &instance.Overlapped, &transferred, TRUE);
+                instance.IsIoPending = false;
+            }
+            ::CloseHandle(instance.hPipe);
+        }
+        ::CloseHandle(instance.Overlapped.hEvent);
+    }
+    ::CloseHandle(_hStopEvent);
+}
+
+// A new runtime gets an EventPipe session and is then resumed on the next connection.
+// The runtime waits for a command on each advertised connection and only reconnects once it has
+// been used or closed: the following connection is kept as is until the runtime exits.
+// Note: the commands are sent without waiting for their response
+void ReversedDiagnosticsServer::OnAdvertise(IpcAdvertiseMessage& message, IIpcEndpoint* pEndpoint)
+{
+    if (memcmp(message.Magic, &DotnetAdvertiseMagic_V1, sizeof(message.Magic)) != 0)
+    {
+        LOG_ERROR("Invalid advertise message\n");
+        pEndpoint->Close();
+        delete pEndpoint;
+        return;
+    }
+
+    std::string cookie(reinterpret_cast<const char*>(message.runtimeCookie), sizeof(message.runtimeCookie));
+    auto& runtime = _runtimes[cookie];
+    runtime.LastConnectionTime = ::GetTickCount64();
+
+    if (!runtime.IsSessionStarted)
+    {
+        runtime.IsSessionStarted = true;
+
+        EventPipeStartRequest request;
+        if (!request.Send(pEndpoint, _keywords, _verbosity))
+        {
+            LOG_ERROR("Impossible to start an EventPipe session for process #" << message.processId << "\n");
+            pEndpoint->Close();
+            delete pEndpoint;
+            return;
+        }
+
+        // the connection now belongs to the session that will receive the response
+        GUID runtimeCookie;
+        memcpy(&runtimeCookie, message.runtimeCookie, sizeof(runtimeCookie));
+        auto pSession = new EventPipeSession((int)message.processId, pEndpoint, 0);
+        pSession->ExpectStartResponse();
+        _pHandler->OnSessionStarted(message.processId, runtimeCookie, pSession);
+        return;
+    }
+
+    if (!runtime.IsResumed)
+    {
+        runtime.IsResumed = true;
+
+        // the connection is closed when the response is received
+        ResumeRuntimeRequest request;
+        if (request.Send(pEndpoint) && _pHost->AddCommand(pEndpoint, message.processId, this))
+        {
+            ForgetOldRuntimes();
+            return;
+        }
+
+        LOG_ERROR("Impossible to resume process #" << message.processId << "\n");
+    }
+    else
+    {
+        // the runtime does not send anything on a spare connection: the read only completes when it exits
+        if (_pHost->AddCommand(pEndpoint, message.processId, &_spareHandler))
+        {
+            ForgetOldRuntimes();
+            return;
+        }
+
+        LOG_ERROR("Impossible to keep the connection of process #" << message.processId << ": it will reconnect\n");
+    }
+
+    pEndpoint->Close();
+    delete pEndpoint;
+
+    ForgetOldRuntimes();
+}
+
+void ReversedDiagnosticsServer::OnCommandResponse(IIpcEndpoint* pEndpoint, uint64_t pid, const IpcHeader* pResponse)
+{
+    ResumeRuntimeRequest request;
+    if ((pResponse == nullptr) || !request.CheckResponse(*pResponse))
+    {
+        LOG_ERROR("Impossible to resume process #" << pid << "\n");
+    }
+
+    pEndpoint->Close();
+    delete pEndpoint;
+}
+
+void ReversedDiagnosticsServer::SpareConnectionHandler::OnCommandResponse(IIpcEndpoint* pEndpoint, uint64_t pid, const IpcHeader* pResponse)
+{
+    LOG_VERBOSE("Spare connection of process #" << pid << " closed\n");
+
+    pEndpoint->Close();
+    delete pEndpoint;
+}
+
+void ReversedDiagnosticsServer::ForgetOldRuntimes()
+{
+    if (_runtimes.size() < MaxRuntimesCount)
+        return;
+
+    ULONGLONG now = ::GetTickCount64();
+    for (auto current = _runtimes.begin(); current != _runtimes.end();)
+    {
+        if (now - current->second.LastConnectionTime > RuntimeExpirationMs)
+            current = _runtimes.erase(current);
+        else
+            ++current;
+    }
+}
+
+void ReversedDiagnosticsServer::Stop()
+{
+    _stopRequested = true;
+
+    ::SetEvent(_hStopEvent);
+}
+
+
+bool ReversedDiagnosticsServer::Start()
+{
+    _instances.resize(PendingConnectionsCount);
+    _events.resize(PendingConnectionsCount + 1);
+    for (size_t i = 0; i < PendingConnectionsCount; i++)
+    {
+        _instances[i].hPipe = INVALID_HANDLE_VALUE;
+        _instances[i].IsIoPending = false;
+        _instances[i].Overlapped = {};
+        _instances[i].Overlapped.hEvent = ::CreateEvent(nullptr, TRUE, FALSE, nullptr);
+        _events[i] = _instances[i].Overlapped.hEvent;
+
+        if (!CreateInstance(i))
+            return false;
+    }
+    _events[PendingConnectionsCount] = _hStopEvent;
+
+    return true;
+}
+
+// create a new instance of the pipe and wait for a runtime to connect
+bool ReversedDiagnosticsServer::CreateInstance(size_t index)
+{
+    auto& instance = _instances[index];
+
+    std::wstring pipeName = L"\\\\.\\pipe\\" + _address;
+    instance.hPipe = ::CreateNamedPipe(
+        pipeName.c_str(),
+        PIPE_ACCESS_DUPLEX | FILE_FLAG_OVERLAPPED,  // overlapped is needed by IpcEndpoint
+        PIPE_TYPE_BYTE | PIPE_READMODE_BYTE | PIPE_WAIT,
+        PIPE_UNLIMITED_INSTANCES,
+        MaxReadBufferSize,
+        MaxReadBufferSize,
+        0,
+        nullptr);
+    if (instance.hPipe == INVALID_HANDLE_VALUE)
+    {
+        Error = ::GetLastError();
+        LOG_ERROR("Impossible to create diagnostics pipe instance: 0x" << std::hex << Error << std::dec << "\n");
+        return false;
+    }
+
+    instance.State = InstanceState::Connecting;
+    HANDLE hEvent = instance.Overlapped.hEvent;
+    instance.Overlapped = {};
+    instance.Overlapped.hEvent = hEvent;
+    if (::ConnectNamedPipe(instance.hPipe, &instance.Overlapped))
+    {
+        ::SetEvent(hEvent);
+        return true;
+    }
+
+    auto error = ::GetLastError();
+    if (error == ERROR_PIPE_CONNECTED)
+    {
+        // the runtime connected between CreateNamedPipe and ConnectNamedPipe
+        ::SetEvent(hEvent);
+        return true;
+    }
+
+    if (error != ERROR_IO_PENDING)
+    {
+        Error = error;
+        LOG_ERROR("Error while waiting for a runtime to connect: 0x" << std::hex << Error << std::dec << "\n");
+        return false;
+    }
+
+    instance.IsIoPending = true;
+    return true;
+}
+
+bool ReversedDiagnosticsServer::Run()
+{
+    while (!_stopRequested)
+    {
+        DWORD result = ::WaitForMultipleObjects((DWORD)_events.size(), _events.data(), FALSE, INFINITE);
+        if (result == WAIT_FAILED)
+        {
+            Error = ::GetLastError();
+            return false;
+        }
+
+        size_t index = result - WAIT_OBJECT_0;
+        if (index == PendingConnectionsCount)  // stop event
+            break;
+
+        if (!OnInstanceSignaled(index))
+            return false;
+    }
+
+    return true;
+}
+
+// read the rest of the advertise message
+bool ReversedDiagnosticsServer::ReadAdvertise(size_t index)
+{
+    auto& instance = _instances[index];
+    HANDLE hEvent = instance.Overlapped.hEvent;
+    instance.Overlapped = {};
+    instance.Overlapped.hEvent = hEvent;
+
+    uint8_t* pMessage = reinterpret_cast<uint8_t*>(&instance.Message);
+    DWORD size = sizeof(instance.Message) - instance.ReceivedBytes;
+    if (::ReadFile(instance.hPipe, pMessage + instance.ReceivedBytes, size, nullptr, &instance.Overlapped) ||
+        (::GetLastError() == ERROR_IO_PENDING))
+    {
+        instance.IsIoPending = true;
+        return true;
+    }
+
+    return false;
+}
+
+// state machine per pipe instance: Connecting --> ReadingAdvertise --> handled + new instance
+bool ReversedDiagnosticsServer::OnInstanceSignaled(size_t index)
+{
+    auto& instance = _instances[index];
+    ::ResetEvent(instance.Overlapped.hEvent);
+
+    DWORD transferred = 0;
+    bool success = ::GetOverlappedResult(instance.hPipe, &instance.Overlapped, &transferred, FALSE);
+    instance.IsIoPending = false;
+
+    if (success && (instance.State == InstanceState::Connecting))
+    {
+        // the advertise message is sent by the runtime right after the connection
+        instance.State = InstanceState::ReadingAdvertise;
+        instance.ReceivedBytes = 0;
+        if (ReadAdvertise(index))
+            return true;
+
+        success = false;
+    }
+    else
+    if (success && (transferred > 0))
+    {
+        // the message could be received in several parts: only 0 byte means a disconnection
+        instance.ReceivedBytes += transferred;
+        if (instance.ReceivedBytes < sizeof(instance.Message))
+        {
+            if (ReadAdvertise(index))
+                return true;
+
+            success = false;
+        }
+    }
+    else
+    {
+        success = false;
+    }
+
+    if (success)
+    {
+        // the pipe instance now belongs to the endpoint
+        auto pEndpoint = PidEndpoint::CreateFromConnection(instance.hPipe, nullptr);
+        instance.hPipe = INVALID_HANDLE_VALUE;
+        OnAdvertise(instance.Message, pEndpoint);
+    }
+    else
+    {
+        // the runtime has disconnected
+        ::CloseHandle(instance.hPipe);
+        instance.hPipe = INVALID_HANDLE_VALUE;
+    }
+
+    return CreateInstance(index);
+}
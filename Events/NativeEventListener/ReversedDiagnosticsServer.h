@@ -0,0 +1,115 @@
+#pragma once
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "DiagnosticsProtocol.h"
+#include "EventPipeSession.h"
+#include "EventPipeSessionHost.h"
+
+
+// Notified each time a runtime has connected and an EventPipe session has been started for it
+class IReversedSessionHandler
+{
+public:
+    // it is up to the handler to listen to the session (and delete it)
+    // Note: the start command has been sent but its response (and the SessionId) is received
+    //       with the nettrace stream so the session can only be listened to asynchronously
+    virtual void OnSessionStarted(uint64_t pid, const GUID& runtimeCookie, EventPipeSession* pSession) = 0;
+
+    virtual ~IReversedSessionHandler() = default;
+};
+
+
+// from https://github.com/dotnet/diagnostics/blob/main/documentation/design-docs/ipc-protocol.md
+//
+// When a runtime is started with DOTNET_DiagnosticPorts=<address>, it connects to the address
+// (a named pipe), sends an IpcAdvertiseMessage and then waits for ONE command on that connection.
+// It immediately reconnects so that another command can be sent.
+// By default, the runtime startup is suspended until a ResumeRuntime command is received.
+//
+// For each new runtime, the server starts an EventPipe session on the first connection and resumes
+// the runtime on the second one. The next connection is kept open without sending any command until
+// the runtime exits (as dotnet-monitor does): closing it would make the runtime reconnect immediately,
+// again and again for as long as it runs. All connections are accepted from a single event loop thread
+// (WaitForMultipleObjects on the pipe instances) so that a lot of short lived processes can be
+// monitored without polling their pid. The commands are only sent from that thread: their responses
+// are received by the host event loops so that a slow runtime does not delay the other connections.
+class ReversedDiagnosticsServer : public ICommandResponseHandler
+{
+public:
+    ReversedDiagnosticsServer(const wchar_t* address, uint64_t keywords, EventVerbosityLevel verbosity, EventPipeSessionHost* pHost, IReversedSessionHandler* pHandler);
+    ~ReversedDiagnosticsServer();
+
+    // create the listening pipe instances
+    bool Start();
+
+    // accept connections until Stop() is called (from another thread)
+    bool Run();
+    void Stop();
+
+    // Implements ICommandResponseHandler interface (called from a host event loop thread)
+    virtual void OnCommandResponse(IIpcEndpoint* pEndpoint, uint64_t pid, const IpcHeader* pResponse) override;
+
+public:
+    DWORD Error;
+
+private:
+    // the spare connections are read by the host event loops only to know when they are closed
+    class SpareConnectionHandler : public ICommandResponseHandler
+    {
+    public:
+        virtual void OnCommandResponse(IIpcEndpoint* pEndpoint, uint64_t pid, const IpcHeader* pResponse) override;
+    };
+
+private:
+    void OnAdvertise(IpcAdvertiseMessage& message, IIpcEndpoint* pEndpoint);
+    void ForgetOldRuntimes();
+
+    bool CreateInstance(size_t index);
+    bool OnInstanceSignaled(size_t index);
+    bool ReadAdvertise(size_t index);
+
+private:
+    // per runtime state, identified by its cookie
+    struct RuntimeState
+    {
+        bool IsSessionStarted;
+        bool IsResumed;
+        ULONGLONG LastConnectionTime;
+    };
+
+    std::wstring _address;
+    uint64_t _keywords;
+    EventVerbosityLevel _verbosity;
+    EventPipeSessionHost* _pHost;
+    IReversedSessionHandler* _pHandler;
+    SpareConnectionHandler _spareHandler;
+    bool _stopRequested;
+
+    //                 cookie bytes
+    std::unordered_map<std::string, RuntimeState> _runtimes;
+
+    // pipe instances waiting for a runtime to connect
+    enum class InstanceState
+    {
+        Connecting,
+        ReadingAdvertise,
+    };
+
+    struct PipeInstance
+    {
+        HANDLE hPipe;
+        OVERLAPPED Overlapped;
+        InstanceState State;
+        bool IsIoPending;   // ConnectNamedPipe or ReadFile not completed yet
+        IpcAdvertiseMessage Message;
+        DWORD ReceivedBytes;    // of Message
+    };
+
+    std::vector<PipeInstance> _instances;
+    std::vector<HANDLE> _events;    // one per instance + stop event
+    HANDLE _hStopEvent;
+};
+
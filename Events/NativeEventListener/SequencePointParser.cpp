@@ -2,13 +2,16 @@
 #include <iomanip>
 
 #include "BlockParser.h"
+#include "Log.h"
 
 SequencePointParser::SequencePointParser(
     std::unordered_map<uint32_t, EventCacheStack32>& stacks32,
-    std::unordered_map<uint32_t, EventCacheStack64>& stacks64
+    std::unordered_map<uint32_t, EventCacheStack64>& stacks64,
+    EventLossTracker& lossTracker
 ) :
     _stacks32(stacks32),
-    _stacks64(stacks64)
+    _stacks64(stacks64),
+    _lossTracker(lossTracker)
 {
 }
 
@@ -34,7 +37,7 @@ bool SequencePointParser::OnParse()
     _stacks32.clear();
     _stacks64.clear();
 
-    std::cout << "========================================================\n";
+    LOG_VERBOSE("========================================================\n");
 
     // read header
     uint64_t timestamp;
@@ -42,15 +45,16 @@ bool SequencePointParser::OnParse()
 
     if (!ReadLong(timestamp))
     {
-        std::cout << "Error while reading timestamp\n";
+        LOG_ERROR("Error while reading timestamp\n");
         return false;
     }
     if (!ReadDWord(threadCount))
     {
-        std::cout << "Error while reading thread count\n";
+        LOG_ERROR("Error while reading thread count\n");
         return false;
     }
-    DumpSequencePointHeader(timestamp, threadCount);
+    TRACE_STEP(TraceId::SequencePoint, timestamp, threadCount);
+    LOG_VERBOSE_DUMP(DumpSequencePointHeader(timestamp, threadCount));
 
     // read per thread sequence number
     uint64_t threadId;
@@ -59,18 +63,22 @@ bool SequencePointParser::OnParse()
     {
         if (!ReadLong(threadId))
         {
-            std::cout << "Error while reading thread id #" << currentThread << "\n";
+            LOG_ERROR("Error while reading thread id #" << currentThread << "\n");
             return false;
         }
 
         if (!ReadDWord(sequenceNumber))
         {
-            std::cout << "Error while reading sequence number #" << currentThread << "\n";
+            LOG_ERROR("Error while reading sequence number #" << currentThread << "\n");
             return false;
         }
 
-        std::cout << "   " << std::setw(8) << threadId << " | " << sequenceNumber << "\n";
+        LOG_VERBOSE("   " << std::setw(8) << threadId << " | " << sequenceNumber << "\n");
+        _lossTracker.OnSequencePoint(threadId, sequenceNumber);
     }
 
+    // the events dropped since the previous sequence point are now known
+    _lossTracker.EndSequencePoint(timestamp);
+
     return true;
 }
\ No newline at end of file
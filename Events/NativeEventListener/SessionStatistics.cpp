@@ -0,0 +1,190 @@
+#include "SessionStatistics.h"
+
+
+SessionStatistics::SessionStatistics()
+{
+    ::QueryPerformanceFrequency(&_frequency);
+    _startTicks = GetTicks();
+
+    _receivedBytes = 0;
+    for (auto& count : _blocksCount)
+    {
+        count = 0;
+    }
+    _eventsCount = 0;
+    for (auto& count : _eventIdsCount)
+    {
+        count = 0;
+    }
+    _eventIdPairsCount = 0;
+    for (auto& count : _providerEventsCount)
+    {
+        count = 0;
+    }
+    _providersCount = 0;
+
+    for (auto& histogram : _handlers)
+    {
+        for (auto& count : histogram.Counts)
+        {
+            count = 0;
+        }
+        histogram.Count = 0;
+        histogram.TotalTicks = 0;
+    }
+
+    _readerReadTicks = 0;
+    _readerStallTicks = 0;
+    _parserWaitTicks = 0;
+    _parserBusyTicks = 0;
+}
+
+uint64_t SessionStatistics::TicksToUs(uint64_t ticks)
+{
+    return ticks / _frequency.QuadPart * 1000000 + (ticks % _frequency.QuadPart) * 1000000 / _frequency.QuadPart;
+}
+
+uint64_t SessionStatistics::TicksToNs(uint64_t ticks)
+{
+    return ticks / _frequency.QuadPart * 1000000000 + (ticks % _frequency.QuadPart) * 1000000000 / _frequency.QuadPart;
+}
+
+void SessionStatistics::OnBlock(ObjectType type, uint32_t blockSize)
+{
+    Add(_receivedBytes, blockSize);
+    if ((size_t)type < BlockTypesCount)
+    {
+        Add(_blocksCount[(size_t)type], 1);
+    }
+}
+
+// the provider and event ID indexes are cached by the caller per definition (0 means not known yet)
+void SessionStatistics::OnEvent(uint32_t eventId, uint32_t& providerIndex, uint32_t& eventIdIndex, const std::wstring& providerName)
+{
+    Add(_eventsCount, 1);
+
+    if (providerIndex == 0)
+    {
+        uint32_t count = _providersCount.load(std::memory_order_relaxed);
+        uint32_t index = 0;
+        while ((index < count) && (_providerNames[index] != providerName))
+        {
+            index++;
+        }
+
+        if ((index == count) && (count < MaxCountedProviders))
+        {
+            _providerNames[count] = providerName;
+            _providersCount.store(count + 1, std::memory_order_release);
+        }
+
+        // the last slot counts the providers that did not fit
+        providerIndex = ((index < MaxCountedProviders) ? index : MaxCountedProviders) + 1;
+    }
+
+    Add(_providerEventsCount[providerIndex - 1], 1);
+
+    // the same event ID has a different meaning for each provider
+    // Note: several definitions (i.e. versions) share the same pair
+    if (eventIdIndex == 0)
+    {
+        uint32_t count = _eventIdPairsCount.load(std::memory_order_relaxed);
+        uint32_t index = 0;
+        while ((index < count) && ((_eventIds[index] != eventId) || (_eventIdProviders[index] != providerIndex)))
+        {
+            index++;
+        }
+
+        if ((index == count) && (count < MaxCountedEventIds))
+        {
+            _eventIdProviders[count] = providerIndex;
+            _eventIds[count] = eventId;
+            _eventIdPairsCount.store(count + 1, std::memory_order_release);
+        }
+
+        // the last slot counts the pairs that did not fit
+        eventIdIndex = ((index < MaxCountedEventIds) ? index : MaxCountedEventIds) + 1;
+    }
+
+    Add(_eventIdsCount[eventIdIndex - 1], 1);
+}
+
+void SessionStatistics::OnHandlerCalled(EventHandlerId handler, uint64_t ticks)
+{
+    Histogram& histogram = _handlers[(size_t)handler];
+
+    uint64_t ns = TicksToNs(ticks);
+    uint32_t bucket = 0;
+    while ((ns >> (bucket + 1)) != 0 && (bucket < HistogramBucketsCount - 1))
+    {
+        bucket++;
+    }
+
+    Add(histogram.Counts[bucket], 1);
+    Add(histogram.Count, 1);
+    Add(histogram.TotalTicks, ticks);
+}
+
+void SessionStatistics::GetSnapshot(SessionStatisticsSnapshot& snapshot)
+{
+    snapshot.ElapsedUs = TicksToUs(GetTicks() - _startTicks);
+    snapshot.ReceivedBytes = _receivedBytes.load(std::memory_order_relaxed);
+    snapshot.BlocksCount = 0;
+    for (size_t i = 0; i < BlockTypesCount; i++)
+    {
+        snapshot.BlocksCountPerType[i] = _blocksCount[i].load(std::memory_order_relaxed);
+        snapshot.BlocksCount += snapshot.BlocksCountPerType[i];
+    }
+    snapshot.EventsCount = _eventsCount.load(std::memory_order_relaxed);
+
+    // the provider names of the pairs are set before the pairs themselves
+    uint32_t eventIdPairsCount = _eventIdPairsCount.load(std::memory_order_acquire);
+    uint32_t providersCount = _providersCount.load(std::memory_order_acquire);
+
+    snapshot.EventIds.clear();
+    for (uint32_t i = 0; i < eventIdPairsCount; i++)
+    {
+        uint32_t providerIndex = _eventIdProviders[i];
+        const wchar_t* providerName = (providerIndex <= MaxCountedProviders) ? _providerNames[providerIndex - 1].c_str() : L"<other>";
+        snapshot.EventIds.push_back({ providerName, _eventIds[i], _eventIdsCount[i].load(std::memory_order_relaxed) });
+    }
+    snapshot.OtherEventIdsCount = _eventIdsCount[MaxCountedEventIds].load(std::memory_order_relaxed);
+
+    snapshot.Providers.clear();
+    for (uint32_t i = 0; i < providersCount; i++)
+    {
+        snapshot.Providers.push_back({ _providerNames[i], _providerEventsCount[i].load(std::memory_order_relaxed) });
+    }
+    uint64_t otherProvidersCount = _providerEventsCount[MaxCountedProviders].load(std::memory_order_relaxed);
+    if (otherProvidersCount != 0)
+    {
+        snapshot.Providers.push_back({ L"<other>", otherProvidersCount });
+    }
+
+    for (size_t i = 0; i < (size_t)EventHandlerId::Count; i++)
+    {
+        for (uint32_t bucket = 0; bucket < HistogramBucketsCount; bucket++)
+        {
+            snapshot.Handlers[i].Counts[bucket] = _handlers[i].Counts[bucket].load(std::memory_order_relaxed);
+        }
+        snapshot.Handlers[i].Count = _handlers[i].Count.load(std::memory_order_relaxed);
+        snapshot.Handlers[i].TotalNs = TicksToNs(_handlers[i].TotalTicks.load(std::memory_order_relaxed));
+    }
+
+    snapshot.ReaderReadUs = TicksToUs(_readerReadTicks.load(std::memory_order_relaxed));
+    snapshot.ReaderStallUs = TicksToUs(_readerStallTicks.load(std::memory_order_relaxed));
+    snapshot.ParserWaitUs = TicksToUs(_parserWaitTicks.load(std::memory_order_relaxed));
+    snapshot.ParserBusyUs = TicksToUs(_parserBusyTicks.load(std::memory_order_relaxed));
+}
+
+void SessionStatistics::ComputeRates(const SessionStatisticsSnapshot& previous, const SessionStatisticsSnapshot& current, SessionRates& rates)
+{
+    rates = {};
+    if (current.ElapsedUs <= previous.ElapsedUs)
+        return;
+
+    double seconds = (double)(current.ElapsedUs - previous.ElapsedUs) / 1000000;
+    rates.BytesPerSecond = (current.ReceivedBytes - previous.ReceivedBytes) / seconds;
+    rates.BlocksPerSecond = (current.BlocksCount - previous.BlocksCount) / seconds;
+    rates.EventsPerSecond = (current.EventsCount - previous.EventsCount) / seconds;
+}
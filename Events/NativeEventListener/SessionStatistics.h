@@ -0,0 +1,158 @@
+#pragma once
+#include <atomic>
+#include <string>
+#include <vector>
+#include <windows.h>
+#include <stdint.h>
+
+#include "NettraceFormat.h"
+
+
+// events are counted per (provider, event ID) up to that many different pairs
+const uint32_t MaxCountedEventIds = 1024;
+const uint32_t MaxCountedProviders = 64;
+const size_t BlockTypesCount = (size_t)ObjectType::SequencePointBlock + 1;
+
+// bucket i counts the durations in [2^i, 2^(i+1)) ns (the last one also counts the longer ones)
+const uint32_t HistogramBucketsCount = 32;
+
+// only the events with a handler in EventParser are timed
+enum class EventHandlerId : uint8_t
+{
+    AllocationTick,
+    ContentionStop,
+    ExceptionThrown,
+    GcStart,
+    GcEnd,
+    BulkType,
+    BulkNode,
+    BulkEdge,
+
+    Count,
+    None = Count
+};
+
+struct DurationHistogram
+{
+    uint64_t Counts[HistogramBucketsCount];
+    uint64_t Count;
+    uint64_t TotalNs;
+};
+
+struct EventIdCount
+{
+    std::wstring ProviderName;
+    uint32_t EventId;
+    uint64_t Count;
+};
+
+struct ProviderCount
+{
+    std::wstring ProviderName;
+    uint64_t Count;
+};
+
+// copied from the counters while the session is running
+// Note: the rates are computed from two snapshots (see ComputeRates)
+struct SessionStatisticsSnapshot
+{
+    uint64_t ElapsedUs;                         // since the session has been created
+    uint64_t ReceivedBytes;                     // nettrace blocks
+    uint64_t BlocksCount;
+    uint64_t BlocksCountPerType[BlockTypesCount];
+    uint64_t EventsCount;
+
+    std::vector<EventIdCount> EventIds;         // in the order they were first received
+    uint64_t OtherEventIdsCount;                // pairs received after MaxCountedEventIds other ones
+    std::vector<ProviderCount> Providers;
+
+    DurationHistogram Handlers[(size_t)EventHandlerId::Count];
+
+    // where the time goes: a reader that mostly waits for the pipe and a busy parser
+    // means that the listener is the bottleneck
+    uint64_t ReaderReadUs;                      // waiting for the bytes of the next block
+    uint64_t ReaderStallUs;                     // waiting for the parser (queue full)
+    uint64_t ParserWaitUs;                      // waiting for the reader (queue empty)
+    uint64_t ParserBusyUs;                      // parsing the blocks and calling the handlers
+};
+
+struct SessionRates
+{
+    double BytesPerSecond;
+    double BlocksPerSecond;
+    double EventsPerSecond;
+};
+
+
+// Counters updated by the reader and parser threads and read from any thread without lock.
+// Each counter has only one writer so it is updated with relaxed loads/stores instead of
+// interlocked operations: a reader could see a slightly old value but never a torn one.
+class SessionStatistics
+{
+public:
+    SessionStatistics();
+
+    static uint64_t GetTicks()
+    {
+        LARGE_INTEGER now;
+        ::QueryPerformanceCounter(&now);
+        return now.QuadPart;
+    }
+
+    // parser thread
+    void OnBlock(ObjectType type, uint32_t blockSize);
+    void OnEvent(uint32_t eventId, uint32_t& providerIndex, uint32_t& eventIdIndex, const std::wstring& providerName);
+    void OnHandlerCalled(EventHandlerId handler, uint64_t ticks);
+    void OnParserWait(uint64_t ticks) { Add(_parserWaitTicks, ticks); }
+    void OnParserBusy(uint64_t ticks) { Add(_parserBusyTicks, ticks); }
+
+    // reader thread
+    void OnReaderRead(uint64_t ticks) { Add(_readerReadTicks, ticks); }
+    void OnReaderStall(uint64_t ticks) { Add(_readerStallTicks, ticks); }
+
+    // any thread
+    void GetSnapshot(SessionStatisticsSnapshot& snapshot);
+    static void ComputeRates(const SessionStatisticsSnapshot& previous, const SessionStatisticsSnapshot& current, SessionRates& rates);
+
+private:
+    // single writer
+    static void Add(std::atomic<uint64_t>& counter, uint64_t value)
+    {
+        counter.store(counter.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+    }
+
+    uint64_t TicksToUs(uint64_t ticks);
+    uint64_t TicksToNs(uint64_t ticks);
+
+private:
+    LARGE_INTEGER _frequency;
+    uint64_t _startTicks;
+
+    std::atomic<uint64_t> _receivedBytes;
+    std::atomic<uint64_t> _blocksCount[BlockTypesCount];
+    std::atomic<uint64_t> _eventsCount;
+
+    // the key is set before the pairs count is incremented so readers only see initialized keys
+    uint32_t _eventIdProviders[MaxCountedEventIds];     // provider index
+    uint32_t _eventIds[MaxCountedEventIds];
+    std::atomic<uint64_t> _eventIdsCount[MaxCountedEventIds + 1];  // + other pairs
+    std::atomic<uint32_t> _eventIdPairsCount;
+
+    // the name is set before the count is incremented so readers only see initialized names
+    std::wstring _providerNames[MaxCountedProviders];
+    std::atomic<uint64_t> _providerEventsCount[MaxCountedProviders + 1];  // + other providers
+    std::atomic<uint32_t> _providersCount;
+
+    struct Histogram
+    {
+        std::atomic<uint64_t> Counts[HistogramBucketsCount];
+        std::atomic<uint64_t> Count;
+        std::atomic<uint64_t> TotalTicks;
+    };
+    Histogram _handlers[(size_t)EventHandlerId::Count];
+
+    std::atomic<uint64_t> _readerReadTicks;
+    std::atomic<uint64_t> _readerStallTicks;
+    std::atomic<uint64_t> _parserWaitTicks;
+    std::atomic<uint64_t> _parserBusyTicks;
+};
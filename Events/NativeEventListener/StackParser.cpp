@@ -1,6 +1,7 @@
 #include <iostream>
 
 #include "BlockParser.h"
+#include "Log.h"
 
 
 StackParser::StackParser(
@@ -10,6 +11,16 @@ StackParser::StackParser(
 _stacks32(stacks32),
 _stacks64(stacks64)
 {
+    // will be set later when the pointer size is known
+    SetPointerSize(sizeof(uint64_t));
+}
+
+void StackParser::SetPointerSize(uint8_t pointerSize)
+{
+    BlockParser::SetPointerSize(pointerSize);
+
+    // the frames are read without checking the bitness for each of them
+    _pfnParseStack = (pointerSize == sizeof(uint64_t)) ? &StackParser::ParseStack64 : &StackParser::ParseStack32;
 }
 
 
@@ -18,12 +29,12 @@ bool StackParser::OnParse()
     StackBlockHeader stackHeader;
     if (!Read(&stackHeader, sizeof(stackHeader)))
     {
-        std::cout << "Error while reading stack block header\n";
+        LOG_ERROR("Error while reading stack block header\n");
         return false;
     }
 
     // TODO: uncomment to dump stack header
-    DumpStackHeader(stackHeader);
+    LOG_VERBOSE_DUMP(DumpStackHeader(stackHeader));
 
     // from https://github.com/microsoft/perfview/blob/main/src/TraceEvent/EventPipe/EventPipeFormat.md
     //
@@ -38,7 +49,7 @@ bool StackParser::OnParse()
     DWORD stackSize = 0;
     DWORD totalStacksSize = 0;
     DWORD remainingBlockSize = _blockSize - sizeof(stackHeader);
-    while (ParseStack(stackId, stackSize))
+    while ((this->*_pfnParseStack)(stackId, stackSize))
     {
         stackId++;
         totalStacksSize += stackSize;
@@ -50,7 +61,7 @@ bool StackParser::OnParse()
             uint8_t tag;
             if (!ReadByte(tag) || (tag != NettraceTag::EndObject))
             {
-                std::cout << "Missing end of block tag: " << (uint8_t)tag << "\n";
+                LOG_ERROR("Missing end of block tag: " << (uint8_t)tag << "\n");
                 return false;
             }
 
@@ -61,65 +72,46 @@ bool StackParser::OnParse()
     return false;
 }
 
-bool StackParser::ParseStack(uint32_t stackId, DWORD& size)
+template <class TPointer, class TStack>
+bool StackParser::ParseStack(uint32_t stackId, DWORD& size, std::unordered_map<uint32_t, TStack>& stacks)
 {
     uint32_t stackSize;
     if (!ReadDWord(stackSize))
     {
-        std::cout << "Error while reading stack #" << stackId << "\n";
+        LOG_ERROR("Error while reading stack #" << stackId << "\n");
         return false;
     }
     size += sizeof(stackSize);
 
-    uint16_t frameCount = stackSize / PointerSize;
+    uint16_t frameCount = stackSize / sizeof(TPointer);
 
     // check for empty stacks
     if (frameCount == 0)
         return true;
 
-    if (PointerSize == 8)
+    // the frames are copied at once after a single check
+    const uint8_t* pFrames;
+    if (!TryGetRange(frameCount * sizeof(TPointer), pFrames))
     {
-        _stacks64[stackId].Id = stackId;
-        _stacks64[stackId].Frames.reserve(frameCount);
-    }
-    else
-    {
-        _stacks32[stackId].Id = stackId;
-        _stacks32[stackId].Frames.reserve(frameCount);
+        LOG_ERROR("Error while reading the " << frameCount << " frames of stack #" << stackId << "\n");
+        return false;
     }
+    size += frameCount * sizeof(TPointer);
 
-    //std::cout << frameCount << " frames\n";
-    // add frames
-    for (size_t i = 0; i < frameCount; i++)
-    {
-        if (PointerSize == 8)
-        {
-            uint64_t frame;
-            if (!ReadLong(frame))
-            {
-                std::cout << "Error while reading stack frame #" << i << "\n";
-                return false;
-            }
-            size += sizeof(frame);
+    auto& stack = stacks[stackId];
+    stack.Id = stackId;
+    stack.Frames.resize(frameCount);
+    memcpy(stack.Frames.data(), pFrames, frameCount * sizeof(TPointer));
 
-            _stacks64[stackId].Frames.push_back(frame);
-            //std::cout << "   " << std::hex << frame << std::dec << "\n";
-        }
-        else
-        {
-            uint32_t frame;
-            if (!ReadDWord(frame))
-            {
-                auto error = ::GetLastError();
-                std::cout << "Error while reading stack frame #" << i << "\n";
-                return false;
-            }
-            size += sizeof(frame);
+    return true;
+}
 
-            _stacks32[stackId].Frames.push_back(frame);
-            //std::cout << "   " << std::hex << frame << std::dec << "\n";
-        }
-    }
+bool StackParser::ParseStack32(uint32_t stackId, DWORD& size)
+{
+    return ParseStack<uint32_t>(stackId, size, _stacks32);
+}
 
-    return true;
+bool StackParser::ParseStack64(uint32_t stackId, DWORD& size)
+{
+    return ParseStack<uint64_t>(stackId, size, _stacks64);
 }
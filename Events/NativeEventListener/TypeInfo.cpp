@@ -4,7 +4,8 @@ TypeInfo::TypeInfo()
 {
     _id = 0;
     _name = "";
-    _instances.reserve(1024);
+    _instancesCount = 0;
+    _instancesSize = 0;
 }
 
 void TypeInfo::SetId(uint64_t id)
@@ -17,7 +18,8 @@ void TypeInfo::SetName(std::string name)
     _name = name;
 }
 
-void TypeInfo::AddInstance(uint64_t address, uint64_t size)
+void TypeInfo::AddInstance(uint64_t size)
 {
-    _instances.push_back(LiveObject(address, _id, size));
-}
\ No newline at end of file
+    _instancesCount++;
+    _instancesSize += size;
+}
@@ -1,21 +1,21 @@
 #pragma once
 
+#include <stdint.h>
 #include <string>
-#include <vector>
 
-#include "LiveObject.h"
 
+// the instances are stored in the LiveObjectStore of the GcDumpState: only their count and size are kept per type
 class TypeInfo
 {
 public:
     TypeInfo();
     void SetId(uint64_t id);
     void SetName(std::string name);
-    void AddInstance(uint64_t address, uint64_t size);
+    void AddInstance(uint64_t size);
 
 public:
     uint64_t _id;
     std::string _name;
-    std::vector<LiveObject> _instances;
+    uint64_t _instancesCount;
+    uint64_t _instancesSize;
 };
-
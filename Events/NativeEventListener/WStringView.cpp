@@ -0,0 +1,87 @@
+#include <windows.h>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__SSE2__)
+#include <emmintrin.h>
+#define WSTRING_SCAN_SSE2 1
+#endif
+
+#include "WStringView.h"
+
+
+uint32_t WStringView::ScanForEnd(const uint8_t* pChars, uint32_t charsCount, uint16_t maxCharacter)
+{
+    uint32_t index = 0;
+
+#ifdef WSTRING_SCAN_SSE2
+    // 8 characters at a time: look for 0 or > maxCharacter (the saturated subtraction is not 0)
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i maxCharacters = _mm_set1_epi16((short)maxCharacter);
+    for (; index + 8 <= charsCount; index += 8)
+    {
+        __m128i characters = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pChars + index * sizeof(uint16_t)));
+        __m128i isEnd = _mm_cmpeq_epi16(characters, zero);
+        __m128i isValid = _mm_cmpeq_epi16(_mm_subs_epu16(characters, maxCharacters), zero);
+        if ((_mm_movemask_epi8(isEnd) | (_mm_movemask_epi8(isValid) ^ 0xFFFF)) != 0)
+        {
+            // the exact position is found by the scalar loop below
+            break;
+        }
+    }
+#endif
+
+    for (; index < charsCount; index++)
+    {
+        uint16_t character;
+        memcpy(&character, pChars + index * sizeof(uint16_t), sizeof(character));
+        if ((character == 0) || (character > maxCharacter))
+            break;
+    }
+
+    return index;
+}
+
+bool WStringView::Equals(const wchar_t* wstr) const
+{
+    uint32_t index = 0;
+    for (; index < _length; index++)
+    {
+        if ((wstr[index] == L'\0') || ((uint16_t)wstr[index] != GetAt(index)))
+            return false;
+    }
+
+    return (wstr[index] == L'\0');
+}
+
+std::wstring WStringView::ToWString() const
+{
+    std::wstring wstring;
+    wstring.resize(_length);
+    for (uint32_t index = 0; index < _length; index++)
+    {
+        wstring[index] = GetAt(index);
+    }
+
+    return wstring;
+}
+
+std::string WStringView::ToString() const
+{
+    std::wstring wstring = ToWString();
+    int size = WideCharToMultiByte(CP_ACP, 0, wstring.c_str(), -1, NULL, 0, NULL, NULL);
+    std::string str(size, '\0');
+    size = WideCharToMultiByte(CP_ACP, 0, wstring.c_str(), -1, &str[0], size, NULL, NULL);
+
+    // remove the \0 counted by WideCharToMultiByte
+    str.resize((size > 0) ? size - 1 : 0);
+    return str;
+}
+
+std::wostream& operator<<(std::wostream& stream, const WStringView& view)
+{
+    for (uint32_t index = 0; index < view.GetLength(); index++)
+    {
+        stream.put(view.GetAt(index));
+    }
+
+    return stream;
+}
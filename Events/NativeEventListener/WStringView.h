@@ -0,0 +1,59 @@
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+#include <iostream>
+#include <string>
+
+
+// the ExceptionThrown event could miss fields so a character above 256 means that the string is not there
+const uint16_t MaxStringCharacter = 256;
+const uint16_t NoMaxCharacter = 0xFFFF;
+
+
+// Non-owning view on a UTF-16 string stored in an event payload (without its \0 terminator).
+// The characters stay in the block being parsed: the view must not be kept after the handler returns
+// and ToWString() must be called to keep a copy of the string.
+// Note: the characters are not necessarily aligned on 2 bytes in the block
+class WStringView
+{
+public:
+    WStringView()
+    {
+        _pChars = nullptr;
+        _length = 0;
+    }
+
+    WStringView(const uint8_t* pChars, uint32_t length)
+    {
+        _pChars = pChars;
+        _length = length;
+    }
+
+    bool IsEmpty() const { return _length == 0; }
+    uint32_t GetLength() const { return _length; }
+
+    uint16_t GetAt(uint32_t index) const
+    {
+        uint16_t character;
+        memcpy(&character, _pChars + index * sizeof(uint16_t), sizeof(character));
+        return character;
+    }
+
+    bool Equals(const wchar_t* wstr) const;
+
+    // materialize the string only when a consumer needs to keep it
+    std::wstring ToWString() const;
+    std::string ToString() const;
+
+    // return the number of characters before the first \0 or the first invalid character (> maxCharacter)
+    // in the given buffer or charsCount if none is found
+    // Note: SSE2 is used to check 8 characters at once when available
+    static uint32_t ScanForEnd(const uint8_t* pChars, uint32_t charsCount, uint16_t maxCharacter = MaxStringCharacter);
+
+private:
+    const uint8_t* _pChars;
+    uint32_t _length;
+};
+
+std::wostream& operator<<(std::wostream& stream, const WStringView& view);